@@ -0,0 +1,98 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_ALIAS_TABLE_H_
+#define BEATRICE_COMMON_ALIAS_TABLE_H_
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <random>
+
+namespace beatrice::common {
+
+// Walker の alias method による離散分布からのサンプラー。
+// 重みが変わったときに Build() で表を作り直し、
+// 1 回の抽選は O(1) かつヒープ確保なしで行う。
+template <std::size_t kMaxN>
+class AliasTable {
+ public:
+  // Build() するまでは常に 0 を返す
+  AliasTable() : n_(1), prob_{1.0}, alias_{0}, values_{0}, small_(), large_() {}
+
+  // weights[argsorted_indices[i]] (i < n) のうち正のものだけを使って表を作る。
+  // 正の重みが 1 つも無ければ argsorted_indices[0] を常に返す表になる。
+  void Build(const int n, const float* const weights,
+             const int* const argsorted_indices) {
+    n_ = 0;
+    auto sum = 0.0;
+    for (auto i = 0; i < n && n_ < static_cast<int>(kMaxN); ++i) {
+      const auto idx = argsorted_indices[i];
+      if (!(weights[idx] > 0.0f)) {
+        continue;
+      }
+      values_[n_] = idx;
+      prob_[n_] = weights[idx];
+      sum += weights[idx];
+      ++n_;
+    }
+    if (n_ == 0) {
+      n_ = 1;
+      values_[0] = n > 0 ? argsorted_indices[0] : 0;
+      prob_[0] = 1.0;
+      alias_[0] = 0;
+      return;
+    }
+
+    // 平均が 1 になるようにスケールし、1 未満と 1 以上に振り分ける
+    auto n_small = 0;
+    auto n_large = 0;
+    for (auto i = 0; i < n_; ++i) {
+      prob_[i] *= n_ / sum;
+      alias_[i] = i;
+      if (prob_[i] < 1.0) {
+        small_[n_small++] = i;
+      } else {
+        large_[n_large++] = i;
+      }
+    }
+    while (n_small > 0 && n_large > 0) {
+      const auto s = small_[--n_small];
+      const auto l = large_[n_large - 1];
+      alias_[s] = l;
+      prob_[l] -= 1.0 - prob_[s];
+      if (prob_[l] < 1.0) {
+        --n_large;
+        small_[n_small++] = l;
+      }
+    }
+    // 丸め誤差で残ったものは確率 1 とする
+    while (n_large > 0) {
+      prob_[large_[--n_large]] = 1.0;
+    }
+    while (n_small > 0) {
+      prob_[small_[--n_small]] = 1.0;
+    }
+  }
+
+  template <typename URBG>
+  auto operator()(URBG& engine) -> int {
+    assert(n_ > 0);
+    const auto u = std::generate_canonical<double, 53>(engine) * n_;
+    const auto i = std::min(static_cast<int>(u), n_ - 1);
+    return values_[u - i < prob_[i] ? i : alias_[i]];
+  }
+
+ private:
+  int n_;
+  std::array<double, kMaxN> prob_;
+  std::array<int, kMaxN> alias_;
+  std::array<int, kMaxN> values_;
+  // Build() の作業領域
+  std::array<int, kMaxN> small_;
+  std::array<int, kMaxN> large_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_ALIAS_TABLE_H_
@@ -0,0 +1,482 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_BASIC_PROCESSOR_CORE_H_
+#define BEATRICE_COMMON_BASIC_PROCESSOR_CORE_H_
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include "beatricelib/beatrice.h"
+
+// Beatrice
+#include "common/error.h"
+#include "common/gain.h"
+#include "common/model_config.h"
+#include "common/pitch_calibrator.h"
+#include "common/pitch_mapping.h"
+#include "common/processor_core.h"
+#include "common/resample.h"
+#include "common/spherical_average.h"
+
+namespace beatrice::common {
+
+// 話者埋め込みを波形生成器に直接渡す世代 (2.0.0-alpha.2, 2.0.0-beta.1)
+// の信号処理クラス。
+// バージョンごとの違いは Traits にまとめ、以下を持たせる。
+//   kVersion, kPhoneChannels, kPitchBins, kHasMorphingQuality
+//   PhoneExtractor などの型と、CreatePhoneExtractor などの API の関数ポインタ
+// 関数ポインタは constexpr なので、フレームごとの処理では直接呼び出しになる
+template <typename Traits>
+class BasicProcessorCore final : public ProcessorCoreBase {
+ public:
+  explicit BasicProcessorCore(const double sample_rate)
+      : ProcessorCoreBase(),
+        any_freq_in_out_(sample_rate),
+        phone_extractor_(Traits::CreatePhoneExtractor()),
+        pitch_estimator_(Traits::CreatePitchEstimator()),
+        waveform_generator_(Traits::CreateWaveformGenerator()),
+        gain_(),
+        phone_context_(Traits::CreatePhoneContext()),
+        pitch_context_(Traits::CreatePitchContext()),
+        waveform_context_(Traits::CreateWaveformContext()),
+        input_gain_context_(sample_rate),
+        output_gain_context_(sample_rate),
+        speaker_morphing_weights_(),
+        calibration_pitch_context_(Traits::CreatePitchContext()) {
+    // 範囲を測るため、Min/Max Source Pitch による制限は掛けない
+    Traits::SetMinQuantizedPitch(calibration_pitch_context_, 1);
+    Traits::SetMaxQuantizedPitch(calibration_pitch_context_,
+                                 Traits::kPitchBins - 1);
+  }
+  ~BasicProcessorCore() override {
+    Traits::DestroyPhoneExtractor(phone_extractor_);
+    Traits::DestroyPitchEstimator(pitch_estimator_);
+    Traits::DestroyWaveformGenerator(waveform_generator_);
+    Traits::DestroyPhoneContext(phone_context_);
+    Traits::DestroyPitchContext(pitch_context_);
+    Traits::DestroyWaveformContext(waveform_context_);
+    Traits::DestroyPitchContext(calibration_pitch_context_);
+  }
+  [[nodiscard]] auto GetVersion() const -> int override {
+    return Traits::kVersion;
+  }
+  auto Process(const float* input, float* output, int n_samples)
+      -> ErrorCode override;
+  auto ResetContext() -> ErrorCode override;
+  auto LoadModel(const ModelConfig& /*config*/,
+                 const std::filesystem::path& /*file*/) -> ErrorCode override;
+  [[nodiscard]] auto GetSourcePitchStatistics() const
+      -> SourcePitchStatistics override {
+    return pitch_calibrator_.GetStatistics();
+  }
+  auto SetSampleRate(double /*sample_rate*/) -> ErrorCode override;
+  auto SetTargetSpeaker(int /*target_speaker*/) -> ErrorCode override;
+  auto SetFormantShift(double /*formant_shift*/) -> ErrorCode override;
+  auto SetPitchShift(double /*pitch_shift*/) -> ErrorCode override;
+  auto SetInputGain(double /*input_gain*/) -> ErrorCode override;
+  auto SetOutputGain(double /*output_gain*/) -> ErrorCode override;
+  auto SetAverageSourcePitch(double /*average_pitch*/) -> ErrorCode override;
+  // NOLINTNEXTLINE(readability/casting)
+  auto SetIntonationIntensity(double /*intonation_intensity*/)
+      -> ErrorCode override;
+  auto SetPitchCorrection(double /*pitch_correction*/) -> ErrorCode override;
+  // NOLINTNEXTLINE(readability/casting)
+  auto SetPitchCorrectionType(int /*pitch_correction_type*/)
+      -> ErrorCode override;
+  auto SetMinSourcePitch(double /*min_source_pitch*/) -> ErrorCode override;
+  auto SetMaxSourcePitch(double /*max_source_pitch*/) -> ErrorCode override;
+  auto SetSpeakerMorphingWeight(int /*target_speaker*/,
+                                double /*morphing weight*/
+                                )      // NOLINT(whitespace/parens)
+      -> ErrorCode override;
+  auto SetSpeakerMorphingWeights(std::span<const double> /*weights*/)
+      -> ErrorCode override;
+  auto SetMorphingQuality(int /*morphing_quality*/) -> ErrorCode override;
+  auto SetPitchCalibration(bool /*pitch_calibration*/) -> ErrorCode override;
+
+ private:
+  class ConvertWithModelBlockSize {
+   public:
+    ConvertWithModelBlockSize() = default;
+    void operator()(const float* const input, float* const output,
+                    BasicProcessorCore& processor_core) const {
+      processor_core.Process1(input, output);
+    }
+  };
+
+  std::filesystem::path model_file_;
+  int target_speaker_ = 0;
+  double formant_shift_ = 0.0;
+  int n_speakers_ = 0;
+  double min_source_pitch_ = 33.125;
+  double max_source_pitch_ = 80.875;
+
+  resampler::AnyFreqInOut<ConvertWithModelBlockSize> any_freq_in_out_;
+  PitchMapping<Traits::kPitchBins> pitch_mapping_;
+
+  // モデル
+  typename Traits::PhoneExtractor* phone_extractor_;
+  typename Traits::PitchEstimator* pitch_estimator_;
+  typename Traits::WaveformGenerator* waveform_generator_;
+  AlignedVector<float, 64> speaker_embeddings_;
+  std::vector<float> formant_shift_embeddings_;
+  Gain gain_;
+  // 状態
+  typename Traits::PhoneContext* phone_context_;
+  typename Traits::PitchContext* pitch_context_;
+  typename Traits::WaveformContext* waveform_context_;
+  Gain::Context input_gain_context_;
+  Gain::Context output_gain_context_;
+
+  // モデルマージ
+  std::array<float, kMaxNSpeakers> speaker_morphing_weights_;
+  SphericalAverage<float, BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS> sph_avg_;
+  MorphingQuality morphing_quality_ = MorphingQuality::kExact;
+  // これ以上 sph_avg_ を更新しなくてよいか
+  bool is_morphing_settled_ = false;
+
+  // 統計専用のピッチ推定の状態。
+  // オーディオスレッドで作らずに済むよう、常に作っておく
+  typename Traits::PitchContext* calibration_pitch_context_;
+  PitchCalibrator<Traits::kPitchBins> pitch_calibrator_;
+  bool is_pitch_calibrating_ = false;
+
+  auto IsLoaded() -> bool { return !model_file_.empty(); }
+  void Process1(const float* input, float* output);
+  void UpdateSpeakerMorphingWeights();
+  auto SetQuantizedPitchLimit(double pitch,
+                              void (*set)(typename Traits::PitchContext*, int))
+      -> ErrorCode;
+};
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::Process(const float* const input,
+                                         float* const output,
+                                         const int n_samples) -> ErrorCode {
+  const auto fill_zero = [output, n_samples] {
+    std::memset(output, 0, sizeof(float) * n_samples);
+  };
+  if (!IsLoaded()) {
+    return fill_zero(), ErrorCode::kModelNotLoaded;
+  }
+  if (!any_freq_in_out_.IsReady()) {
+    return fill_zero(), ErrorCode::kResamplerNotReady;
+  }
+  if (!input_gain_context_.IsReady()) {
+    return fill_zero(), ErrorCode::kGainNotReady;
+  }
+  if (!output_gain_context_.IsReady()) {
+    return fill_zero(), ErrorCode::kGainNotReady;
+  }
+  if (target_speaker_ < 0) {
+    return fill_zero(), ErrorCode::kSpeakerIDOutOfRange;
+  }
+  if (target_speaker_ > n_speakers_) {
+    return fill_zero(), ErrorCode::kSpeakerIDOutOfRange;
+  }
+  assert(static_cast<int>(formant_shift_embeddings_.size()) ==
+         9 * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  gain_.Process(input, output, n_samples, input_gain_context_);
+  any_freq_in_out_(output, output, n_samples, *this);
+  gain_.Process(output, output, n_samples, output_gain_context_);
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+void BasicProcessorCore<Traits>::Process1(const float* const input,
+                                          float* const output) {
+  if (is_pitch_calibrating_) {
+    // 変換は行わず、ピッチ推定の結果だけを集める
+    int quantized_pitch;
+    std::array<float, 4> pitch_feature;
+    Traits::EstimatePitch(pitch_estimator_, input, &quantized_pitch,
+                          pitch_feature.data(), calibration_pitch_context_);
+    pitch_calibrator_.Add(quantized_pitch);
+    std::memset(output, 0, sizeof(float) * BEATRICE_OUT_HOP_LENGTH);
+    return;
+  }
+  std::array<float, Traits::kPhoneChannels> phone;
+  Traits::ExtractPhone(phone_extractor_, input, phone.data(), phone_context_);
+  int quantized_pitch;
+  std::array<float, 4> pitch_feature;
+  Traits::EstimatePitch(pitch_estimator_, input, &quantized_pitch,
+                        pitch_feature.data(), pitch_context_);
+  // PitchShift, IntonationIntensity, PitchCorrection
+  quantized_pitch = pitch_mapping_(quantized_pitch);
+  std::array<float, BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS> speaker;
+  if (target_speaker_ == n_speakers_ && !is_morphing_settled_) {
+    if (!sph_avg_.Update()) {
+      sph_avg_.GetResult(
+          BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+          &speaker_embeddings_[n_speakers_ *
+                               BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS]);
+    }
+    // 1 回目の更新で線形ブレンドからほとんど動かなければ、それで十分とみなす
+    if (morphing_quality_ == MorphingQuality::kAuto &&
+        sph_avg_.GetApproximationAngle() <= kMorphingMaxApproximationAngle) {
+      is_morphing_settled_ = true;
+    }
+  }
+  std::memcpy(speaker.data(),
+              &speaker_embeddings_[target_speaker_ *
+                                   BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS],
+              sizeof(float) * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  const auto* const formant_shift_embedding =
+      &formant_shift_embeddings_[static_cast<int>(
+                                     std::round(formant_shift_ * 2 + 4)) *
+                                 BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS];
+  for (auto i = 0; i < BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS; ++i) {
+    speaker[i] += formant_shift_embedding[i];
+  }
+  Traits::GenerateWaveform(waveform_generator_, phone.data(), &quantized_pitch,
+                           pitch_feature.data(), speaker.data(), output,
+                           waveform_context_);
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::ResetContext() -> ErrorCode {
+  Traits::DestroyPhoneContext(phone_context_);
+  Traits::DestroyPitchContext(pitch_context_);
+  Traits::DestroyWaveformContext(waveform_context_);
+  phone_context_ = Traits::CreatePhoneContext();
+  pitch_context_ = Traits::CreatePitchContext();
+  waveform_context_ = Traits::CreateWaveformContext();
+  // パラメータを再設定
+  auto error = ErrorCode::kSuccess;
+  if (const auto err = SetMinSourcePitch(min_source_pitch_);
+      error == ErrorCode::kSuccess) {
+    error = err;
+  }
+  if (const auto err = SetMaxSourcePitch(max_source_pitch_);
+      error == ErrorCode::kSuccess) {
+    error = err;
+  }
+  return error;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::LoadModel(
+    const ModelConfig& /*config*/, const std::filesystem::path& new_model_file)
+    -> ErrorCode {
+  model_file_.clear();  // IsLoaded() が false を返すようにする
+
+  const auto d = new_model_file.parent_path();
+  if (const auto err = Traits::ReadPhoneExtractorParameters(
+          phone_extractor_,
+          reinterpret_cast<const char*>(
+              (d / "phone_extractor.bin").u8string().c_str()))) {
+    return static_cast<ErrorCode>(err);
+  }
+  if (const auto err = Traits::ReadPitchEstimatorParameters(
+          pitch_estimator_,
+          reinterpret_cast<const char*>(
+              (d / "pitch_estimator.bin").u8string().c_str()))) {
+    return static_cast<ErrorCode>(err);
+  }
+  if (const auto err = Traits::ReadWaveformGeneratorParameters(
+          waveform_generator_,
+          reinterpret_cast<const char*>(
+              (d / "waveform_generator.bin").u8string().c_str()))) {
+    return static_cast<ErrorCode>(err);
+  }
+  if (const auto err = Traits::ReadNSpeakers(
+          reinterpret_cast<const char*>(
+              (d / "speaker_embeddings.bin").u8string().c_str()),
+          &n_speakers_)) {
+    return static_cast<ErrorCode>(err);
+  }
+  speaker_embeddings_.resize(
+      (n_speakers_ + 1) * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS, 0.0f);
+  if (const auto err = Traits::ReadSpeakerEmbeddings(
+          reinterpret_cast<const char*>(
+              (d / "speaker_embeddings.bin").u8string().c_str()),
+          speaker_embeddings_.data())) {
+    return static_cast<ErrorCode>(err);
+  }
+  sph_avg_.Initialize(n_speakers_, BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+                      speaker_embeddings_.data());
+
+  formant_shift_embeddings_.resize(9 *
+                                   BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  if (const auto err = Traits::ReadSpeakerEmbeddings(
+          reinterpret_cast<const char*>(
+              (d / "formant_shift_embeddings.bin").u8string().c_str()),
+          formant_shift_embeddings_.data())) {
+    return static_cast<ErrorCode>(err);
+  }
+
+  model_file_ = new_model_file;
+
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetSampleRate(const double new_sample_rate)
+    -> ErrorCode {
+  if (new_sample_rate == any_freq_in_out_.GetSampleRate()) {
+    return ErrorCode::kSuccess;
+  }
+  any_freq_in_out_.SetSampleRate(new_sample_rate);
+  input_gain_context_.SetSampleRate(new_sample_rate);
+  output_gain_context_.SetSampleRate(new_sample_rate);
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetTargetSpeaker(
+    const int new_target_speaker_id) -> ErrorCode {
+  if (new_target_speaker_id < 0) {
+    return ErrorCode::kSpeakerIDOutOfRange;
+  }
+  target_speaker_ = new_target_speaker_id;
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetFormantShift(const double new_formant_shift)
+    -> ErrorCode {
+  formant_shift_ = std::clamp(new_formant_shift, -2.0, 2.0);
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetPitchShift(const double new_pitch_shift)
+    -> ErrorCode {
+  return pitch_mapping_.SetPitchShift(new_pitch_shift);
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetInputGain(const double new_input_gain)
+    -> ErrorCode {
+  input_gain_context_.SetTargetGain(new_input_gain);
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetOutputGain(const double new_output_gain)
+    -> ErrorCode {
+  output_gain_context_.SetTargetGain(new_output_gain);
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetSpeakerMorphingWeight(
+    const int target_speaker_id, const double morphing_weight) -> ErrorCode {
+  if (target_speaker_id < 0 || target_speaker_id >= kMaxNSpeakers) {
+    return ErrorCode::kSpeakerIDOutOfRange;
+  }
+  speaker_morphing_weights_[target_speaker_id] = morphing_weight;
+  UpdateSpeakerMorphingWeights();
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetSpeakerMorphingWeights(
+    const std::span<const double> weights) -> ErrorCode {
+  const auto n =
+      std::min(weights.size(), static_cast<std::size_t>(kMaxNSpeakers));
+  std::copy_n(weights.begin(), n, speaker_morphing_weights_.begin());
+  UpdateSpeakerMorphingWeights();
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+void BasicProcessorCore<Traits>::UpdateSpeakerMorphingWeights() {
+  // ここで得られるのは線形ブレンドによる近似で、
+  // kFast 以外では Process1() 内で球面平均に近付けていく
+  sph_avg_.SetWeights(n_speakers_, speaker_morphing_weights_.data());
+  sph_avg_.GetResult(
+      BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+      &speaker_embeddings_[n_speakers_ *
+                           BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS]);
+  is_morphing_settled_ = morphing_quality_ == MorphingQuality::kFast;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetMorphingQuality(
+    const int new_morphing_quality) -> ErrorCode {
+  // 対応していないバージョンでは常に球面平均を求める
+  if constexpr (Traits::kHasMorphingQuality) {
+    if (new_morphing_quality < 0 || new_morphing_quality > 2) {
+      return ErrorCode::kInvalidMorphingQuality;
+    }
+    morphing_quality_ = static_cast<MorphingQuality>(new_morphing_quality);
+    is_morphing_settled_ = morphing_quality_ == MorphingQuality::kFast;
+  }
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetPitchCalibration(
+    const bool new_pitch_calibration) -> ErrorCode {
+  if (new_pitch_calibration == is_pitch_calibrating_) {
+    return ErrorCode::kSuccess;
+  }
+  // 結果は次に測り始めるまで残しておく
+  if (new_pitch_calibration) {
+    pitch_calibrator_.Reset();
+  }
+  is_pitch_calibrating_ = new_pitch_calibration;
+  return ErrorCode::kSuccess;
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetAverageSourcePitch(
+    const double new_average_pitch) -> ErrorCode {
+  return pitch_mapping_.SetAverageSourcePitch(new_average_pitch);
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetIntonationIntensity(
+    const double new_intonation_intensity) -> ErrorCode {
+  return pitch_mapping_.SetIntonationIntensity(new_intonation_intensity);
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetPitchCorrection(
+    const double new_pitch_correction) -> ErrorCode {
+  return pitch_mapping_.SetPitchCorrection(new_pitch_correction);
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetPitchCorrectionType(
+    const int new_pitch_correction_type) -> ErrorCode {
+  return pitch_mapping_.SetPitchCorrectionType(new_pitch_correction_type);
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetMinSourcePitch(
+    const double new_min_source_pitch) -> ErrorCode {
+  min_source_pitch_ = std::clamp(new_min_source_pitch, 0.0, 128.0);
+  return SetQuantizedPitchLimit(min_source_pitch_,
+                                Traits::SetMinQuantizedPitch);
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetMaxSourcePitch(
+    const double new_max_source_pitch) -> ErrorCode {
+  max_source_pitch_ = std::clamp(new_max_source_pitch, 0.0, 128.0);
+  return SetQuantizedPitchLimit(max_source_pitch_,
+                                Traits::SetMaxQuantizedPitch);
+}
+
+template <typename Traits>
+auto BasicProcessorCore<Traits>::SetQuantizedPitchLimit(
+    const double pitch, void (*const set)(typename Traits::PitchContext*, int))
+    -> ErrorCode {
+  set(pitch_context_,
+      std::clamp(static_cast<int>(std::round(
+                     (pitch - 33.0) * (BEATRICE_PITCH_BINS_PER_OCTAVE / 12.0))),
+                 1, Traits::kPitchBins - 1));
+  return ErrorCode::kSuccess;
+}
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_BASIC_PROCESSOR_CORE_H_
@@ -0,0 +1,81 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_CACHE_DIRECTORY_H_
+#define BEATRICE_COMMON_CACHE_DIRECTORY_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <system_error>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+namespace beatrice::common {
+
+// 一時ディレクトリに置くキャッシュの直下の項目 (ファイルかディレクトリ) を
+// 使ったことを記録する。TrimCacheDirectory() は更新時刻の古いものから消す
+inline void TouchCacheEntry(const std::filesystem::path& entry) {
+  auto ec = std::error_code();
+  std::filesystem::last_write_time(
+      entry, std::filesystem::file_time_type::clock::now(), ec);
+}
+
+// root の直下の項目の合計の大きさが max_total_size 以下になるまで、
+// 更新時刻の古いものから消す。keep は消さない。
+// 他のプロセスが使っていて消せないものは飛ばす
+inline void TrimCacheDirectory(const std::filesystem::path& root,
+                               const std::uintmax_t max_total_size,
+                               const std::filesystem::path& keep) {
+  struct Entry {
+    std::filesystem::path path;
+    std::filesystem::file_time_type time;
+    std::uintmax_t size;
+  };
+  auto entries = std::vector<Entry>();
+  auto total_size = std::uintmax_t{0};
+  auto ec = std::error_code();
+  for (auto it = std::filesystem::directory_iterator(root, ec);
+       !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    auto entry = Entry{it->path(), it->last_write_time(ec), 0};
+    if (ec) {
+      ec.clear();
+      continue;
+    }
+    if (it->is_directory(ec)) {
+      for (auto sub = std::filesystem::recursive_directory_iterator(
+               entry.path, ec);
+           !ec && sub != std::filesystem::recursive_directory_iterator();
+           sub.increment(ec)) {
+        if (sub->is_regular_file(ec)) {
+          entry.size += sub->file_size(ec);
+        }
+      }
+    } else {
+      entry.size = it->file_size(ec);
+    }
+    ec.clear();
+    total_size += entry.size;
+    entries.push_back(std::move(entry));
+  }
+  if (total_size <= max_total_size) {
+    return;
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.time < b.time; });
+  for (const auto& entry : entries) {
+    if (total_size <= max_total_size) {
+      break;
+    }
+    if (entry.path == keep) {
+      continue;
+    }
+    if (std::filesystem::remove_all(entry.path, ec); !ec) {
+      total_size -= entry.size;
+    }
+    ec.clear();
+  }
+}
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_CACHE_DIRECTORY_H_
@@ -0,0 +1,279 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_CODEBOOK_MORPHER_H_
+#define BEATRICE_COMMON_CODEBOOK_MORPHER_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <cstring>
+#include <list>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "common/float16.h"
+#include "common/spherical_average.h"
+
+namespace beatrice::common {
+
+// VQ codebook の各エントリについて話者間の spherical average を求めるクラス。
+// codebook 全体の計算はエントリ数だけの球面平均を解く必要があり
+// 1 フレームの処理時間に収まらないので、バックグラウンドのワーカースレッドで
+// 計算し、完成したものをトリプルバッファ経由でオーディオスレッドに渡す。
+// 直近に計算した重みの組み合わせについては結果をキャッシュしておく。
+// Request(), Poll(), Current() はオーディオスレッドからのみ、
+// SetCodebooks() はそれ以外のスレッドからのみ呼ぶこと。
+// SetCodebooks() のたびに世代を進め、それより前の依頼や結果は捨てる。
+template <std::size_t kCodebookSize, std::size_t M, std::size_t kMaxNPoints>
+class CodebookMorpher {
+ public:
+  static constexpr int kMaxNUpdates = 4;
+  static constexpr std::size_t kCacheSize = 4;
+
+  CodebookMorpher()
+      : buffers_(),
+        middle_(1),
+        write_idx_(2),
+        read_idx_(0),
+        has_result_(false),
+        read_generation_(0),
+        generation_(0),
+        stop_(false),
+        has_request_(false) {
+    for (auto&& buffer : buffers_) {
+      buffer.resize(kCodebookSize * M, 0.0f);
+    }
+    worker_ = std::thread([this] { Run(); });
+  }
+  ~CodebookMorpher() {
+    {
+      const auto lock = std::lock_guard<std::mutex>(request_mtx_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+  }
+  CodebookMorpher(const CodebookMorpher&) = delete;
+  auto operator=(const CodebookMorpher&) -> CodebookMorpher& = delete;
+
+  // 元になる codebook を設定する。
+  // codebooks は n_speakers * kCodebookSize * M の大きさで、
+  // 呼び出し側が所有し続けること。
+  void SetCodebooks(const int n_speakers, const float* const codebooks) {
+    SetCodebooksImpl(n_speakers, codebooks, nullptr);
+  }
+  // 半精度で保持している codebook を設定する。計算の際に単精度に戻す
+  void SetCodebooks(const int n_speakers, const Float16* const codebooks) {
+    SetCodebooksImpl(n_speakers, nullptr, codebooks);
+  }
+
+  // モーフィング重みを登録し、ワーカースレッドに計算を依頼する。
+  // weights は話者 ID で引く重みで、argsorted_indices は重みの降順に並べた
+  // 話者 ID。approximate が true なら球面平均の反復を省き、
+  // 正規化した重み付き線形和で近似する。
+  // ブロックしないので、ワーカーが依頼を受け取れなかった場合は
+  // false を返す。その場合は次のフレームで再度呼ぶこと。
+  auto Request(const int n_speakers, const float* const weights,
+               const int* const argsorted_indices, const bool approximate)
+      -> bool {
+    auto lock = std::unique_lock<std::mutex>(request_mtx_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      return false;
+    }
+    auto& request = request_;
+    request.generation = generation_.load(std::memory_order_relaxed);
+    request.approximate = approximate;
+    request.n = 0;
+    for (auto i = 0; i < std::min(n_speakers, static_cast<int>(kMaxNPoints));
+         ++i) {
+      const auto idx = argsorted_indices[i];
+      if (weights[idx] <= 0.0f) {
+        break;
+      }
+      request.indices[request.n] = idx;
+      request.weights[request.n] = weights[idx];
+      ++request.n;
+    }
+    has_request_ = true;
+    lock.unlock();
+    cv_.notify_one();
+    return true;
+  }
+
+  // 新しい計算結果があればそれを返す。無ければ nullptr を返す。
+  // 返したバッファは次に新しい結果を返すまで有効。
+  [[nodiscard]] auto Poll() -> const float* {
+    // codebook が差し替えられていれば、受け取り済みの結果も捨てる
+    const auto generation = generation_.load(std::memory_order_acquire);
+    if (read_generation_ != generation) {
+      read_generation_ = generation;
+      has_result_ = false;
+    }
+    if ((middle_.load(std::memory_order_relaxed) & kFreshBit) == 0) {
+      return nullptr;
+    }
+    read_idx_ = middle_.exchange(read_idx_, std::memory_order_acq_rel) &
+                ~kFreshBit;
+    if (buffer_generations_[read_idx_] != generation) {
+      return nullptr;
+    }
+    has_result_ = true;
+    return buffers_[read_idx_].data();
+  }
+
+  // 最後に Poll() で受け取った結果を返す。まだ無ければ nullptr を返す。
+  [[nodiscard]] auto Current() const -> const float* {
+    return has_result_ &&
+                   read_generation_ ==
+                       generation_.load(std::memory_order_acquire)
+               ? buffers_[read_idx_].data()
+               : nullptr;
+  }
+
+ private:
+  static constexpr int kFreshBit = 4;
+
+  struct MorphRequest {
+    unsigned int generation = 0;
+    bool approximate = false;
+    int n = 0;
+    std::array<int, kMaxNPoints> indices;
+    std::array<float, kMaxNPoints> weights;
+    auto operator==(const MorphRequest& rhs) const -> bool {
+      return approximate == rhs.approximate && n == rhs.n &&
+             std::equal(indices.begin(), indices.begin() + n,
+                        rhs.indices.begin()) &&
+             std::equal(weights.begin(), weights.begin() + n,
+                        rhs.weights.begin());
+    }
+  };
+  struct CacheEntry {
+    MorphRequest request;
+    AlignedVector<float, 64> codebook;
+  };
+
+  void SetCodebooksImpl(const int n_speakers, const float* const codebooks,
+                        const Float16* const half_codebooks) {
+    // 前のモデルの話者 ID で計算しないよう、未処理の依頼を捨てて世代を進める
+    {
+      const auto lock = std::lock_guard<std::mutex>(request_mtx_);
+      has_request_ = false;
+      request_ = MorphRequest();
+      generation_.fetch_add(1, std::memory_order_acq_rel);
+    }
+    const auto lock = std::lock_guard<std::mutex>(compute_mtx_);
+    n_speakers_ = n_speakers;
+    codebooks_ = codebooks;
+    half_codebooks_ = half_codebooks;
+    cache_.clear();
+  }
+
+  void Run() {
+    auto request = MorphRequest();
+    while (true) {
+      {
+        auto lock = std::unique_lock<std::mutex>(request_mtx_);
+        cv_.wait(lock, [this] { return stop_ || has_request_; });
+        if (stop_) {
+          return;
+        }
+        request = request_;
+        has_request_ = false;
+      }
+      const auto lock = std::lock_guard<std::mutex>(compute_mtx_);
+      // 依頼を受け取ってから codebook が差し替えられていれば捨てる
+      if ((codebooks_ == nullptr && half_codebooks_ == nullptr) ||
+          request.n == 0 ||
+          request.generation !=
+              generation_.load(std::memory_order_acquire) ||
+          std::any_of(request.indices.begin(),
+                      request.indices.begin() + request.n,
+                      [this](const int idx) {
+                        return idx < 0 || idx >= n_speakers_;
+                      })) {
+        continue;
+      }
+      auto* const dst = buffers_[write_idx_].data();
+      if (const auto itr = std::ranges::find_if(
+              cache_,
+              [&request](const auto& e) { return e.request == request; });
+          itr != cache_.end()) {
+        std::memcpy(dst, itr->codebook.data(),
+                    sizeof(float) * kCodebookSize * M);
+        cache_.splice(cache_.begin(), cache_, itr);
+      } else {
+        Compute(request, dst);
+        if (cache_.size() >= kCacheSize) {
+          cache_.pop_back();
+        }
+        cache_.push_front({request, AlignedVector<float, 64>(
+                                        dst, dst + kCodebookSize * M)});
+      }
+      buffer_generations_[write_idx_] = request.generation;
+      write_idx_ = middle_.exchange(write_idx_ | kFreshBit,
+                                    std::memory_order_acq_rel) &
+                   ~kFreshBit;
+    }
+  }
+
+  // 選ばれた話者の点だけを集めて、エントリごとに球面平均を解く
+  void Compute(const MorphRequest& request, float* const dst) {
+    const auto n = static_cast<std::size_t>(request.n);
+    auto block = AlignedVector<float, 64>(n * M);
+    auto weights = std::array<float, kMaxNPoints>();
+    std::copy_n(request.weights.begin(), n, weights.begin());
+    for (std::size_t i = 0; i < kCodebookSize; ++i) {
+      for (std::size_t j = 0; j < n; ++j) {
+        const auto offset = (request.indices[j] * kCodebookSize + i) * M;
+        if (half_codebooks_ != nullptr) {
+          ConvertToFloat(half_codebooks_ + offset, block.data() + j * M, M);
+        } else {
+          std::copy_n(codebooks_ + offset, M, block.data() + j * M);
+        }
+      }
+      sph_avg_.Initialize(n, M, block.data(), n);
+      sph_avg_.SetWeights(n, weights.data());
+      for (auto k = 0; k < kMaxNUpdates && !request.approximate; ++k) {
+        if (sph_avg_.Update()) break;
+      }
+      sph_avg_.GetResult(M, dst + i * M);
+    }
+  }
+
+  // トリプルバッファ
+  std::array<AlignedVector<float, 64>, 3> buffers_;
+  std::atomic<int> middle_;
+  int write_idx_;  // ワーカースレッドのみが触る
+  int read_idx_;   // オーディオスレッドのみが触る
+  bool has_result_;  // オーディオスレッドのみが触る
+  unsigned int read_generation_;  // オーディオスレッドのみが触る
+  // 各バッファの結果がどの世代の codebook から計算されたか
+  std::array<unsigned int, 3> buffer_generations_ = {};
+  // SetCodebooks() のたびに進む
+  std::atomic<unsigned int> generation_;
+
+  // ワーカーが計算に使うもの
+  std::mutex compute_mtx_;
+  int n_speakers_ = 0;
+  const float* codebooks_ = nullptr;
+  const Float16* half_codebooks_ = nullptr;
+  SphericalAverage<float, M> sph_avg_;
+  std::list<CacheEntry> cache_;
+
+  // ワーカーへの依頼
+  std::mutex request_mtx_;
+  std::condition_variable cv_;
+  bool stop_;
+  bool has_request_;
+  MorphRequest request_;
+
+  std::thread worker_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_CODEBOOK_MORPHER_H_
@@ -0,0 +1,184 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_CORE_LOADER_H_
+#define BEATRICE_COMMON_CORE_LOADER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+
+#include "common/error.h"
+#include "common/processor_core.h"
+
+namespace beatrice::common {
+
+// ProcessorCore の作成とモデルの読み込みをバックグラウンドのスレッドで行い、
+// 完成したものをオーディオスレッドに渡すクラス。
+// 使い終わった ProcessorCore の破棄もバックグラウンドのスレッドで行う。
+// TakeLoadedCore(), CanRetire(), Retire(), Wake() は待ちもメモリ確保も
+// 行わないのでオーディオスレッドから呼べる。Request() と Cancel() は
+// それ以外のスレッドから呼ぶこと。
+// バックグラウンドのスレッドは、これらで起こされるまで眠っている
+class CoreLoader {
+ public:
+  // ProcessorCore を作り、読み込みの結果を error に入れる
+  using Job = std::function<std::unique_ptr<ProcessorCoreBase>(ErrorCode&)>;
+  // 完成した ProcessorCore が受け取られるまでの間、
+  // 依頼した後の変更をバックグラウンドのスレッドで反映する
+  using Refresh = std::function<void(std::unique_ptr<ProcessorCoreBase>&)>;
+
+  CoreLoader()
+      : loaded_(nullptr),
+        loaded_error_(ErrorCode::kSuccess),
+        retired_(nullptr),
+        wake_(0),
+        worker_([this] { Run(); }) {}
+  ~CoreLoader() {
+    {
+      const auto lock = std::lock_guard<std::mutex>(mtx_);
+      stop_ = true;
+    }
+    Wake();
+    worker_.join();
+    delete loaded_.exchange(nullptr);
+    delete retired_.exchange(nullptr);
+  }
+  CoreLoader(const CoreLoader&) = delete;
+  auto operator=(const CoreLoader&) -> CoreLoader& = delete;
+
+  // job をバックグラウンドのスレッドで実行させ、結果が受け取られるまでは
+  // 受け渡す前と、Wake() で起こされるたびに refresh を適用させる。
+  // 以前の依頼の結果は、受け取られていなければ捨てられる
+  void Request(Job job, Refresh refresh) {
+    {
+      const auto lock = std::lock_guard<std::mutex>(mtx_);
+      job_ = std::move(job);
+      refresh_ = std::move(refresh);
+      ++generation_;
+      delete loaded_.exchange(nullptr, std::memory_order_acq_rel);
+    }
+    Wake();
+  }
+  // 依頼を取り下げ、受け取られていない結果を捨てる
+  void Cancel() {
+    const auto lock = std::lock_guard<std::mutex>(mtx_);
+    job_ = nullptr;
+    refresh_ = nullptr;
+    ++generation_;
+    delete loaded_.exchange(nullptr, std::memory_order_acq_rel);
+  }
+
+  // バックグラウンドのスレッドを起こし、Retire() されたものを破棄させ、
+  // 受け取られていない結果があれば refresh を適用し直させる
+  void Wake() {
+    wake_.fetch_add(1, std::memory_order_release);
+    wake_.notify_one();
+  }
+
+  // 最後の依頼が完了していれば、その結果を返し、
+  // 読み込みの結果を error に入れる。
+  // 無ければ nullptr
+  auto TakeLoadedCore(ErrorCode& error) -> std::unique_ptr<ProcessorCoreBase> {
+    auto core = std::unique_ptr<ProcessorCoreBase>(
+        loaded_.exchange(nullptr, std::memory_order_acq_rel));
+    if (core) {
+      error = loaded_error_.load(std::memory_order_relaxed);
+    }
+    return core;
+  }
+
+  // Retire() で渡せる空きがあるか
+  [[nodiscard]] auto CanRetire() const -> bool {
+    return retired_.load(std::memory_order_acquire) == nullptr;
+  }
+  // core の破棄をバックグラウンドのスレッドに任せる。
+  // 空きが無ければ core はそのままで false を返す
+  auto Retire(std::unique_ptr<ProcessorCoreBase>& core) -> bool {
+    auto* expected = static_cast<ProcessorCoreBase*>(nullptr);
+    if (!retired_.compare_exchange_strong(expected, core.get(),
+                                          std::memory_order_acq_rel)) {
+      return false;
+    }
+    static_cast<void>(core.release());
+    Wake();
+    return true;
+  }
+
+ private:
+  void Run() {
+    auto lock = std::unique_lock<std::mutex>(mtx_);
+    while (true) {
+      // 以下を確かめている間に起こされた場合は、眠らずにもう一度確かめる
+      const auto wake = wake_.load(std::memory_order_acquire);
+      delete retired_.exchange(nullptr, std::memory_order_acq_rel);
+      if (stop_) {
+        return;
+      }
+      if (job_ == nullptr) {
+        // 受け取られるまでの間に変更されたものを反映しておく
+        if (auto core = std::unique_ptr<ProcessorCoreBase>(
+                loaded_.exchange(nullptr, std::memory_order_acq_rel))) {
+          Publish(lock, std::move(core), loaded_error_.load());
+        }
+        lock.unlock();
+        wake_.wait(wake, std::memory_order_acquire);
+        lock.lock();
+        continue;
+      }
+      auto job = std::move(job_);
+      job_ = nullptr;
+      const auto generation = generation_;
+      lock.unlock();
+      auto error = ErrorCode::kSuccess;
+      auto core = job(error);
+      lock.lock();
+      if (generation != generation_) {
+        // 読み込み中に新しい依頼が来たので、結果は使わない
+        lock.unlock();
+        core.reset();
+        lock.lock();
+        continue;
+      }
+      Publish(lock, std::move(core), error);
+    }
+  }
+
+  // refresh_ を適用してから、オーディオスレッドが受け取れるようにする
+  void Publish(std::unique_lock<std::mutex>& lock,
+               std::unique_ptr<ProcessorCoreBase> core, const ErrorCode error) {
+    const auto generation = generation_;
+    if (auto refresh = refresh_) {
+      lock.unlock();
+      refresh(core);
+      lock.lock();
+    }
+    if (generation != generation_) {
+      lock.unlock();
+      core.reset();
+      lock.lock();
+      return;
+    }
+    loaded_error_.store(error, std::memory_order_relaxed);
+    delete loaded_.exchange(core.release(), std::memory_order_acq_rel);
+  }
+
+  std::mutex mtx_;
+  bool stop_ = false;
+  Job job_;
+  Refresh refresh_;
+  std::uint64_t generation_ = 0;
+  std::atomic<ProcessorCoreBase*> loaded_;
+  std::atomic<ErrorCode> loaded_error_;
+  std::atomic<ProcessorCoreBase*> retired_;
+  std::atomic<std::uint32_t> wake_;
+
+  std::thread worker_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_CORE_LOADER_H_
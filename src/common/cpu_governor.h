@@ -0,0 +1,115 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_CPU_GOVERNOR_H_
+#define BEATRICE_COMMON_CPU_GOVERNOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+
+namespace beatrice::common {
+
+// 処理の品質の段階。値が大きいほど処理が軽く、
+// 値の小さい段階の処理も併せて行う。音質への影響が小さいものから順に並べる
+enum class QualityTier : int {
+  kFull = 0,
+  // モーフィングの更新を負荷が下がるまで止める
+  kDeferMorphing = 1,
+  // モーフィングを線形ブレンドで近似する
+  kApproximateMorphing = 2,
+  // VQ を使わない
+  kNoVQ = 3,
+};
+inline constexpr int kNQualityTiers = 4;
+
+// フレームごとの処理時間をフレームの長さと比べ、
+// 負荷が高ければ品質の段階を下げ、余裕が戻れば上げるクラス。
+// 段階が行ったり来たりしないよう、下げる閾値と上げる閾値を離し、
+// 段階を変えた後はしばらく次の変更を待つ。
+// Update() と SetEnabled() は同じ 1 つのスレッドから呼ぶこと。
+// 段階と締め切り超過の回数は任意のスレッドから読める。
+class CpuGovernor {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // 負荷 (処理時間 / フレームの長さ) の移動平均がこれを超えたら段階を下げる
+  static constexpr double kStepDownLoad = 0.7;
+  // 負荷の移動平均がこれを下回ったら段階を上げる
+  static constexpr double kStepUpLoad = 0.3;
+  // 段階を下げた後、次に変更するまでに待つフレーム数
+  static constexpr int kStepDownHoldHops = 50;
+  // 段階を上げた後、次に変更するまでに待つフレーム数
+  static constexpr int kStepUpHoldHops = 300;
+
+  explicit CpuGovernor(const Clock::duration hop_duration)
+      : hop_duration_(hop_duration) {}
+
+  // n_hops フレームの処理に elapsed かかったことを記録する。
+  // 段階が変わったら true を返す
+  auto Update(const Clock::duration elapsed, const int n_hops) -> bool {
+    if (n_hops <= 0) {
+      return false;
+    }
+    const auto budget = hop_duration_ * n_hops;
+    if (const auto count =
+            deadline_miss_count_.load(std::memory_order_relaxed);
+        elapsed > budget && count < kMaxCount) {
+      deadline_miss_count_.store(count + 1, std::memory_order_relaxed);
+    }
+    const auto load = std::chrono::duration<double>(elapsed).count() /
+                      std::chrono::duration<double>(budget).count();
+    // 1 フレームあたり 1/16 の重みで追従する
+    const auto alpha = std::min(1.0, n_hops / 16.0);
+    average_load_ += alpha * (load - average_load_);
+
+    hold_hops_ = std::max(hold_hops_ - n_hops, 0);
+    if (!is_enabled_ || hold_hops_ > 0) {
+      return false;
+    }
+    const auto tier = tier_.load(std::memory_order_relaxed);
+    if (average_load_ > kStepDownLoad && tier + 1 < kNQualityTiers) {
+      tier_.store(tier + 1, std::memory_order_relaxed);
+      hold_hops_ = kStepDownHoldHops;
+      return true;
+    }
+    if (average_load_ < kStepUpLoad && tier > 0) {
+      tier_.store(tier - 1, std::memory_order_relaxed);
+      hold_hops_ = kStepUpHoldHops;
+      return true;
+    }
+    return false;
+  }
+
+  // 無効にすると最高品質に戻す。段階が変わったら true を返す
+  auto SetEnabled(const bool enabled) -> bool {
+    is_enabled_ = enabled;
+    if (!enabled && tier_.load(std::memory_order_relaxed) != 0) {
+      tier_.store(0, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+  // 負荷 (1 フレームの処理時間 / フレームの長さ) の移動平均。
+  // まだ測っていなければ 0 を返す。Update() と同じスレッドから呼ぶこと
+  [[nodiscard]] auto GetAverageLoad() const -> double { return average_load_; }
+  [[nodiscard]] auto GetTier() const -> QualityTier {
+    return static_cast<QualityTier>(tier_.load(std::memory_order_relaxed));
+  }
+  [[nodiscard]] auto GetDeadlineMissCount() const -> int {
+    return deadline_miss_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr int kMaxCount = 1 << 30;
+
+  Clock::duration hop_duration_;
+  bool is_enabled_ = false;
+  int hold_hops_ = 0;
+  double average_load_ = 0.0;
+  std::atomic<int> tier_ = 0;
+  std::atomic<int> deadline_miss_count_ = 0;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_CPU_GOVERNOR_H_
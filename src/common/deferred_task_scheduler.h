@@ -0,0 +1,107 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_DEFERRED_TASK_SCHEDULER_H_
+#define BEATRICE_COMMON_DEFERRED_TASK_SCHEDULER_H_
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+namespace beatrice::common {
+
+// 1 フレームの推論が終わった後の残り時間で、
+// 後回しにできる重い処理を少しずつ進めるクラス。
+// タスクは「1 単位の処理を行い、まだ残りがあれば true を返す関数」で、
+// ID の小さいものから優先して実行する。
+// 各タスクの 1 単位の実行時間を計測しておき、締め切りまでに
+// 終わらないと見込まれる場合はそのフレームでの実行を打ち切る。
+template <std::size_t kNTasks>
+class DeferredTaskScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Step = std::function<bool()>;
+
+  DeferredTaskScheduler()
+      : steps_(), is_pending_{}, is_suspended_{}, estimated_costs_{} {}
+
+  // メモリ確保が発生するので、オーディオスレッド以外から呼ぶこと
+  void SetTask(const std::size_t id, Step step) {
+    assert(id < kNTasks);
+    steps_[id] = std::move(step);
+  }
+  void Schedule(const std::size_t id) {
+    assert(id < kNTasks);
+    is_pending_[id] = true;
+  }
+  void Cancel(const std::size_t id) {
+    assert(id < kNTasks);
+    is_pending_[id] = false;
+  }
+  void Clear() { is_pending_.fill(false); }
+  // 一時停止中のタスクは予約されたまま Run() で実行されなくなる
+  void SetSuspended(const std::size_t id, const bool suspended) {
+    assert(id < kNTasks);
+    is_suspended_[id] = suspended;
+  }
+  [[nodiscard]] auto IsPending(const std::size_t id) const -> bool {
+    assert(id < kNTasks);
+    return is_pending_[id];
+  }
+
+  // deadline までに終わると見込まれる分だけ処理を進める。
+  // 見積もりが大きすぎて処理が一切進まなくなるのを防ぐため、
+  // 残っている処理があれば最低 1 単位は実行する。
+  void Run(const Clock::time_point deadline) {
+    auto n_executed = 0;
+    for (std::size_t id = 0; id < kNTasks; ++id) {
+      while (is_pending_[id] && !is_suspended_[id]) {
+        const auto start = Clock::now();
+        if (n_executed > 0 && start + estimated_costs_[id] > deadline) {
+          return;
+        }
+        is_pending_[id] = steps_[id]();
+        ++n_executed;
+        // 見積もりは最大値を保持しつつ、ゆっくり減衰させる
+        const auto cost = Clock::now() - start;
+        estimated_costs_[id] =
+            std::max(cost, estimated_costs_[id] - estimated_costs_[id] / 8);
+        // 実行中に優先度の高いタスクが追加された場合はそちらを先に処理する
+        for (std::size_t i = 0; i < id; ++i) {
+          if (is_pending_[i] && !is_suspended_[i]) {
+            id = i;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  // 一時停止中のものも含め、残っている処理を全て実行する。
+  // モデルの読み込み時など、時間制約が無い場面で使う。
+  void RunAll() {
+    for (std::size_t id = 0; id < kNTasks; ++id) {
+      while (is_pending_[id]) {
+        is_pending_[id] = steps_[id]();
+        if (const auto itr =
+                std::find(is_pending_.begin(), is_pending_.begin() + id, true);
+            itr != is_pending_.begin() + id) {
+          id = static_cast<std::size_t>(itr - is_pending_.begin());
+        }
+      }
+    }
+  }
+
+ private:
+  std::array<Step, kNTasks> steps_;
+  std::array<bool, kNTasks> is_pending_;
+  std::array<bool, kNTasks> is_suspended_;
+  std::array<Clock::duration, kNTasks> estimated_costs_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_DEFERRED_TASK_SCHEDULER_H_
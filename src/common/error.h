@@ -17,9 +17,12 @@ enum class [[nodiscard]] ErrorCode : std::uint8_t {
   kTOMLSyntaxError,
   kSpeakerIDOutOfRange,
   kInvalidPitchCorrectionType,
+  kInvalidMorphingQuality,
   kModelNotLoaded,
   kResamplerNotReady,
   kGainNotReady,
+  kInvalidModelBundle,
+  kChecksumMismatch,
   kUnknownError,
 };
 }  // namespace beatrice::common
@@ -0,0 +1,117 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_FLOAT16_H_
+#define BEATRICE_COMMON_FLOAT16_H_
+
+#include <immintrin.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// F16C の変換命令が使えるか。
+// MSVC の /arch:AVX2 は __F16C__ を定義しないが、F16C を含む
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define BEATRICE_HAS_F16C 1
+#else
+#define BEATRICE_HAS_F16C 0
+#endif
+
+namespace beatrice::common {
+
+// IEEE 754 の半精度浮動小数点数。
+// 保持するためだけの型で、演算は単精度に戻してから行う
+struct Float16 {
+  std::uint16_t bits;
+};
+static_assert(sizeof(Float16) == 2);
+// 半精度で表せる最大の有限値
+inline constexpr auto kFloat16Max = 65504.0f;
+
+// 最近接偶数丸めで半精度に変換する。範囲外の値は無限大になる
+inline auto ToFloat16(const float value) -> Float16 {
+  // 指数部をずらした単精度の加算で仮数部の丸めを行う
+  constexpr auto kScaleToInf = 0x1.0p+112f;
+  constexpr auto kScaleToZero = 0x1.0p-110f;
+  const auto w = std::bit_cast<std::uint32_t>(value);
+  const auto shl1_w = w + w;
+  const auto sign = w & 0x80000000u;
+  auto bias = shl1_w & 0xff000000u;
+  if (bias < 0x71000000u) {
+    bias = 0x71000000u;
+  }
+  auto base = (std::bit_cast<float>(w & 0x7fffffffu) * kScaleToInf) *
+              kScaleToZero;
+  base = std::bit_cast<float>((bias >> 1) + 0x07800000u) + base;
+  const auto bits = std::bit_cast<std::uint32_t>(base);
+  const auto exp_bits = (bits >> 13) & 0x00007c00u;
+  const auto mantissa_bits = bits & 0x00000fffu;
+  const auto nonsign = exp_bits + mantissa_bits;
+  return {static_cast<std::uint16_t>((sign >> 16) |
+                                     (shl1_w > 0xff000000u ? 0x7e00u
+                                                           : nonsign))};
+}
+
+inline auto ToFloat(const Float16 value) -> float {
+  const auto w = static_cast<std::uint32_t>(value.bits) << 16;
+  const auto sign = w & 0x80000000u;
+  const auto two_w = w + w;
+  // 正規化数は指数部のずれを乗算で、非正規化数は減算で補正する
+  const auto normalized =
+      std::bit_cast<float>((two_w >> 4) + (0xe0u << 23)) * 0x1.0p-112f;
+  const auto denormalized =
+      std::bit_cast<float>((two_w >> 17) | (126u << 23)) - 0.5f;
+  return std::bit_cast<float>(
+      sign | std::bit_cast<std::uint32_t>(two_w < (1u << 27) ? denormalized
+                                                             : normalized));
+}
+
+// n 要素をまとめて変換する。NaN 以外の結果は ToFloat16(), ToFloat() と一致する
+inline void ConvertToFloat16(const float* const src, Float16* const dst,
+                             const std::size_t n) {
+  auto i = std::size_t{0};
+#if defined(__AVX512F__)
+  for (; i < n / 16 * 16; i += 16) {
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dst + i),
+        _mm512_cvtps_ph(_mm512_loadu_ps(src + i),
+                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+#endif
+#if BEATRICE_HAS_F16C
+  for (; i < n / 8 * 8; i += 8) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst + i),
+        _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] = ToFloat16(src[i]);
+  }
+}
+
+inline void ConvertToFloat(const Float16* const src, float* const dst,
+                           const std::size_t n) {
+  auto i = std::size_t{0};
+#if defined(__AVX512F__)
+  for (; i < n / 16 * 16; i += 16) {
+    _mm512_storeu_ps(dst + i,
+                     _mm512_cvtph_ps(_mm256_loadu_si256(
+                         reinterpret_cast<const __m256i*>(src + i))));
+  }
+#endif
+#if BEATRICE_HAS_F16C
+  for (; i < n / 8 * 8; i += 8) {
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(
+                                  reinterpret_cast<const __m128i*>(src + i))));
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] = ToFloat(src[i]);
+  }
+}
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_FLOAT16_H_
@@ -0,0 +1,225 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_HOP_PIPELINE_H_
+#define BEATRICE_COMMON_HOP_PIPELINE_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "common/parallel_worker.h"
+#include "common/spsc_queue.h"
+
+namespace beatrice::common {
+
+// フレームごとの推論を専用のワーカースレッドで行うクラス。
+// オーディオスレッドは入力フレームをキューに積み、
+// 処理済みのフレームを受け取るだけになるので、
+// 1 回のコールバックで複数フレームが揃う場合でも負荷が時間的に均される。
+// 出力は入力から常にちょうど depth フレーム遅れ、
+// ワーカーの処理が間に合わなかったフレームは無音になる。
+// スレッドを作り直さずに済むよう、Pause() と Resume() で一時停止できる。
+template <int kInLength, int kOutLength>
+class HopPipeline {
+ public:
+  // ワーカーが一度にまとめて処理する最大フレーム数
+  static constexpr int kMaxBatchSize = 16;
+  static constexpr std::size_t kCapacity = 64;
+
+  // job(arg, input, output, n) で連続する n フレームをまとめて処理する。
+  // 今は処理できない場合は false を返せば、
+  // 次に Process() が呼ばれたときに再試行する
+  using Job = bool (*)(void*, const float*, float*, int);
+
+  HopPipeline(const int depth, const Job job, void* const arg)
+      : depth_(std::clamp(depth, 1, static_cast<int>(kCapacity) / 2)),
+        job_(job),
+        arg_(arg),
+        input_seq_(0),
+        in_item_(),
+        batch_input_(),
+        batch_output_(),
+        out_item_(),
+        input_queue_(),
+        output_queue_(),
+        signal_(0),
+        state_(kRunning),
+        resume_seq_(0),
+        stop_(false),
+        worker_([this] {
+          RaiseCurrentThreadPriority();
+          Run();
+        }) {}
+  ~HopPipeline() {
+    stop_.store(true, std::memory_order_release);
+    signal_.fetch_add(1, std::memory_order_release);
+    signal_.notify_one();
+    worker_.join();
+  }
+  HopPipeline(const HopPipeline&) = delete;
+  auto operator=(const HopPipeline&) -> HopPipeline& = delete;
+
+  [[nodiscard]] auto GetDepth() const -> int { return depth_; }
+  // 呼び出したスレッドがワーカースレッドか
+  [[nodiscard]] auto IsWorkerThread() const -> bool {
+    return std::this_thread::get_id() == worker_.get_id();
+  }
+
+  // ワーカーに一時停止を頼む。ワーカーは処理中のバッチを終えてから止まる。
+  // 止まるまでの間も Process() は呼んでよい。
+  // オーディオスレッドからのみ呼ぶこと
+  void Pause() {
+    auto expected = static_cast<int>(kRunning);
+    if (state_.compare_exchange_strong(expected, kPauseRequested,
+                                       std::memory_order_acq_rel)) {
+      Notify();
+    }
+  }
+
+  // ワーカーが止まり、以降は job を呼ばないか。
+  // true を返した後は、ワーカーが job の中で書いた内容を読んでよい
+  [[nodiscard]] auto IsPaused() const -> bool {
+    return state_.load(std::memory_order_acquire) == kPaused;
+  }
+
+  // 一時停止を解く。止める前に渡した入力と出力は捨てる。
+  // オーディオスレッドからのみ呼ぶこと
+  void Resume() {
+    while (output_queue_.Size() > 0) {
+      output_queue_.Pop();
+    }
+    resume_seq_.store(input_seq_, std::memory_order_relaxed);
+    state_.store(kRunning, std::memory_order_release);
+    Notify();
+  }
+
+  // n_hops フレーム分の入力を渡し、depth フレーム前の出力を受け取る。
+  // オーディオスレッドからのみ呼ぶこと
+  void Process(const float* const input, float* const output,
+               const int n_hops) {
+    for (auto i = 0; i < n_hops; ++i) {
+      auto& in = in_item_;
+      in.seq = input_seq_;
+      std::memcpy(in.data.data(), input + i * kInLength,
+                  sizeof(float) * kInLength);
+      // 満杯であればそのフレームは捨て、対応する出力は無音になる
+      static_cast<void>(input_queue_.TryPush(in));
+
+      // 間に合わなかったフレームの出力が後から届いていれば捨てる
+      const auto wanted = input_seq_ - depth_;
+      while (output_queue_.Size() > 0 && output_queue_[0].seq < wanted) {
+        output_queue_.Pop();
+      }
+      if (output_queue_.Size() > 0 && output_queue_[0].seq == wanted) {
+        std::memcpy(output + i * kOutLength, output_queue_[0].data.data(),
+                    sizeof(float) * kOutLength);
+        output_queue_.Pop();
+      } else {
+        std::memset(output + i * kOutLength, 0, sizeof(float) * kOutLength);
+      }
+      ++input_seq_;
+    }
+    Notify();
+  }
+
+ private:
+  enum State : int {
+    kRunning,
+    kPauseRequested,
+    kPaused,
+  };
+
+  template <int kLength>
+  struct Item {
+    std::int64_t seq;
+    std::array<float, kLength> data;
+  };
+
+  void Notify() {
+    signal_.fetch_add(1, std::memory_order_release);
+    signal_.notify_one();
+  }
+
+  void Run() {
+    while (true) {
+      const auto signal = signal_.load(std::memory_order_acquire);
+      if (stop_.load(std::memory_order_acquire)) {
+        return;
+      }
+      if (const auto state = state_.load(std::memory_order_acquire);
+          state != kRunning) {
+        if (state == kPauseRequested) {
+          // 先に Resume() されていれば止まらない
+          auto expected = state;
+          state_.compare_exchange_strong(expected, kPaused,
+                                         std::memory_order_acq_rel);
+        }
+        signal_.wait(signal, std::memory_order_acquire);
+        continue;
+      }
+      if (!Step()) {
+        signal_.wait(signal, std::memory_order_acquire);
+      }
+    }
+  }
+
+  // 溜まっている入力をまとめて処理する。処理が進んだら true を返す
+  auto Step() -> bool {
+    // 一時停止する前に渡された入力は処理しない
+    const auto resume_seq = resume_seq_.load(std::memory_order_relaxed);
+    while (input_queue_.Size() > 0 && input_queue_[0].seq < resume_seq) {
+      input_queue_.Pop();
+    }
+    const auto n = static_cast<int>(
+        std::min(input_queue_.Size(), static_cast<std::size_t>(kMaxBatchSize)));
+    if (n == 0) {
+      return false;
+    }
+    for (auto i = 0; i < n; ++i) {
+      std::memcpy(&batch_input_[i * kInLength], input_queue_[i].data.data(),
+                  sizeof(float) * kInLength);
+    }
+    if (!job_(arg_, batch_input_.data(), batch_output_.data(), n)) {
+      return false;
+    }
+    for (auto i = 0; i < n; ++i) {
+      auto& out = out_item_;
+      out.seq = input_queue_[i].seq;
+      std::memcpy(out.data.data(), &batch_output_[i * kOutLength],
+                  sizeof(float) * kOutLength);
+      // 満杯になるのはオーディオスレッドが止まっているときなので、捨ててよい
+      static_cast<void>(output_queue_.TryPush(out));
+    }
+    input_queue_.Pop(n);
+    return true;
+  }
+
+  const int depth_;
+  const Job job_;
+  void* const arg_;
+
+  // オーディオスレッドのみが触る
+  std::int64_t input_seq_;
+  Item<kInLength> in_item_;
+  // ワーカースレッドのみが触る
+  alignas(64) std::array<float, kInLength * kMaxBatchSize> batch_input_;
+  alignas(64) std::array<float, kOutLength * kMaxBatchSize> batch_output_;
+  Item<kOutLength> out_item_;
+
+  SpscQueue<Item<kInLength>, kCapacity> input_queue_;
+  SpscQueue<Item<kOutLength>, kCapacity> output_queue_;
+  std::atomic<std::uint32_t> signal_;
+  std::atomic<int> state_;
+  // Resume() した時点の入力の通し番号。state_ を介して受け渡す
+  std::atomic<std::int64_t> resume_seq_;
+  std::atomic<bool> stop_;
+  std::thread worker_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_HOP_PIPELINE_H_
@@ -0,0 +1,109 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MAPPED_FILE_H_
+#define BEATRICE_COMMON_MAPPED_FILE_H_
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <filesystem>
+
+namespace beatrice::common {
+
+// ファイルを読み取り専用でメモリにマップするクラス。
+// 内容は触れたページから順に読み込まれ、使われていないページは
+// OS がいつでも手放せるので、大きなファイルの一部だけを使う場合に向く
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); }
+  MappedFile(const MappedFile&) = delete;
+  auto operator=(const MappedFile&) -> MappedFile& = delete;
+
+  // マップできたら true を返す。空のファイルはマップできない
+  auto Open(const std::filesystem::path& file) -> bool {
+    Close();
+#ifdef _WIN32
+    const auto handle = CreateFileW(
+        file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    auto size = LARGE_INTEGER();
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart <= 0) {
+      CloseHandle(handle);
+      return false;
+    }
+    const auto mapping =
+        CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if (mapping == nullptr) {
+      return false;
+    }
+    // ビューがマッピングを参照し続けるので、ハンドルは閉じてよい
+    auto* const data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == nullptr) {
+      return false;
+    }
+    data_ = data;
+    size_ = static_cast<std::size_t>(size.QuadPart);
+#else
+    const auto fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+      close(fd);
+      return false;
+    }
+    auto* const data = mmap(nullptr, static_cast<std::size_t>(st.st_size),
+                            PROT_READ, MAP_PRIVATE, fd, 0);
+    // マップした後はファイルディスクリプタを閉じてよい
+    close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    data_ = data;
+    size_ = static_cast<std::size_t>(st.st_size);
+#endif
+    return true;
+  }
+  void Close() {
+    if (data_ == nullptr) {
+      return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(const_cast<void*>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+  [[nodiscard]] auto IsOpen() const -> bool { return data_ != nullptr; }
+  [[nodiscard]] auto GetData() const -> const std::byte* {
+    return static_cast<const std::byte*>(data_);
+  }
+  [[nodiscard]] auto GetSize() const -> std::size_t { return size_; }
+
+ private:
+  const void* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MAPPED_FILE_H_
@@ -0,0 +1,118 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MEMORY_RESIDENCY_H_
+#define BEATRICE_COMMON_MEMORY_RESIDENCY_H_
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace beatrice::common {
+
+// 一般的なページサイズ。実際より小さくても触る回数が増えるだけなので問題ない
+inline constexpr std::size_t kPrefaultStride = 4096;
+
+// 各ページを 1 回ずつ読み、ページフォールトを前もって済ませておく
+inline void PrefaultMemory(const void* const data, const std::size_t bytes) {
+  if (data == nullptr || bytes == 0) {
+    return;
+  }
+  const auto* const p = static_cast<const volatile unsigned char*>(data);
+  auto sink = static_cast<unsigned char>(0);
+  for (std::size_t i = 0; i < bytes; i += kPrefaultStride) {
+    sink ^= p[i];
+  }
+  sink ^= p[bytes - 1];
+  static_cast<void>(sink);
+}
+
+// メモリマップされた領域の読み込みを OS に依頼し、待たずに戻る。
+// 読み込みが終わる前に触れた場合は、通常通りページフォールトになる
+inline void PrefetchMemory(const void* const data, const std::size_t bytes) {
+  if (data == nullptr || bytes == 0) {
+    return;
+  }
+#ifdef _WIN32
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+  auto range = WIN32_MEMORY_RANGE_ENTRY{const_cast<void*>(data), bytes};
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+  // madvise() にはページ境界に揃えたアドレスを渡す
+  const auto page_size = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+  const auto begin = reinterpret_cast<std::uintptr_t>(data) & ~(page_size - 1);
+  const auto end = reinterpret_cast<std::uintptr_t>(data) + bytes;
+  madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+#endif
+}
+
+// 確保済みのメモリ領域を物理メモリに固定するクラス。
+// 固定できなかった領域はページアウトされうるだけで、動作には影響しない。
+// 固定した領域を解放する前に UnlockAll() を呼ぶこと
+class MemoryLock {
+ public:
+  MemoryLock() = default;
+  ~MemoryLock() { UnlockAll(); }
+  MemoryLock(const MemoryLock&) = delete;
+  auto operator=(const MemoryLock&) -> MemoryLock& = delete;
+
+  // 固定できたら true を返す
+  auto Lock(const void* const data, const std::size_t bytes) -> bool {
+    if (data == nullptr || bytes == 0) {
+      return false;
+    }
+#ifdef _WIN32
+    auto* const p = const_cast<void*>(data);
+    if (!VirtualLock(p, bytes)) {
+      // ワーキングセットの上限に達していれば、その分だけ広げて再試行する
+      if (GetLastError() != ERROR_WORKING_SET_QUOTA) {
+        return false;
+      }
+      const auto process = GetCurrentProcess();
+      SIZE_T min_size = 0;
+      SIZE_T max_size = 0;
+      if (!GetProcessWorkingSetSize(process, &min_size, &max_size) ||
+          !SetProcessWorkingSetSize(process, min_size + bytes,
+                                    max_size + bytes) ||
+          !VirtualLock(p, bytes)) {
+        return false;
+      }
+    }
+#else
+    if (mlock(data, bytes) != 0) {
+      return false;
+    }
+#endif
+    regions_.emplace_back(data, bytes);
+    return true;
+  }
+  void UnlockAll() {
+    for (const auto& [data, bytes] : regions_) {
+#ifdef _WIN32
+      VirtualUnlock(const_cast<void*>(data), bytes);
+#else
+      munlock(data, bytes);
+#endif
+    }
+    regions_.clear();
+  }
+  [[nodiscard]] auto IsLocked() const -> bool { return !regions_.empty(); }
+
+ private:
+  std::vector<std::pair<const void*, std::size_t>> regions_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MEMORY_RESIDENCY_H_
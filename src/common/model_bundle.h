@@ -0,0 +1,385 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MODEL_BUNDLE_H_
+#define BEATRICE_COMMON_MODEL_BUNDLE_H_
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>  // NOLINT(build/c++11)
+#include <thread>        // NOLINT(build/c++11)
+#include <vector>
+
+#include "common/cache_directory.h"
+#include "common/error.h"
+#include "common/mapped_file.h"
+
+// CRC32 命令が使えるか。
+// MSVC の /arch:AVX2 は __SSE4_2__ を定義しないが、SSE4.2 を含む
+#if defined(__SSE4_2__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define BEATRICE_HAS_CRC32C 1
+#else
+#define BEATRICE_HAS_CRC32C 0
+#endif
+
+namespace beatrice::common {
+
+// モデルを構成する TOML、重み、画像などを 1 つにまとめたファイル。
+// 先頭に ModelBundleHeader、続いて ModelBundleSection が n_sections 個並び、
+// その後に各セクションの中身が kModelBundleAlignment 境界から並ぶ。
+// 最初のセクションがモデルの TOML ファイルである。
+// 数値はリトルエンディアン
+inline constexpr auto kModelBundleExtension = std::string_view(".beatrice");
+inline constexpr auto kModelBundleMagic =
+    std::array<char, 8>{'B', 'T', 'R', 'B', 'N', 'D', 'L', '\0'};
+inline constexpr std::uint32_t kModelBundleFormatVersion = 1;
+inline constexpr std::size_t kModelBundleAlignment = 4096;
+inline constexpr std::size_t kModelBundleMaxNameLength = 104;
+// 展開先の合計の大きさの上限。超えたら使われていないものから消す
+inline constexpr std::uintmax_t kModelBundleCacheMaxTotalSize =
+    std::uintmax_t{4} << 30;
+
+struct ModelBundleHeader {
+  std::array<char, 8> magic;
+  std::uint32_t format_version;
+  std::uint32_t n_sections;
+};
+static_assert(sizeof(ModelBundleHeader) == 16);
+
+struct ModelBundleSection {
+  // ファイルの先頭からの位置 [バイト]
+  std::uint64_t offset;
+  std::uint64_t size;
+  // 中身の CRC-32C
+  std::uint32_t checksum;
+  std::uint32_t name_length;
+  // TOML のあるディレクトリからの相対パス。区切りは '/'
+  std::array<char, kModelBundleMaxNameLength> name;
+};
+static_assert(sizeof(ModelBundleSection) == 128);
+
+// CRC-32C (Castagnoli)。crc に前の結果を渡すと続きから計算する
+inline auto Crc32c(const std::byte* const data, const std::size_t size,
+                   const std::uint32_t crc = 0) -> std::uint32_t {
+  static constexpr auto kTable = [] {
+    auto table = std::array<std::uint32_t, 256>();
+    for (auto i = std::uint32_t{0}; i < 256; ++i) {
+      auto c = i;
+      for (auto k = 0; k < 8; ++k) {
+        c = (c & 1) != 0 ? 0x82f63b78u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    return table;
+  }();
+  auto c = ~crc;
+  auto i = std::size_t{0};
+#if BEATRICE_HAS_CRC32C
+  auto c64 = static_cast<std::uint64_t>(c);
+  for (; i < size / 8 * 8; i += 8) {
+    auto v = std::uint64_t();
+    std::memcpy(&v, data + i, sizeof(v));
+    c64 = _mm_crc32_u64(c64, v);
+  }
+  c = static_cast<std::uint32_t>(c64);
+#endif
+  for (; i < size; ++i) {
+    c = kTable[(c ^ static_cast<std::uint32_t>(data[i])) & 0xff] ^ (c >> 8);
+  }
+  return ~c;
+}
+
+// モデルバンドルをメモリマップして読むクラス
+class ModelBundle {
+ public:
+  struct Section {
+    std::u8string name;
+    const std::byte* data;
+    std::size_t size;
+    std::uint32_t checksum;
+  };
+
+  [[nodiscard]] static auto IsBundleFile(const std::filesystem::path& file)
+      -> bool {
+    return file.extension().u8string() ==
+           std::u8string(kModelBundleExtension.begin(),
+                         kModelBundleExtension.end());
+  }
+
+  // ヘッダと索引を読み、各セクションがファイルに収まっているかを確かめる。
+  // 中身の検査は Verify() で行う
+  auto Open(const std::filesystem::path& file) -> ErrorCode {
+    sections_.clear();
+    if (!file_.Open(file)) {
+      return ErrorCode::kFileOpenError;
+    }
+    const auto* const base = file_.GetData();
+    const auto file_size = file_.GetSize();
+    auto header = ModelBundleHeader();
+    if (file_size < sizeof(header)) {
+      return Fail(ErrorCode::kFileTooSmall);
+    }
+    std::memcpy(&header, base, sizeof(header));
+    if (header.magic != kModelBundleMagic ||
+        header.format_version != kModelBundleFormatVersion ||
+        header.n_sections == 0) {
+      return Fail(ErrorCode::kInvalidModelBundle);
+    }
+    if ((file_size - sizeof(header)) / sizeof(ModelBundleSection) <
+        header.n_sections) {
+      return Fail(ErrorCode::kFileTooSmall);
+    }
+    for (auto i = std::uint32_t{0}; i < header.n_sections; ++i) {
+      auto entry = ModelBundleSection();
+      std::memcpy(&entry,
+                  base + sizeof(header) + i * sizeof(ModelBundleSection),
+                  sizeof(entry));
+      if (entry.name_length == 0 ||
+          entry.name_length > kModelBundleMaxNameLength ||
+          entry.offset > file_size || entry.size > file_size - entry.offset) {
+        return Fail(ErrorCode::kInvalidModelBundle);
+      }
+      auto name = std::u8string(
+          reinterpret_cast<const char8_t*>(entry.name.data()),
+          entry.name_length);
+      if (!IsSafeName(name)) {
+        return Fail(ErrorCode::kInvalidModelBundle);
+      }
+      sections_.push_back({.name = std::move(name),
+                           .data = base + entry.offset,
+                           .size = static_cast<std::size_t>(entry.size),
+                           .checksum = entry.checksum});
+    }
+    return ErrorCode::kSuccess;
+  }
+  [[nodiscard]] auto IsOpen() const -> bool { return file_.IsOpen(); }
+  [[nodiscard]] auto GetSections() const -> const std::vector<Section>& {
+    return sections_;
+  }
+  // モデルの TOML ファイルの名前
+  [[nodiscard]] auto GetConfigName() const -> const std::u8string& {
+    return sections_.front().name;
+  }
+  // name のセクションを探す。無ければ nullptr
+  [[nodiscard]] auto FindSection(const std::filesystem::path& name) const
+      -> const Section* {
+    const auto normal = name.lexically_normal().generic_u8string();
+    const auto it = std::ranges::find(sections_, normal, &Section::name);
+    return it == sections_.end() ? nullptr : &*it;
+  }
+  // 1 つのセクションの中身を検査して contents に複製する
+  [[nodiscard]] static auto ReadSection(const Section& section,
+                                        std::string& contents) -> ErrorCode {
+    if (Crc32c(section.data, section.size) != section.checksum) {
+      return ErrorCode::kChecksumMismatch;
+    }
+    contents.assign(reinterpret_cast<const char*>(section.data),
+                    section.size);
+    return ErrorCode::kSuccess;
+  }
+
+  // 全セクションのチェックサムを確かめる
+  [[nodiscard]] auto Verify() const -> ErrorCode {
+    for (const auto& section : sections_) {
+      if (Crc32c(section.data, section.size) != section.checksum) {
+        return ErrorCode::kChecksumMismatch;
+      }
+    }
+    return ErrorCode::kSuccess;
+  }
+
+  // 中身を検査しながら directory 以下に書き出す
+  [[nodiscard]] auto Extract(const std::filesystem::path& directory) const
+      -> ErrorCode {
+    for (const auto& section : sections_) {
+      if (Crc32c(section.data, section.size) != section.checksum) {
+        return ErrorCode::kChecksumMismatch;
+      }
+      const auto file = directory / std::filesystem::path(section.name);
+      auto ec = std::error_code();
+      std::filesystem::create_directories(file.parent_path(), ec);
+      if (ec) {
+        return ErrorCode::kFileOpenError;
+      }
+      auto ofs = std::ofstream(file, std::ios::binary);
+      ofs.write(reinterpret_cast<const char*>(section.data),
+                static_cast<std::streamsize>(section.size));
+      if (!ofs) {
+        return ErrorCode::kFileOpenError;
+      }
+    }
+    return ErrorCode::kSuccess;
+  }
+
+ private:
+  auto Fail(const ErrorCode error_code) -> ErrorCode {
+    file_.Close();
+    sections_.clear();
+    return error_code;
+  }
+  // 展開したときにディレクトリの外を指さない相対パスか
+  static auto IsSafeName(const std::u8string& name) -> bool {
+    const auto path = std::filesystem::path(name);
+    if (path.is_absolute() || path.has_root_name() ||
+        path.has_root_directory()) {
+      return false;
+    }
+    return std::ranges::none_of(path, [](const auto& part) {
+      return part == ".." || part == ".";
+    });
+  }
+
+  MappedFile file_;
+  std::vector<Section> sections_;
+};
+
+// モデルの TOML と、TOML のあるディレクトリからの相対パスで指定される
+// 画像などを、展開せずに読むクラス。重みを必要としない UI で使う。
+// バンドルであれば読むセクションだけを検査し、
+// バンドルでなければ個々のファイルをそのまま読む
+class ModelFileReader {
+ public:
+  auto Open(const std::filesystem::path& file) -> ErrorCode {
+    file_ = file;
+    if (!ModelBundle::IsBundleFile(file)) {
+      return ErrorCode::kSuccess;
+    }
+    return bundle_.Open(file);
+  }
+  [[nodiscard]] auto ReadConfig(std::string& contents) const -> ErrorCode {
+    if (!bundle_.IsOpen()) {
+      return ReadWholeFile(file_, contents);
+    }
+    return ModelBundle::ReadSection(bundle_.GetSections().front(), contents);
+  }
+  [[nodiscard]] auto ReadFile(const std::filesystem::path& relative,
+                              std::string& contents) const -> ErrorCode {
+    if (!bundle_.IsOpen()) {
+      return ReadWholeFile(file_.parent_path() / relative, contents);
+    }
+    const auto* const section = bundle_.FindSection(
+        std::filesystem::path(bundle_.GetConfigName()).parent_path() /
+        relative);
+    if (section == nullptr) {
+      return ErrorCode::kFileOpenError;
+    }
+    return ModelBundle::ReadSection(*section, contents);
+  }
+
+ private:
+  static auto ReadWholeFile(const std::filesystem::path& file,
+                            std::string& contents) -> ErrorCode {
+    auto ifs = std::ifstream(file, std::ios::binary);
+    if (!ifs) {
+      return ErrorCode::kFileOpenError;
+    }
+    contents.assign(std::istreambuf_iterator<char>(ifs),
+                    std::istreambuf_iterator<char>());
+    return ifs.bad() ? ErrorCode::kFileOpenError : ErrorCode::kSuccess;
+  }
+
+  std::filesystem::path file_;
+  ModelBundle bundle_;
+};
+
+// file がモデルバンドルであれば一時ディレクトリに展開し、
+// 展開した TOML ファイルのパスを resolved に返す。
+// バンドルでなければ file をそのまま返す。
+// 重みを読み込むライブラリはファイル名でしか受け取らないので、
+// バンドルはまとめて 1 度だけ読み、以降はローカルに展開したものを使う。
+// 展開先はバンドルのパス、サイズ、更新時刻ごとに分けるので、
+// 展開済みであればバンドルの索引を読むだけで済む。
+// 展開先の合計が kModelBundleCacheMaxTotalSize を超えたら古いものから消す
+inline auto ResolveModelFile(const std::filesystem::path& file,
+                             std::filesystem::path& resolved) -> ErrorCode {
+  if (!ModelBundle::IsBundleFile(file)) {
+    resolved = file;
+    return ErrorCode::kSuccess;
+  }
+  auto bundle = ModelBundle();
+  if (const auto err = bundle.Open(file); err != ErrorCode::kSuccess) {
+    return err;
+  }
+  auto ec = std::error_code();
+  const auto canonical = std::filesystem::canonical(file, ec);
+  if (ec) {
+    return ErrorCode::kFileOpenError;
+  }
+  const auto size = std::filesystem::file_size(canonical, ec);
+  if (ec) {
+    return ErrorCode::kFileOpenError;
+  }
+  const auto time = std::filesystem::last_write_time(canonical, ec);
+  if (ec) {
+    return ErrorCode::kFileOpenError;
+  }
+  const auto cache_root =
+      std::filesystem::temp_directory_path(ec) / "beatrice-bundle-cache";
+  if (ec) {
+    return ErrorCode::kFileOpenError;
+  }
+  auto key = canonical.u8string();
+  for (const auto n : {static_cast<std::int64_t>(size),
+                       static_cast<std::int64_t>(
+                           time.time_since_epoch().count())}) {
+    const auto s = std::to_string(n);
+    key += u8'\n';
+    key += std::u8string(s.begin(), s.end());
+  }
+  auto name = std::array<char, 17>();
+  std::snprintf(name.data(), name.size(), "%016llx",
+                static_cast<unsigned long long>(  // NOLINT(runtime/int)
+                    std::hash<std::u8string>()(key)));
+  const auto directory = cache_root / name.data();
+  const auto config = directory / std::filesystem::path(bundle.GetConfigName());
+  if (std::filesystem::is_regular_file(config, ec)) {
+    // 使われていないものから消されるよう、使ったことを記録する
+    TouchCacheEntry(directory);
+    resolved = config;
+    return ErrorCode::kSuccess;
+  }
+
+  // 他のスレッドやプロセスと同時に展開しても壊れないよう、
+  // 別名のディレクトリに展開してから名前を変える
+  auto temporary = directory;
+  temporary += ".tmp" +
+               std::to_string(std::hash<std::thread::id>()(
+                   std::this_thread::get_id())) +
+               std::to_string(
+                   std::chrono::steady_clock::now().time_since_epoch().count());
+  std::filesystem::create_directories(temporary, ec);
+  if (ec) {
+    return ErrorCode::kFileOpenError;
+  }
+  if (const auto err = bundle.Extract(temporary); err != ErrorCode::kSuccess) {
+    std::filesystem::remove_all(temporary, ec);
+    return err;
+  }
+  std::filesystem::rename(temporary, directory, ec);
+  if (ec) {
+    // 先に他が展開し終えていれば、そちらを使う
+    std::filesystem::remove_all(temporary, ec);
+    if (!std::filesystem::is_regular_file(config, ec)) {
+      return ErrorCode::kFileOpenError;
+    }
+  }
+  TrimCacheDirectory(cache_root, kModelBundleCacheMaxTotalSize, directory);
+  resolved = config;
+  return ErrorCode::kSuccess;
+}
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MODEL_BUNDLE_H_
@@ -0,0 +1,151 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_MODEL_CACHE_H_
+#define BEATRICE_COMMON_MODEL_CACHE_H_
+
+#include <exception>
+#include <filesystem>
+#include <future>  // NOLINT(build/c++11)
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <system_error>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "common/error.h"
+
+namespace beatrice::common {
+
+// 同じモデルを読み込んだプラグインのインスタンス同士で、
+// 読み込み済みの重みや話者埋め込みを共有するためのプロセス全体のキャッシュ。
+// Model は共有された後は変更されず、複数のスレッドから const で使われる。
+// どのインスタンスからも使われなくなったモデルは解放される
+template <typename Model>
+class ModelCache {
+ public:
+  static auto GetInstance() -> ModelCache& {
+    static auto instance = ModelCache();
+    return instance;
+  }
+  ModelCache(const ModelCache&) = delete;
+  auto operator=(const ModelCache&) -> ModelCache& = delete;
+
+  // files のパス、サイズ、更新時刻と variant が全て一致するモデルが
+  // 読み込み済みであればそれを model に返し、無ければ load(Model&) で読み込んで
+  // 登録する。同じファイルでも読み込み方の異なるものは variant で区別する。
+  // 同じモデルを 2 度読み込まないよう、読み込み中のモデルを要求された場合は
+  // その読み込みが終わるのを待って結果を共有する。
+  // 異なるモデルの読み込みは互いに待たない
+  template <typename Loader>
+  auto Load(const std::vector<std::filesystem::path>& files,
+            const std::string& variant, Loader&& load,
+            std::shared_ptr<const Model>& model) -> ErrorCode {
+    auto key = MakeKey(files);
+    if (key.empty()) {
+      // キーが作れなかった場合も読み込み自体は行い、共有だけしない
+      auto result = LoadModel(load);
+      model = std::move(result.model);
+      return result.error;
+    }
+    key += variant;
+    auto lock = std::unique_lock(mutex_);
+    std::erase_if(models_, [](const auto& entry) {
+      return entry.second.model.expired() && !entry.second.loading.valid();
+    });
+    auto& entry = models_[key];
+    if (auto cached = entry.model.lock()) {
+      model = std::move(cached);
+      return ErrorCode::kSuccess;
+    }
+    if (entry.loading.valid()) {
+      // 他のスレッドが読み込み中なので、ロックを外して待つ
+      const auto loading = entry.loading;
+      lock.unlock();
+      const auto& result = loading.get();
+      model = result.model;
+      return result.error;
+    }
+    auto promise = std::promise<Result>();
+    entry.loading = promise.get_future().share();
+    lock.unlock();
+
+    auto result = LoadModel(load);
+
+    lock.lock();
+    if (const auto it = models_.find(key); it != models_.end()) {
+      it->second.loading = {};
+      if (result.model) {
+        it->second.model = result.model;
+      }
+    }
+    lock.unlock();
+    promise.set_value(result);
+    model = std::move(result.model);
+    return result.error;
+  }
+
+ private:
+  struct Result {
+    ErrorCode error;
+    std::shared_ptr<const Model> model;
+  };
+  struct Entry {
+    std::weak_ptr<const Model> model;
+    // 読み込み中であれば、その結果を待つためのもの
+    std::shared_future<Result> loading;
+  };
+
+  ModelCache() = default;
+
+  template <typename Loader>
+  static auto LoadModel(Loader& load) -> Result {
+    auto new_model = std::make_shared<Model>();
+    auto error = ErrorCode::kSuccess;
+    try {
+      error = load(*new_model);
+    } catch (const std::exception&) {
+      error = ErrorCode::kUnknownError;
+    }
+    if (error != ErrorCode::kSuccess) {
+      return {error, nullptr};
+    }
+    return {ErrorCode::kSuccess, std::move(new_model)};
+  }
+
+  // ファイルが存在しないなどでキーを作れなければ空文字列を返す
+  static auto MakeKey(const std::vector<std::filesystem::path>& files)
+      -> std::string {
+    auto key = std::string();
+    for (const auto& file : files) {
+      auto ec = std::error_code();
+      const auto canonical = std::filesystem::canonical(file, ec);
+      if (ec) {
+        return {};
+      }
+      const auto size = std::filesystem::file_size(canonical, ec);
+      if (ec) {
+        return {};
+      }
+      const auto time = std::filesystem::last_write_time(canonical, ec);
+      if (ec) {
+        return {};
+      }
+      key += reinterpret_cast<const char*>(canonical.u8string().c_str());
+      key += '\n';
+      key += std::to_string(size);
+      key += '\n';
+      key += std::to_string(time.time_since_epoch().count());
+      key += '\n';
+    }
+    return key;
+  }
+
+  std::mutex mutex_;
+  std::map<std::string, Entry> models_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_MODEL_CACHE_H_
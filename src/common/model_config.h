@@ -12,6 +12,8 @@
 namespace beatrice::common {
 
 static constexpr auto kMaxNSpeakers = 256;
+// 同じ入力の解析結果を共有して同時に生成できる、追加の目標話者の最大数
+static constexpr auto kMaxNExtraTargets = 3;
 
 // モデル情報の TOML ファイルを読み込むための構造体
 struct ModelConfig {
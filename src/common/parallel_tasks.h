@@ -0,0 +1,60 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PARALLEL_TASKS_H_
+#define BEATRICE_COMMON_PARALLEL_TASKS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "common/error.h"
+
+namespace beatrice::common {
+
+// 互いに依存しない n 個の処理 task(0), ..., task(n - 1) を
+// 複数のスレッドで分担して実行し、全て終わってから戻る。
+// 呼び出したスレッドも分担に加わり、スレッド数はコア数までに抑える。
+// 失敗したものがあれば、そのうち番号が最も小さいものの ErrorCode を返す。
+// スレッドを起動するので、モデルの読み込みのような時間のかかる処理に使い、
+// オーディオスレッドからは呼ばないこと
+template <typename Task>
+auto RunParallelTasks(const std::size_t n, const Task& task) -> ErrorCode {
+  auto results = std::vector<ErrorCode>(n, ErrorCode::kSuccess);
+  auto next = std::atomic<std::size_t>(0);
+  const auto run = [&] {
+    for (auto i = next.fetch_add(1); i < n; i = next.fetch_add(1)) {
+      try {
+        results[i] = task(i);
+      } catch (const std::exception&) {
+        results[i] = ErrorCode::kUnknownError;
+      }
+    }
+  };
+  const auto n_threads = std::min<std::size_t>(
+      n, std::max(1u, std::thread::hardware_concurrency()));
+  auto threads = std::vector<std::thread>();
+  threads.reserve(n_threads);
+  for (std::size_t i = 1; i < n_threads; ++i) {
+    try {
+      threads.emplace_back(run);
+    } catch (const std::exception&) {
+      // 起動できなかった分は残りのスレッドで分担する
+      break;
+    }
+  }
+  run();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto it = std::ranges::find_if(results, [](const ErrorCode err) {
+    return err != ErrorCode::kSuccess;
+  });
+  return it == results.end() ? ErrorCode::kSuccess : *it;
+}
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PARALLEL_TASKS_H_
@@ -0,0 +1,106 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PARALLEL_WORKER_H_
+#define BEATRICE_COMMON_PARALLEL_WORKER_H_
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#include <atomic>
+#include <cassert>
+#include <thread>  // NOLINT(build/c++11)
+
+namespace beatrice::common {
+
+// 呼び出したスレッドの優先度をオーディオ処理向けに引き上げる。
+// 失敗しても処理は続けられるので、結果は無視する
+inline void RaiseCurrentThreadPriority() {
+#ifdef _WIN32
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+}
+
+// オーディオスレッドの処理の一部を別のコアで並行して実行するためのワーカー。
+// スレッドはコンストラクタで起動しておき、Dispatch() から Wait() までの間は
+// メモリ確保もロックも行わない。
+// 受け渡しは atomic な状態変数 1 つで行い、しばらくスピンしても
+// 状態が変わらなければ std::atomic::wait() で眠る。
+// Dispatch(), Wait() は同じ 1 つのスレッドからのみ呼ぶこと。
+class ParallelWorker {
+ public:
+  using Job = void (*)(void*);
+
+  ParallelWorker()
+      : state_(kIdle), job_(nullptr), arg_(nullptr), thread_([this] {
+          RaiseCurrentThreadPriority();
+          Run();
+        }) {}
+  ~ParallelWorker() {
+    assert(state_.load() != kRequested);
+    state_.store(kStop, std::memory_order_release);
+    state_.notify_all();
+    thread_.join();
+  }
+  ParallelWorker(const ParallelWorker&) = delete;
+  auto operator=(const ParallelWorker&) -> ParallelWorker& = delete;
+
+  // job(arg) をワーカースレッドで実行させる。
+  // 次に Dispatch() するまでに必ず Wait() を呼ぶこと
+  void Dispatch(const Job job, void* const arg) {
+    assert(state_.load(std::memory_order_relaxed) == kIdle);
+    job_ = job;
+    arg_ = arg;
+    state_.store(kRequested, std::memory_order_release);
+    state_.notify_all();
+  }
+
+  // Dispatch() した処理が終わるまで待つ
+  void Wait() { WaitWhile(kRequested); }
+
+ private:
+  enum State : int {
+    kIdle,
+    kRequested,
+    kStop,
+  };
+  // 眠るまでにスピンする回数。
+  // 並行処理の相手は数百 μs 程度で終わる想定なので、その程度待てる値にする
+  static constexpr int kNSpins = 1 << 10;
+
+  // state_ が value でなくなるまで待ち、新しい値を返す
+  auto WaitWhile(const int value) -> int {
+    for (auto i = 0; i < kNSpins; ++i) {
+      if (const auto s = state_.load(std::memory_order_acquire); s != value) {
+        return s;
+      }
+      std::this_thread::yield();
+    }
+    while (true) {
+      state_.wait(value, std::memory_order_acquire);
+      if (const auto s = state_.load(std::memory_order_acquire); s != value) {
+        return s;
+      }
+    }
+  }
+
+  void Run() {
+    while (WaitWhile(kIdle) != kStop) {
+      job_(arg_);
+      state_.store(kIdle, std::memory_order_release);
+      state_.notify_all();
+    }
+  }
+
+  std::atomic<int> state_;
+  Job job_;
+  void* arg_;
+  std::thread thread_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PARALLEL_WORKER_H_
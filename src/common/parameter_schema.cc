@@ -4,8 +4,12 @@
 
 #include <exception>
 #include <filesystem>
+#include <sstream>
+#include <string>
+#include <utility>
 
 #include "common/controller_core.h"
+#include "common/model_bundle.h"
 #include "common/processor_core.h"
 #include "common/processor_proxy.h"
 #include "toml11/single_include/toml.hpp"
@@ -29,9 +33,21 @@ const ParameterSchema kSchema = [] {
        StringParameter(
            u8"Model"s, u8""s, false,
            [](ControllerCore& controller, const std::u8string& value) {
+             // UI スレッドで呼ばれるので、バンドルは展開せずに TOML だけ読む
+             auto reader = ModelFileReader();
+             auto toml_text = std::string();
+             if (const auto err = reader.Open(std::filesystem::path(value));
+                 err != ErrorCode::kSuccess) {
+               return err;
+             }
+             if (const auto err = reader.ReadConfig(toml_text);
+                 err != ErrorCode::kSuccess) {
+               return err;
+             }
              ModelConfig model_config;
              try {
-               const auto toml_data = toml::parse(std::filesystem::path(value));
+               auto iss = std::istringstream(toml_text);
+               const auto toml_data = toml::parse(iss);
                model_config = toml::get<ModelConfig>(toml_data);
              } catch (const toml::file_io_error& e) {
                return ErrorCode::kFileOpenError;
@@ -367,6 +383,182 @@ const ParameterSchema kSchema = [] {
              return vc.GetCore()->SetVQNumNeighbors(
                  static_cast<int>(std::round(value)));
            })},
+      {ParameterID::kMorphingQuality,
+       ListParameter(
+           u8"Morphing Quality"s, {u8"Exact"s, u8"Fast"s, u8"Auto"s}, 0,
+           u8"MphQly"s, parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const int value) {
+             return vc.GetCore()->SetMorphingQuality(value);
+           })},
+      {ParameterID::kVoiceCacheSize,
+       NumberParameter(
+           u8"Voice Cache Size"s, 2.0, 0.0, 8.0, u8""s, 8, u8"VcCach"s,
+           parameter_flag::kNoFlags,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const double value) {
+             return vc.GetCore()->SetVoiceCacheSize(
+                 static_cast<int>(std::round(value)));
+           })},
+      {ParameterID::kParallelPitchEstimation,
+       ListParameter(
+           u8"Parallel Pitch Estimation"s, {u8"Off"s, u8"On"s}, 0,
+           u8"PrlPit"s, parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const int value) {
+             return vc.GetCore()->SetParallelPitchEstimation(value != 0);
+           })},
+      {ParameterID::kPipelinedProcessing,
+       ListParameter(
+           u8"Pipelined Processing"s, {u8"Off"s, u8"On"s}, 0, u8"Pipe"s,
+           parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const int value) {
+             return vc.GetCore()->SetPipelinedProcessing(value != 0);
+           })},
+      {ParameterID::kSilenceThreshold,
+       NumberParameter(
+           u8"Silence Threshold"s, -120.0, -120.0, -20.0, u8"dB"s, 0,
+           u8"SilThr"s, parameter_flag::kCanAutomate,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const double value) {
+             return vc.GetCore()->SetSilenceThreshold(value);
+           })},
+      {ParameterID::kAdaptiveQuality,
+       ListParameter(
+           u8"Adaptive Quality"s, {u8"Off"s, u8"On"s}, 0, u8"AdpQly"s,
+           parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const int value) {
+             return vc.GetCore()->SetAdaptiveQuality(value != 0);
+           })},
+      // 以下の 3 つは Processor から状態を通知するための読み取り専用のもの
+      {ParameterID::kQualityTier,
+       ListParameter(
+           u8"Quality Tier"s,
+           {u8"Full"s, u8"Deferred Morphing"s, u8"Approximate Morphing"s,
+            u8"No VQ"s},
+           0, u8"QlyTier"s,
+           parameter_flag::kIsReadOnly | parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, int) { return ErrorCode::kSuccess; })},
+      {ParameterID::kDeadlineMissCount,
+       NumberParameter(
+           u8"Deadline Misses"s, 0.0, 0.0, 1000000.0, u8""s, 0,
+           u8"Misses"s, parameter_flag::kIsReadOnly,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, double) { return ErrorCode::kSuccess; })},
+      // Controller はこれが変わったときにホストに遅延の変化を通知する
+      {ParameterID::kLatencySamples,
+       NumberParameter(
+           u8"Latency"s, 0.0, 0.0, 100000.0, u8"samples"s, 0, u8"Latncy"s,
+           parameter_flag::kIsReadOnly,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, double) { return ErrorCode::kSuccess; })},
+      // 最後に読み込んだモデルの ErrorCode。読み込めていれば 0
+      {ParameterID::kModelLoadError,
+       NumberParameter(
+           u8"Model Load Error"s, 0.0, 0.0, 255.0, u8""s, 255, u8"LoadEr"s,
+           parameter_flag::kIsReadOnly,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, double) { return ErrorCode::kSuccess; })},
+      // 次にモデルを読み込んだときから反映される
+      {ParameterID::kWarmUpHops,
+       NumberParameter(
+           u8"Warm-up Hops"s, 50.0, 0.0, 500.0, u8""s, 500, u8"WarmUp"s,
+           parameter_flag::kNoFlags,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, double) { return ErrorCode::kSuccess; })},
+      // 次にモデルを読み込んだときから反映される
+      {ParameterID::kLockModelMemory,
+       ListParameter(
+           u8"Lock Model Memory"s, {u8"Off"s, u8"On"s}, 0, u8"MemLck"s,
+           parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const int value) {
+             return vc.GetCore()->SetLockModelMemory(value != 0);
+           })},
+      {ParameterID::kPitchCalibration,
+       ListParameter(
+           u8"Pitch Calibration"s, {u8"Off"s, u8"Measure"s}, 0, u8"PitCal"s,
+           parameter_flag::kIsList,
+           [](ControllerCore& controller, const int value) {
+             // 測定を終えたときに、測った値を反映する
+             auto& state = controller.parameter_state_;
+             const auto was_measuring =
+                 std::get<int>(state.GetValue(ParameterID::kPitchCalibration));
+             if (value != 0 || was_measuring == 0) {
+               return ErrorCode::kSuccess;
+             }
+             const auto average = std::get<double>(
+                 state.GetValue(ParameterID::kMeasuredAverageSourcePitch));
+             if (average <= 0.0) {
+               // 有声のフレームが無かった
+               return ErrorCode::kSuccess;
+             }
+             for (const auto& [measured, param_id] :
+                  {std::pair(ParameterID::kMeasuredMinSourcePitch,
+                             ParameterID::kMinSourcePitch),
+                   std::pair(ParameterID::kMeasuredMaxSourcePitch,
+                             ParameterID::kMaxSourcePitch)}) {
+               state.SetValue(param_id,
+                              std::get<double>(state.GetValue(measured)));
+               controller.updated_parameters_.push_back(param_id);
+             }
+             // Pitch Shift 固定の場合は Average Source Pitch を変えず、
+             // 測った値は Measured Average Source Pitch に示すだけにする
+             if (std::get<int>(state.GetValue(ParameterID::kLock)) != 0) {
+               return ErrorCode::kSuccess;
+             }
+             state.SetValue(ParameterID::kAverageSourcePitch, average);
+             controller.updated_parameters_.push_back(
+                 ParameterID::kAverageSourcePitch);
+             // Average Source Pitch を手で変えたときと同様に
+             // ピッチシフト量を合わせる
+             return std::get<NumberParameter>(
+                        kSchema.GetParameter(ParameterID::kAverageSourcePitch))
+                 .ControllerSetValue(controller, average);
+           },
+           [](ProcessorProxy& vc, const int value) {
+             return vc.GetCore()->SetPitchCalibration(value != 0);
+           })},
+      // 以下の 3 つは Pitch Calibration の測定結果を通知するための
+      // 読み取り専用のもの。測定結果が無ければ 0
+      {ParameterID::kMeasuredAverageSourcePitch,
+       NumberParameter(
+           u8"Measured Average Source Pitch"s, 0.0, 0.0, 128.0, u8""s,
+           128 * 8, u8"MesAvg"s, parameter_flag::kIsReadOnly,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, double) { return ErrorCode::kSuccess; })},
+      {ParameterID::kMeasuredMinSourcePitch,
+       NumberParameter(
+           u8"Measured Min Source Pitch"s, 0.0, 0.0, 128.0, u8""s, 128 * 8,
+           u8"MesMin"s, parameter_flag::kIsReadOnly,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, double) { return ErrorCode::kSuccess; })},
+      {ParameterID::kMeasuredMaxSourcePitch,
+       NumberParameter(
+           u8"Measured Max Source Pitch"s, 0.0, 0.0, 128.0, u8""s, 128 * 8,
+           u8"MesMax"s, parameter_flag::kIsReadOnly,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, double) { return ErrorCode::kSuccess; })},
+      // 次にモデルを読み込んだときから反映される
+      {ParameterID::kHalfPrecisionEmbeddings,
+       ListParameter(
+           u8"Half Precision Embeddings"s, {u8"Off"s, u8"On"s}, 0,
+           u8"HalfEm"s, parameter_flag::kIsList,
+           [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy&, int) { return ErrorCode::kSuccess; })},
+      // 同じシードであれば、同じ入力に対して同じ出力になる
+      {ParameterID::kRandomSeed,
+       NumberParameter(
+           u8"Random Seed"s, 5489.0, 0.0, 65535.0, u8""s, 65535, u8"Seed"s,
+           parameter_flag::kNoFlags,
+           [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+           [](ProcessorProxy& vc, const double value) {
+             return vc.GetCore()->SetRandomSeed(
+                 static_cast<unsigned int>(std::round(value)));
+           })},
   });
 
   for (auto i = 0; i < kMaxNSpeakers + 1;
@@ -398,12 +590,55 @@ const ParameterSchema kSchema = [] {
               // そこまでする必要は無さそうに感じたので、とりあえず保留。
               return ErrorCode::kSuccess;
             },
-            // ここ、NumberParameter::processor_set_value_
-            // が関数ポインタのままだと
-            // キャプチャ付きのラムダ式を格納できなかった。
-            // std::function を用いる定義に書き直すと格納できるようになる。
-            [i](ProcessorProxy& vc, double value) {
-              return vc.GetCore()->SetSpeakerMorphingWeight(i, value);
+            // 話者ごとに設定するとその度にモーフィングをやり直すことになるので、
+            // ProcessorProxy で全話者分をまとめて設定する
+            [](ProcessorProxy& vc, double) {
+              return vc.SyncSpeakerMorphingWeights();
+            }));
+  }
+  // 追加の出力バスに出力する目標話者。
+  // Voice と同じく、モデルの話者数の番号は Voice Morphing Mode を表す
+  auto extra_target_voices = std::vector<std::u8string>{u8"Off"s};
+  for (auto i = 0; i < kMaxNSpeakers; ++i) {
+    const auto i_ascii = std::to_string(i);
+    const auto i_u8 = std::u8string(i_ascii.begin(), i_ascii.end());
+    extra_target_voices.push_back(u8"ID "s + i_u8);
+  }
+  for (auto i = 0; i < kMaxNExtraTargets; ++i) {
+    const auto i_ascii = std::to_string(i + 1);
+    const auto i_u8 = std::u8string(i_ascii.begin(), i_ascii.end());
+    schema.AddParameter(
+        static_cast<ParameterID>(
+            static_cast<int>(ParameterID::kExtraTargetVoiceBase) + i),
+        ListParameter(
+            u8"Extra Output "s + i_u8 + u8" Voice"s, extra_target_voices, 0,
+            u8"ExVc"s + i_u8, parameter_flag::kIsList,
+            [](ControllerCore&, int) { return ErrorCode::kSuccess; },
+            [i](ProcessorProxy& vc, const int value) {
+              return vc.GetCore()->SetExtraTargetSpeaker(i, value - 1);
+            }));
+    schema.AddParameter(
+        static_cast<ParameterID>(
+            static_cast<int>(ParameterID::kExtraTargetFormantShiftBase) + i),
+        NumberParameter(
+            u8"Extra Output "s + i_u8 + u8" Formant Shift"s, 0.0, -2.0, 2.0,
+            u8"semitones"s, 8, u8"ExFmt"s + i_u8,
+            parameter_flag::kCanAutomate,
+            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+            [i](ProcessorProxy& vc, const double value) {
+              return vc.GetCore()->SetExtraTargetFormantShift(i, value);
+            }));
+    schema.AddParameter(
+        static_cast<ParameterID>(
+            static_cast<int>(ParameterID::kExtraTargetPitchShiftBase) + i),
+        NumberParameter(
+            u8"Extra Output "s + i_u8 + u8" Pitch Shift"s, 0.0,
+            -kMaxAbsPitchShift, kMaxAbsPitchShift, u8"semitones"s, 48 * 8,
+            u8"ExPit"s + i_u8,
+            parameter_flag::kCanAutomate,
+            [](ControllerCore&, double) { return ErrorCode::kSuccess; },
+            [i](ProcessorProxy& vc, const double value) {
+              return vc.GetCore()->SetExtraTargetPitchShift(i, value);
             }));
   }
 
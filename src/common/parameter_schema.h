@@ -57,12 +57,35 @@ enum class ParameterID : std::int16_t {
   kMinSourcePitch = 12,
   kMaxSourcePitch = 13,
   kVQNumNeighbors = 14,
+  kMorphingQuality = 15,
+  kVoiceCacheSize = 16,
+  kParallelPitchEstimation = 17,
+  kPipelinedProcessing = 18,
+  kSilenceThreshold = 19,
+  kAdaptiveQuality = 20,
+  kQualityTier = 21,
+  kDeadlineMissCount = 22,
+  kWarmUpHops = 23,
+  kLockModelMemory = 24,
+  kPitchCalibration = 25,
+  kMeasuredAverageSourcePitch = 26,
+  kMeasuredMinSourcePitch = 27,
+  kMeasuredMaxSourcePitch = 28,
+  kHalfPrecisionEmbeddings = 29,
+  kLatencySamples = 30,
+  kModelLoadError = 31,
+  kRandomSeed = 32,
   kAverageTargetPitchBase = 100,
   // Voice Morphing Mode の分も格納するため、要素数は(kMaxNSpeakers + 1)となる
   kVoiceMorphWeights =
       kAverageTargetPitchBase +
       (kMaxNSpeakers + 1),  // Voice Morphing Mode の重みを保存するのに使う
-  kSentinel = kVoiceMorphWeights + kMaxNSpeakers,
+  // 追加の目標話者ごとの設定
+  kExtraTargetVoiceBase = kVoiceMorphWeights + kMaxNSpeakers,
+  kExtraTargetFormantShiftBase = kExtraTargetVoiceBase + kMaxNExtraTargets,
+  kExtraTargetPitchShiftBase =
+      kExtraTargetFormantShiftBase + kMaxNExtraTargets,
+  kSentinel = kExtraTargetPitchShiftBase + kMaxNExtraTargets,
 };
 
 class NumberParameter {
@@ -0,0 +1,107 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PIPELINE_DRIVER_H_
+#define BEATRICE_COMMON_PIPELINE_DRIVER_H_
+
+#include <atomic>
+#include <memory>
+
+#include "common/hop_pipeline.h"
+
+namespace beatrice::common {
+
+// HopPipeline の作り直しと、パイプライン処理の有効・無効の切り替えを
+// 行うクラス。
+// オーディオスレッドでスレッドを作らずに済むよう、HopPipeline は無効なときも
+// 作っておき、一時停止させておく。
+// 有効にするときはすぐにワーカーへ切り替える。無効にするときは、
+// ワーカーが推論の状態に触れている間は切り替えられないので、
+// 止まったのを確かめてから直接の推論に戻す。それまではワーカーに推論させ続ける
+template <int kInLength, int kOutLength>
+class PipelineDriver {
+ public:
+  using Pipeline = HopPipeline<kInLength, kOutLength>;
+
+  PipelineDriver() = default;
+  PipelineDriver(const PipelineDriver&) = delete;
+  auto operator=(const PipelineDriver&) -> PipelineDriver& = delete;
+
+  // 空の状態の HopPipeline を作り直す。無効であれば一時停止させておく。
+  // オーディオスレッド以外から、処理が止まっている間に呼ぶこと
+  void Restart(const int depth, const typename Pipeline::Job job,
+               void* const arg) {
+    Stop();
+    pipeline_ = std::make_unique<Pipeline>(depth, job, arg);
+    is_active_ = IsEnabled();
+    if (!is_active_) {
+      pipeline_->Pause();
+    }
+  }
+  // HopPipeline を破棄する。動いていたら true を返す
+  auto Stop() -> bool {
+    if (!pipeline_) {
+      return false;
+    }
+    pipeline_.reset();
+    is_active_ = false;
+    return true;
+  }
+
+  // 有効・無効を設定する。反映は UpdateMode() で行う
+  void SetEnabled(const bool enabled) {
+    is_enabled_.store(enabled, std::memory_order_relaxed);
+  }
+  [[nodiscard]] auto IsEnabled() const -> bool {
+    return is_enabled_.load(std::memory_order_relaxed);
+  }
+  // 実際にワーカーに推論させているか
+  [[nodiscard]] auto IsActive() const -> bool { return is_active_; }
+  [[nodiscard]] auto IsWorkerThread() const -> bool {
+    return pipeline_ && pipeline_->IsWorkerThread();
+  }
+  [[nodiscard]] auto HasPipeline() const -> bool {
+    return static_cast<bool>(pipeline_);
+  }
+  // 有効であれば遅延のフレーム数。無効なら 0
+  [[nodiscard]] auto GetDepth() const -> int {
+    return pipeline_ && IsEnabled() ? pipeline_->GetDepth() : 0;
+  }
+
+  // SetEnabled() の変更を反映する。オーディオスレッドから呼ぶ。
+  // 無効に切り替わり、ワーカーが止まったときに true を返す。
+  // このとき呼び出し側は、ワーカーに任せていた設定を反映すること
+  auto UpdateMode() -> bool {
+    const auto is_enabled = IsEnabled();
+    if (!pipeline_ || is_enabled == is_active_) {
+      return false;
+    }
+    if (is_enabled) {
+      pipeline_->Resume();
+      is_active_ = true;
+      return false;
+    }
+    pipeline_->Pause();
+    if (!pipeline_->IsPaused()) {
+      return false;
+    }
+    is_active_ = false;
+    return true;
+  }
+
+  // IsActive() の間、入力を渡して depth フレーム前の出力を受け取る
+  void Process(const float* const input, float* const output,
+               const int n_hops) {
+    pipeline_->Process(input, output, n_hops);
+  }
+
+ private:
+  std::unique_ptr<Pipeline> pipeline_;
+  // 設定された有効・無効。パイプライン処理中はワーカーが書き換える
+  std::atomic<bool> is_enabled_ = false;
+  // 実際にワーカーに推論させているか。オーディオスレッドのみが書き換える
+  bool is_active_ = false;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PIPELINE_DRIVER_H_
@@ -0,0 +1,118 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PITCH_CALIBRATOR_H_
+#define BEATRICE_COMMON_PITCH_CALIBRATOR_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+#include "beatricelib/beatrice.h"
+
+namespace beatrice::common {
+
+// 入力の音高の統計から求めた Average/Min/Max Source Pitch の推奨値。
+// n_voiced_hops が 0 なら推奨値はまだ無い
+struct SourcePitchStatistics {
+  double average = 0.0;
+  double min = 0.0;
+  double max = 0.0;
+  int n_voiced_hops = 0;
+};
+
+// ピッチ推定の結果のヒストグラムを取り、SourcePitchStatistics を求めるクラス。
+// Reset() と Add() は同じ 1 つのスレッドから呼ぶこと。
+// GetStatistics() は任意のスレッドから呼べる
+template <int kPitchBins>
+class PitchCalibrator {
+ public:
+  // 外れ値を除くため、範囲はこの割合の分位点から求める
+  static constexpr double kRangeQuantile = 0.02;
+  // 求めた範囲の外側にとる余裕 [半音]
+  static constexpr double kRangeMargin = 2.0;
+  // 何フレームごとに結果を更新するか
+  static constexpr int kPublishIntervalHops = 10;
+
+  PitchCalibrator() { Reset(); }
+
+  void Reset() {
+    histogram_.fill(0);
+    n_voiced_hops_ = 0;
+    sum_ = 0.0;
+    hops_since_publish_ = 0;
+    average_.store(0.0f, std::memory_order_relaxed);
+    min_.store(0.0f, std::memory_order_relaxed);
+    max_.store(0.0f, std::memory_order_relaxed);
+    n_published_hops_.store(0, std::memory_order_relaxed);
+  }
+
+  // 1 フレーム分のピッチ推定の結果を加える。0 は無声として数えない
+  void Add(const int quantized_pitch) {
+    if (quantized_pitch <= 0 || quantized_pitch >= kPitchBins) {
+      return;
+    }
+    ++histogram_[quantized_pitch];
+    ++n_voiced_hops_;
+    sum_ += BinToNote(quantized_pitch);
+    if (++hops_since_publish_ >= kPublishIntervalHops) {
+      Publish();
+    }
+  }
+
+  [[nodiscard]] auto GetStatistics() const -> SourcePitchStatistics {
+    return {
+        .average = average_.load(std::memory_order_relaxed),
+        .min = min_.load(std::memory_order_relaxed),
+        .max = max_.load(std::memory_order_relaxed),
+        .n_voiced_hops = n_published_hops_.load(std::memory_order_relaxed),
+    };
+  }
+
+  // 量子化されたピッチを Source Pitch と同じ単位 (MIDI ノート番号) にする
+  static constexpr auto BinToNote(const int quantized_pitch) -> double {
+    return 33.0 + quantized_pitch * (12.0 / BEATRICE_PITCH_BINS_PER_OCTAVE);
+  }
+
+ private:
+  void Publish() {
+    hops_since_publish_ = 0;
+    const auto quantile_count =
+        static_cast<int>(n_voiced_hops_ * kRangeQuantile);
+    auto low = 0;
+    auto high = kPitchBins - 1;
+    for (auto count = 0; low < kPitchBins - 1; ++low) {
+      count += histogram_[low];
+      if (count > quantile_count) {
+        break;
+      }
+    }
+    for (auto count = 0; high > 0; --high) {
+      count += histogram_[high];
+      if (count > quantile_count) {
+        break;
+      }
+    }
+    average_.store(static_cast<float>(sum_ / n_voiced_hops_),
+                   std::memory_order_relaxed);
+    min_.store(static_cast<float>(
+                   std::clamp(BinToNote(low) - kRangeMargin, 0.0, 128.0)),
+               std::memory_order_relaxed);
+    max_.store(static_cast<float>(
+                   std::clamp(BinToNote(high) + kRangeMargin, 0.0, 128.0)),
+               std::memory_order_relaxed);
+    n_published_hops_.store(n_voiced_hops_, std::memory_order_relaxed);
+  }
+
+  std::array<int, kPitchBins> histogram_;
+  int n_voiced_hops_;
+  double sum_;
+  int hops_since_publish_;
+  std::atomic<float> average_;
+  std::atomic<float> min_;
+  std::atomic<float> max_;
+  std::atomic<int> n_published_hops_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PITCH_CALIBRATOR_H_
@@ -0,0 +1,156 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_PITCH_MAPPING_H_
+#define BEATRICE_COMMON_PITCH_MAPPING_H_
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+
+#include "beatricelib/beatrice.h"
+
+// Beatrice
+#include "common/error.h"
+
+namespace beatrice::common {
+
+// ピッチ推定器が出力した量子化ピッチを、ピッチシフトや
+// ピッチ補正などを適用した量子化ピッチに変換するクラス。
+// 入力は高々 kPitchBins 通りしかないので、全ての入力に対する変換表を作っておき、
+// フレームごとの処理では表を引くだけにする。
+// オートメーションなどでパラメータが頻繁に変わっても重くならないよう、
+// 設定時には印を付けるだけにして、表は変更後に最初に引くときに 1 度だけ作り直す。
+// 同じ値の再設定では作り直さない
+template <int kPitchBins>
+class PitchMapping {
+ public:
+  PitchMapping() { Rebuild(); }
+
+  [[nodiscard]] auto operator()(const int quantized_pitch) const -> int {
+    if (is_dirty_) {
+      Rebuild();
+    }
+    return table_[std::clamp(quantized_pitch, 0, kPitchBins - 1)];
+  }
+
+  auto SetPitchShift(const double new_pitch_shift) -> ErrorCode {
+    Assign(pitch_shift_, std::clamp(new_pitch_shift, -24.0, 24.0));
+    return ErrorCode::kSuccess;
+  }
+  auto SetAverageSourcePitch(const double new_average_pitch) -> ErrorCode {
+    Assign(average_source_pitch_, std::clamp(new_average_pitch, 0.0, 128.0));
+    return ErrorCode::kSuccess;
+  }
+  auto SetIntonationIntensity(const double new_intonation_intensity)
+      -> ErrorCode {
+    Assign(intonation_intensity_, new_intonation_intensity);
+    return ErrorCode::kSuccess;
+  }
+  auto SetPitchCorrection(const double new_pitch_correction) -> ErrorCode {
+    Assign(pitch_correction_, std::clamp(new_pitch_correction, 0.0, 1.0));
+    return ErrorCode::kSuccess;
+  }
+  auto SetPitchCorrectionType(const int new_pitch_correction_type)
+      -> ErrorCode {
+    if (new_pitch_correction_type < 0 || new_pitch_correction_type > 1) {
+      return ErrorCode::kInvalidPitchCorrectionType;
+    }
+    Assign(pitch_correction_type_, new_pitch_correction_type);
+    return ErrorCode::kSuccess;
+  }
+
+ private:
+  template <typename T>
+  void Assign(T& dst, const T value) {
+    if (dst != value) {
+      dst = value;
+      is_dirty_ = true;
+    }
+  }
+  void Rebuild() const {
+    for (auto i = 0; i < kPitchBins; ++i) {
+      table_[i] = Map(i);
+    }
+    is_dirty_ = false;
+  }
+
+  [[nodiscard]] auto Map(const int quantized_pitch) const -> int {
+    constexpr auto kPitchBinsPerSemitone =
+        static_cast<double>(BEATRICE_PITCH_BINS_PER_OCTAVE) / 12.0;
+    // PitchShift, IntonationIntensity
+    auto tmp_quantized_pitch =
+        average_source_pitch_ +
+        (static_cast<double>(quantized_pitch) - average_source_pitch_) *
+            intonation_intensity_ +
+        kPitchBinsPerSemitone * pitch_shift_;
+    // PitchCorrection
+    if (pitch_correction_ != 0.0) {
+      const auto before_pitch_correction = tmp_quantized_pitch;
+      if (pitch_correction_type_ == 0) {
+        // x|x|^{-p}
+        const auto nearest_pitch =
+            (std::floor(tmp_quantized_pitch / kPitchBinsPerSemitone) + 0.5) *
+            kPitchBinsPerSemitone;
+        const auto normalized_delta = (tmp_quantized_pitch - nearest_pitch) *
+                                      (2.0 / kPitchBinsPerSemitone);
+        if (std::abs(normalized_delta) < 1e-4) {
+          tmp_quantized_pitch = nearest_pitch;
+        } else {
+          tmp_quantized_pitch =
+              nearest_pitch +
+              normalized_delta *
+                  std::pow(std::abs(normalized_delta), -pitch_correction_) *
+                  (kPitchBinsPerSemitone / 2.0);
+        }
+        assert(
+            std::abs(tmp_quantized_pitch -
+                     std::round(tmp_quantized_pitch / kPitchBinsPerSemitone) *
+                         kPitchBinsPerSemitone) <=
+            std::abs(before_pitch_correction -
+                     std::round(tmp_quantized_pitch / kPitchBinsPerSemitone) *
+                         kPitchBinsPerSemitone) +
+                1e-4);
+      } else if (pitch_correction_type_ == 1) {
+        // sgn(x)|x|^{1/(1-p)}
+        const auto nearest_pitch =
+            std::round(tmp_quantized_pitch / kPitchBinsPerSemitone) *
+            kPitchBinsPerSemitone;
+        const auto normalized_delta = (tmp_quantized_pitch - nearest_pitch) *
+                                      (2.0 / kPitchBinsPerSemitone);
+        if (pitch_correction_ > 1 - 1e-4) {
+          tmp_quantized_pitch = nearest_pitch;
+        } else if (normalized_delta >= 0.0) {
+          tmp_quantized_pitch =
+              nearest_pitch +
+              std::pow(normalized_delta, 1.0 / (1.0 - pitch_correction_)) *
+                  (kPitchBinsPerSemitone / 2.0);
+        } else {
+          tmp_quantized_pitch =
+              nearest_pitch -
+              std::pow(-normalized_delta, 1.0 / (1.0 - pitch_correction_)) *
+                  (kPitchBinsPerSemitone / 2.0);
+        }
+        assert(std::abs(tmp_quantized_pitch - nearest_pitch) <=
+               std::abs(before_pitch_correction - nearest_pitch) + 1e-4);
+      } else {
+        assert(false);
+      }
+    }
+    return std::clamp(static_cast<int>(std::round(tmp_quantized_pitch)), 1,
+                      kPitchBins - 1);
+  }
+
+  double pitch_shift_ = 0.0;
+  double average_source_pitch_ = 52.0;
+  double intonation_intensity_ = 1.0;
+  double pitch_correction_ = 0.0;
+  int pitch_correction_type_ = 0;
+  // 表はパラメータから決まるキャッシュなので、引くときに作り直してよい
+  mutable std::array<int, kPitchBins> table_;
+  mutable bool is_dirty_ = false;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_PITCH_MAPPING_H_
@@ -3,11 +3,27 @@
 #ifndef BEATRICE_COMMON_PROCESSOR_CORE_H_
 #define BEATRICE_COMMON_PROCESSOR_CORE_H_
 
+#include <cstring>
+#include <span>
+
 #include "common/error.h"
 #include "common/model_config.h"
+#include "common/pitch_calibrator.h"
 
 namespace beatrice::common {
 
+// 話者モーフィングの計算方法
+enum class MorphingQuality : int {
+  // 球面平均を収束するまで求める
+  kExact = 0,
+  // 正規化した重み付き線形和で近似する
+  kFast = 1,
+  // 線形和で近似した場合の角度誤差を測り、十分小さければ近似で済ませる
+  kAuto = 2,
+};
+// kAuto で近似を使ってよい角度誤差の上限 [rad]
+static constexpr auto kMorphingMaxApproximationAngle = 1e-2;
+
 // 任意のサンプリング周波数と任意のブロックサイズで
 // Beatrice の推論を行う、ミニマルな信号処理クラス。
 // 1 つの子クラスは 1 つのモデルバージョンに対応する。
@@ -23,16 +39,54 @@ class ProcessorCoreBase {
   [[nodiscard]] virtual auto GetVersion() const -> int = 0;
   virtual auto Process(const float* input, float* output, int n_samples)
       -> ErrorCode = 0;
+  // Process() に加えて、追加の目標話者の音声を extra_outputs[i] に出力する。
+  // extra_outputs[i] が nullptr であるか i >= n_extra_outputs の出力は捨てる。
+  // 対応していない ProcessorCore では追加の出力は無音になる
+  virtual auto ProcessMultiTarget(const float* input, float* output,
+                                  float* const* extra_outputs,
+                                  int n_extra_outputs, int n_samples)
+      -> ErrorCode {
+    for (auto i = 0; i < n_extra_outputs; ++i) {
+      if (extra_outputs[i] != nullptr) {
+        std::memset(extra_outputs[i], 0, sizeof(float) * n_samples);
+      }
+    }
+    return Process(input, output, n_samples);
+  }
   virtual auto ResetContext() -> ErrorCode { return ErrorCode::kSuccess; }
   virtual auto LoadModel(const ModelConfig& /*config*/,
                          const std::filesystem::path& /*file*/) -> ErrorCode {
     return ErrorCode::kSuccess;
   }
+  // ホストに報告する遅延 [サンプル]。
+  // 今のところパイプライン処理で増える分のみを含む
+  [[nodiscard]] virtual auto GetLatencySamples() const -> int { return 0; }
+  // 無音区間の推論を自前で省略するか。
+  // false であれば、呼び出し側が無音のブロックの処理を省略してよい
+  [[nodiscard]] virtual auto IsSilenceGated() const -> bool { return false; }
+  // 負荷に応じて下げている品質の段階 (QualityTier) と、
+  // フレームの処理が間に合わなかった回数。任意のスレッドから呼べる
+  [[nodiscard]] virtual auto GetQualityTier() const -> int { return 0; }
+  [[nodiscard]] virtual auto GetDeadlineMissCount() const -> int { return 0; }
+  // SetPitchCalibration(true) の間に測った入力の音高の統計。
+  // 任意のスレッドから呼べる
+  [[nodiscard]] virtual auto GetSourcePitchStatistics() const
+      -> SourcePitchStatistics {
+    return {};
+  }
 
  protected:
   virtual auto SetSampleRate(double /*sample_rate*/) -> ErrorCode {
     return ErrorCode::kSuccess;
   }
+  virtual auto SetMaxBlockSize(int /*max_block_size*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // LoadModel() とパラメータの反映の後、音声処理に使われる前に呼ばれる。
+  // 使い捨ての状態で n_hops フレーム推論し、重みなどをメモリに載せておく
+  virtual auto WarmUp(int /*n_hops*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
 
  public:
   virtual auto SetTargetSpeaker(int /*target_speaker*/) -> ErrorCode {
@@ -75,6 +129,68 @@ class ProcessorCoreBase {
   virtual auto SetVQNumNeighbors(int /*vq_num_neighbors*/) -> ErrorCode {
     return ErrorCode::kSuccess;
   }
+  virtual auto SetMorphingQuality(int /*morphing_quality*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  virtual auto SetVoiceCacheSize(int /*voice_cache_size*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // ピッチ推定を音素抽出と並行して別スレッドで行うか
+  virtual auto SetParallelPitchEstimation(bool /*parallel_pitch_estimation*/)
+      -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // 推論を専用のワーカースレッドで行い、その分の遅延を追加するか。
+  // 有効な間に変更された設定は、ワーカーがフレームの区切りで反映する。
+  // 追加の目標話者は処理せず、その出力は無音になる
+  virtual auto SetPipelinedProcessing(bool /*pipelined_processing*/)
+      -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // 入力のフレームの音量がこれを下回る区間では推論を省略する [dB]
+  virtual auto SetSilenceThreshold(double /*silence_threshold*/)
+      -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // 有効な間は変換を止めて無音を出力し、ピッチ推定だけを行って
+  // 入力の音高の統計を取る。有効にするたびに統計をやり直す
+  virtual auto SetPitchCalibration(bool /*pitch_calibration*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // 負荷が高いときに品質を自動的に下げるか
+  virtual auto SetAdaptiveQuality(bool /*adaptive_quality*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // モデルの重みや話者埋め込みを物理メモリに固定するか。
+  // LoadModel() より前に設定する
+  virtual auto SetLockModelMemory(bool /*lock_model_memory*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // 話者埋め込みのうち大きなものを半精度で保持し、使う直前に単精度に戻すか。
+  // 次に LoadModel() したときから反映される
+  virtual auto SetHalfPrecisionEmbeddings(bool /*half_precision_embeddings*/)
+      -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  // 処理中に使う乱数のシード。同じシードなら同じ入力に対して同じ出力になる
+  virtual auto SetRandomSeed(unsigned int /*seed*/) -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+
+  // 追加の目標話者の設定。target_speaker が負であればその出力を無効にする
+  virtual auto SetExtraTargetSpeaker(int /*index*/, int /*target_speaker*/)
+      -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  virtual auto SetExtraTargetFormantShift(int /*index*/,
+                                          double /*formant_shift*/)
+      -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
+  virtual auto SetExtraTargetPitchShift(int /*index*/, double /*pitch_shift*/)
+      -> ErrorCode {
+    return ErrorCode::kSuccess;
+  }
 
   virtual auto SetSpeakerMorphingWeight(int /*target_speaker*/,
                                         double /*morphing weight*/
@@ -82,6 +198,19 @@ class ProcessorCoreBase {
       -> ErrorCode {
     return ErrorCode::kSuccess;
   }
+  // 話者 0 から順の重みをまとめて設定する。
+  // 話者ごとに設定するより、モーフィングの再計算が 1 回で済む
+  virtual auto SetSpeakerMorphingWeights(const std::span<const double> weights)
+      -> ErrorCode {
+    auto error = ErrorCode::kSuccess;
+    for (auto i = 0; i < static_cast<int>(weights.size()); ++i) {
+      if (const auto err = SetSpeakerMorphingWeight(i, weights[i]);
+          error == ErrorCode::kSuccess) {
+        error = err;
+      }
+    }
+    return error;
+  }
 
   friend class ProcessorProxy;
 };
@@ -3,119 +3,72 @@
 #ifndef BEATRICE_COMMON_PROCESSOR_CORE_0_H_
 #define BEATRICE_COMMON_PROCESSOR_CORE_0_H_
 
-#include <array>
-#include <filesystem>
-#include <vector>
-
 #include "beatricelib/beatrice.h"
 
 // Beatrice
-#include "common/error.h"
-#include "common/gain.h"
-#include "common/model_config.h"
-#include "common/processor_core.h"
-#include "common/resample.h"
-#include "common/spherical_average.h"
+#include "common/basic_processor_core.h"
 
 namespace beatrice::common {
 
-// 2.0.0-alpha.2 用の信号処理クラス
-class ProcessorCore0 : public ProcessorCoreBase {
- public:
-  explicit ProcessorCore0(const double sample_rate)
-      : ProcessorCoreBase(),
-        any_freq_in_out_(sample_rate),
-        phone_extractor_(Beatrice20a2_CreatePhoneExtractor()),
-        pitch_estimator_(Beatrice20a2_CreatePitchEstimator()),
-        waveform_generator_(Beatrice20a2_CreateWaveformGenerator()),
-        gain_(),
-        phone_context_(Beatrice20a2_CreatePhoneContext1()),
-        pitch_context_(Beatrice20a2_CreatePitchContext1()),
-        waveform_context_(Beatrice20a2_CreateWaveformContext1()),
-        input_gain_context_(sample_rate),
-        output_gain_context_(sample_rate),
-        speaker_morphing_weights_() {}
-  ~ProcessorCore0() override {
-    Beatrice20a2_DestroyPhoneExtractor(phone_extractor_);
-    Beatrice20a2_DestroyPitchEstimator(pitch_estimator_);
-    Beatrice20a2_DestroyWaveformGenerator(waveform_generator_);
-    Beatrice20a2_DestroyPhoneContext1(phone_context_);
-    Beatrice20a2_DestroyPitchContext1(pitch_context_);
-    Beatrice20a2_DestroyWaveformContext1(waveform_context_);
-  }
-  [[nodiscard]] auto GetVersion() const -> int override;
-  auto Process(const float* input, float* output, int n_samples)
-      -> ErrorCode override;
-  auto ResetContext() -> ErrorCode override;
-  auto LoadModel(const ModelConfig& /*config*/,
-                 const std::filesystem::path& /*file*/) -> ErrorCode override;
-  auto SetSampleRate(double /*sample_rate*/) -> ErrorCode override;
-  auto SetTargetSpeaker(int /*target_speaker*/) -> ErrorCode override;
-  auto SetFormantShift(double /*formant_shift*/) -> ErrorCode override;
-  auto SetPitchShift(double /*pitch_shift*/) -> ErrorCode override;
-  auto SetInputGain(double /*input_gain*/) -> ErrorCode override;
-  auto SetOutputGain(double /*output_gain*/) -> ErrorCode override;
-  auto SetAverageSourcePitch(double /*average_pitch*/) -> ErrorCode override;
-  // NOLINTNEXTLINE(readability/casting)
-  auto SetIntonationIntensity(double /*intonation_intensity*/)
-      -> ErrorCode override;
-  auto SetPitchCorrection(double /*pitch_correction*/) -> ErrorCode override;
-  // NOLINTNEXTLINE(readability/casting)
-  auto SetPitchCorrectionType(int /*pitch_correction_type*/)
-      -> ErrorCode override;
-  auto SetMinSourcePitch(double /*min_source_pitch*/) -> ErrorCode override;
-  auto SetMaxSourcePitch(double /*max_source_pitch*/) -> ErrorCode override;
-  auto SetSpeakerMorphingWeight(int /*target_speaker*/,
-                                double /*morphing weight*/
-                                )      // NOLINT(whitespace/parens)
-      -> ErrorCode override;
-
- private:
-  class ConvertWithModelBlockSize {
-   public:
-    ConvertWithModelBlockSize() = default;
-    void operator()(const float* const input, float* const output,
-                    ProcessorCore0& processor_core) const {
-      processor_core.Process1(input, output);
-    }
-  };
+// 2.0.0-alpha.2 のモデルの API
+struct ProcessorCore0Traits {
+  static constexpr int kVersion = 0;
+  static constexpr int kPhoneChannels = BEATRICE_20A2_PHONE_CHANNELS;
+  static constexpr int kPitchBins = BEATRICE_20A2_PITCH_BINS;
+  static constexpr bool kHasMorphingQuality = false;
 
-  std::filesystem::path model_file_;
-  int target_speaker_ = 0;
-  double formant_shift_ = 0.0;
-  double pitch_shift_ = 0.0;
-  int n_speakers_ = 0;
-  double average_source_pitch_ = 52.0;
-  double intonation_intensity_ = 1.0;
-  double pitch_correction_ = 0.0;
-  int pitch_correction_type_ = 0;
-  double min_source_pitch_ = 33.125;
-  double max_source_pitch_ = 80.875;
+  using PhoneExtractor = Beatrice20a2_PhoneExtractor;
+  using PhoneContext = Beatrice20a2_PhoneContext1;
+  using PitchEstimator = Beatrice20a2_PitchEstimator;
+  using PitchContext = Beatrice20a2_PitchContext1;
+  using WaveformGenerator = Beatrice20a2_WaveformGenerator;
+  using WaveformContext = Beatrice20a2_WaveformContext1;
 
-  resampler::AnyFreqInOut<ConvertWithModelBlockSize> any_freq_in_out_;
+  static constexpr auto CreatePhoneExtractor =
+      Beatrice20a2_CreatePhoneExtractor;
+  static constexpr auto DestroyPhoneExtractor =
+      Beatrice20a2_DestroyPhoneExtractor;
+  static constexpr auto CreatePhoneContext = Beatrice20a2_CreatePhoneContext1;
+  static constexpr auto DestroyPhoneContext = Beatrice20a2_DestroyPhoneContext1;
+  static constexpr auto ReadPhoneExtractorParameters =
+      Beatrice20a2_ReadPhoneExtractorParameters;
+  static constexpr auto ExtractPhone = Beatrice20a2_ExtractPhone1;
 
-  // モデル
-  Beatrice20a2_PhoneExtractor* phone_extractor_;
-  Beatrice20a2_PitchEstimator* pitch_estimator_;
-  Beatrice20a2_WaveformGenerator* waveform_generator_;
-  AlignedVector<float, 64> speaker_embeddings_;
-  std::vector<float> formant_shift_embeddings_;
-  Gain gain_;
-  // 状態
-  Beatrice20a2_PhoneContext1* phone_context_;
-  Beatrice20a2_PitchContext1* pitch_context_;
-  Beatrice20a2_WaveformContext1* waveform_context_;
-  Gain::Context input_gain_context_;
-  Gain::Context output_gain_context_;
+  static constexpr auto CreatePitchEstimator =
+      Beatrice20a2_CreatePitchEstimator;
+  static constexpr auto DestroyPitchEstimator =
+      Beatrice20a2_DestroyPitchEstimator;
+  static constexpr auto CreatePitchContext = Beatrice20a2_CreatePitchContext1;
+  static constexpr auto DestroyPitchContext = Beatrice20a2_DestroyPitchContext1;
+  static constexpr auto ReadPitchEstimatorParameters =
+      Beatrice20a2_ReadPitchEstimatorParameters;
+  static constexpr auto SetMinQuantizedPitch =
+      Beatrice20a2_SetMinQuantizedPitch;
+  static constexpr auto SetMaxQuantizedPitch =
+      Beatrice20a2_SetMaxQuantizedPitch;
+  static constexpr auto EstimatePitch = Beatrice20a2_EstimatePitch1;
 
-  // モデルマージ
-  std::array<float, kMaxNSpeakers> speaker_morphing_weights_;
-  SphericalAverage<float, BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS> sph_avg_;
+  static constexpr auto ReadNSpeakers = Beatrice20a2_ReadNSpeakers;
+  static constexpr auto ReadSpeakerEmbeddings =
+      Beatrice20a2_ReadSpeakerEmbeddings;
 
-  auto IsLoaded() -> bool { return !model_file_.empty(); }
-  void Process1(const float* input, float* output);
+  static constexpr auto CreateWaveformGenerator =
+      Beatrice20a2_CreateWaveformGenerator;
+  static constexpr auto DestroyWaveformGenerator =
+      Beatrice20a2_DestroyWaveformGenerator;
+  static constexpr auto CreateWaveformContext =
+      Beatrice20a2_CreateWaveformContext1;
+  static constexpr auto DestroyWaveformContext =
+      Beatrice20a2_DestroyWaveformContext1;
+  static constexpr auto ReadWaveformGeneratorParameters =
+      Beatrice20a2_ReadWaveformGeneratorParameters;
+  static constexpr auto GenerateWaveform = Beatrice20a2_GenerateWaveform1;
 };
 
+// 2.0.0-alpha.2 用の信号処理クラス
+using ProcessorCore0 = BasicProcessorCore<ProcessorCore0Traits>;
+extern template class BasicProcessorCore<ProcessorCore0Traits>;
+
 }  // namespace beatrice::common
 
 #endif  // BEATRICE_COMMON_PROCESSOR_CORE_0_H_
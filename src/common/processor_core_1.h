@@ -3,119 +3,72 @@
 #ifndef BEATRICE_COMMON_PROCESSOR_CORE_1_H_
 #define BEATRICE_COMMON_PROCESSOR_CORE_1_H_
 
-#include <array>
-#include <filesystem>
-#include <vector>
-
 #include "beatricelib/beatrice.h"
 
 // Beatrice
-#include "common/error.h"
-#include "common/gain.h"
-#include "common/model_config.h"
-#include "common/processor_core.h"
-#include "common/resample.h"
-#include "common/spherical_average.h"
+#include "common/basic_processor_core.h"
 
 namespace beatrice::common {
 
-// 2.0.0-beta.1 用の信号処理クラス
-class ProcessorCore1 : public ProcessorCoreBase {
- public:
-  explicit ProcessorCore1(const double sample_rate)
-      : ProcessorCoreBase(),
-        any_freq_in_out_(sample_rate),
-        phone_extractor_(Beatrice20b1_CreatePhoneExtractor()),
-        pitch_estimator_(Beatrice20b1_CreatePitchEstimator()),
-        waveform_generator_(Beatrice20b1_CreateWaveformGenerator()),
-        gain_(),
-        phone_context_(Beatrice20b1_CreatePhoneContext1()),
-        pitch_context_(Beatrice20b1_CreatePitchContext1()),
-        waveform_context_(Beatrice20b1_CreateWaveformContext1()),
-        input_gain_context_(sample_rate),
-        output_gain_context_(sample_rate),
-        speaker_morphing_weights_() {}
-  ~ProcessorCore1() override {
-    Beatrice20b1_DestroyPhoneExtractor(phone_extractor_);
-    Beatrice20b1_DestroyPitchEstimator(pitch_estimator_);
-    Beatrice20b1_DestroyWaveformGenerator(waveform_generator_);
-    Beatrice20b1_DestroyPhoneContext1(phone_context_);
-    Beatrice20b1_DestroyPitchContext1(pitch_context_);
-    Beatrice20b1_DestroyWaveformContext1(waveform_context_);
-  }
-  [[nodiscard]] auto GetVersion() const -> int override;
-  auto Process(const float* input, float* output, int n_samples)
-      -> ErrorCode override;
-  auto ResetContext() -> ErrorCode override;
-  auto LoadModel(const ModelConfig& /*config*/,
-                 const std::filesystem::path& /*file*/) -> ErrorCode override;
-  auto SetSampleRate(double /*sample_rate*/) -> ErrorCode override;
-  auto SetTargetSpeaker(int /*target_speaker*/) -> ErrorCode override;
-  auto SetFormantShift(double /*formant_shift*/) -> ErrorCode override;
-  auto SetPitchShift(double /*pitch_shift*/) -> ErrorCode override;
-  auto SetInputGain(double /*input_gain*/) -> ErrorCode override;
-  auto SetOutputGain(double /*output_gain*/) -> ErrorCode override;
-  auto SetAverageSourcePitch(double /*average_pitch*/) -> ErrorCode override;
-  // NOLINTNEXTLINE(readability/casting)
-  auto SetIntonationIntensity(double /*intonation_intensity*/)
-      -> ErrorCode override;
-  auto SetPitchCorrection(double /*pitch_correction*/) -> ErrorCode override;
-  // NOLINTNEXTLINE(readability/casting)
-  auto SetPitchCorrectionType(int /*pitch_correction_type*/)
-      -> ErrorCode override;
-  auto SetMinSourcePitch(double /*min_source_pitch*/) -> ErrorCode override;
-  auto SetMaxSourcePitch(double /*max_source_pitch*/) -> ErrorCode override;
-  auto SetSpeakerMorphingWeight(int /*target_speaker*/,
-                                double /*morphing weight*/
-                                )      // NOLINT(whitespace/parens)
-      -> ErrorCode override;
-
- private:
-  class ConvertWithModelBlockSize {
-   public:
-    ConvertWithModelBlockSize() = default;
-    void operator()(const float* const input, float* const output,
-                    ProcessorCore1& processor_core) const {
-      processor_core.Process1(input, output);
-    }
-  };
+// 2.0.0-beta.1 のモデルの API
+struct ProcessorCore1Traits {
+  static constexpr int kVersion = 1;
+  static constexpr int kPhoneChannels = BEATRICE_20B1_PHONE_CHANNELS;
+  static constexpr int kPitchBins = BEATRICE_20B1_PITCH_BINS;
+  static constexpr bool kHasMorphingQuality = true;
 
-  std::filesystem::path model_file_;
-  int target_speaker_ = 0;
-  double formant_shift_ = 0.0;
-  double pitch_shift_ = 0.0;
-  int n_speakers_ = 0;
-  double average_source_pitch_ = 52.0;
-  double intonation_intensity_ = 1.0;
-  double pitch_correction_ = 0.0;
-  int pitch_correction_type_ = 0;
-  double min_source_pitch_ = 33.125;
-  double max_source_pitch_ = 80.875;
+  using PhoneExtractor = Beatrice20b1_PhoneExtractor;
+  using PhoneContext = Beatrice20b1_PhoneContext1;
+  using PitchEstimator = Beatrice20b1_PitchEstimator;
+  using PitchContext = Beatrice20b1_PitchContext1;
+  using WaveformGenerator = Beatrice20b1_WaveformGenerator;
+  using WaveformContext = Beatrice20b1_WaveformContext1;
 
-  resampler::AnyFreqInOut<ConvertWithModelBlockSize> any_freq_in_out_;
+  static constexpr auto CreatePhoneExtractor =
+      Beatrice20b1_CreatePhoneExtractor;
+  static constexpr auto DestroyPhoneExtractor =
+      Beatrice20b1_DestroyPhoneExtractor;
+  static constexpr auto CreatePhoneContext = Beatrice20b1_CreatePhoneContext1;
+  static constexpr auto DestroyPhoneContext = Beatrice20b1_DestroyPhoneContext1;
+  static constexpr auto ReadPhoneExtractorParameters =
+      Beatrice20b1_ReadPhoneExtractorParameters;
+  static constexpr auto ExtractPhone = Beatrice20b1_ExtractPhone1;
 
-  // モデル
-  Beatrice20b1_PhoneExtractor* phone_extractor_;
-  Beatrice20b1_PitchEstimator* pitch_estimator_;
-  Beatrice20b1_WaveformGenerator* waveform_generator_;
-  AlignedVector<float, 64> speaker_embeddings_;
-  std::vector<float> formant_shift_embeddings_;
-  Gain gain_;
-  // 状態
-  Beatrice20b1_PhoneContext1* phone_context_;
-  Beatrice20b1_PitchContext1* pitch_context_;
-  Beatrice20b1_WaveformContext1* waveform_context_;
-  Gain::Context input_gain_context_;
-  Gain::Context output_gain_context_;
+  static constexpr auto CreatePitchEstimator =
+      Beatrice20b1_CreatePitchEstimator;
+  static constexpr auto DestroyPitchEstimator =
+      Beatrice20b1_DestroyPitchEstimator;
+  static constexpr auto CreatePitchContext = Beatrice20b1_CreatePitchContext1;
+  static constexpr auto DestroyPitchContext = Beatrice20b1_DestroyPitchContext1;
+  static constexpr auto ReadPitchEstimatorParameters =
+      Beatrice20b1_ReadPitchEstimatorParameters;
+  static constexpr auto SetMinQuantizedPitch =
+      Beatrice20b1_SetMinQuantizedPitch;
+  static constexpr auto SetMaxQuantizedPitch =
+      Beatrice20b1_SetMaxQuantizedPitch;
+  static constexpr auto EstimatePitch = Beatrice20b1_EstimatePitch1;
 
-  // モデルマージ
-  std::array<float, kMaxNSpeakers> speaker_morphing_weights_;
-  SphericalAverage<float, BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS> sph_avg_;
+  static constexpr auto ReadNSpeakers = Beatrice20b1_ReadNSpeakers;
+  static constexpr auto ReadSpeakerEmbeddings =
+      Beatrice20b1_ReadSpeakerEmbeddings;
 
-  auto IsLoaded() -> bool { return !model_file_.empty(); }
-  void Process1(const float* input, float* output);
+  static constexpr auto CreateWaveformGenerator =
+      Beatrice20b1_CreateWaveformGenerator;
+  static constexpr auto DestroyWaveformGenerator =
+      Beatrice20b1_DestroyWaveformGenerator;
+  static constexpr auto CreateWaveformContext =
+      Beatrice20b1_CreateWaveformContext1;
+  static constexpr auto DestroyWaveformContext =
+      Beatrice20b1_DestroyWaveformContext1;
+  static constexpr auto ReadWaveformGeneratorParameters =
+      Beatrice20b1_ReadWaveformGeneratorParameters;
+  static constexpr auto GenerateWaveform = Beatrice20b1_GenerateWaveform1;
 };
 
+// 2.0.0-beta.1 用の信号処理クラス
+using ProcessorCore1 = BasicProcessorCore<ProcessorCore1Traits>;
+extern template class BasicProcessorCore<ProcessorCore1Traits>;
+
 }  // namespace beatrice::common
 
 #endif  // BEATRICE_COMMON_PROCESSOR_CORE_1_H_
@@ -2,13 +2,26 @@
 
 #include "common/processor_core_2.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
 #include <numeric>
+#include <random>
+#include <string>
+#include <system_error>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
 
+#include "common/cache_directory.h"
 #include "common/error.h"
 #include "common/model_config.h"
+#include "common/parallel_tasks.h"
 
 namespace beatrice::common {
 
@@ -30,8 +43,10 @@ auto ProcessorCore2::Process(const float* const input, float* const output,
   if (!output_gain_context_.IsReady()) {
     return fill_zero(), ErrorCode::kGainNotReady;
   }
-  if (pitch_correction_type_ < 0 || pitch_correction_type_ > 1) {
-    return fill_zero(), ErrorCode::kInvalidPitchCorrectionType;
+  UpdatePipelineMode();
+  if (!pipeline_.IsActive() && HasExtraTargets()) {
+    // 追加の目標話者のフレームの区切りがずれないよう、出力は捨てて処理を進める
+    return ProcessMultiTarget(input, output, nullptr, 0, n_samples);
   }
   gain_.Process(input, output, n_samples, input_gain_context_);
   any_freq_in_out_(output, output, n_samples, *this);
@@ -39,211 +54,591 @@ auto ProcessorCore2::Process(const float* const input, float* const output,
   return ErrorCode::kSuccess;
 }
 
+// メインの出力を処理した後、同じ入力で各追加の目標話者の出力を処理する。
+// 追加の目標話者の処理はメインが記録した解析結果を参照するので、
+// 記録が上書きされないようチャンクごとに交互に進める
+auto ProcessorCore2::ProcessMultiTarget(const float* const input,
+                                        float* const output,
+                                        float* const* const extra_outputs,
+                                        const int n_extra_outputs,
+                                        const int n_samples) -> ErrorCode {
+  const auto get_extra_output = [extra_outputs, n_extra_outputs](
+                                    const int i) -> float* {
+    return i < n_extra_outputs ? extra_outputs[i] : nullptr;
+  };
+  const auto fill_zero = [&] {
+    std::memset(output, 0, sizeof(float) * n_samples);
+    for (auto i = 0; i < n_extra_outputs; ++i) {
+      if (auto* const extra_output = get_extra_output(i)) {
+        std::memset(extra_output, 0, sizeof(float) * n_samples);
+      }
+    }
+  };
+  if (!IsLoaded()) {
+    return fill_zero(), ErrorCode::kModelNotLoaded;
+  }
+  if (!any_freq_in_out_.IsReady()) {
+    return fill_zero(), ErrorCode::kResamplerNotReady;
+  }
+  if (!input_gain_context_.IsReady()) {
+    return fill_zero(), ErrorCode::kGainNotReady;
+  }
+  if (!output_gain_context_.IsReady()) {
+    return fill_zero(), ErrorCode::kGainNotReady;
+  }
+  UpdatePipelineMode();
+  if (pipeline_.IsActive()) {
+    // 追加の目標話者の状態はワーカーが触るので、パイプライン処理中は処理しない
+    gain_.Process(input, output, n_samples, input_gain_context_);
+    any_freq_in_out_(output, output, n_samples, *this);
+    gain_.Process(output, output, n_samples, output_gain_context_);
+    for (auto i = 0; i < n_extra_outputs; ++i) {
+      if (auto* const extra_output = get_extra_output(i)) {
+        std::memset(extra_output, 0, sizeof(float) * n_samples);
+      }
+    }
+    return ErrorCode::kSuccess;
+  }
+  for (auto offset = 0; offset < n_samples; offset += kMultiTargetChunkSize) {
+    const auto n = std::min(n_samples - offset, kMultiTargetChunkSize);
+    // input と output は同じバッファの場合があるので、入力をとっておく
+    gain_.Process(input + offset, multi_target_input_.data(), n,
+                  input_gain_context_);
+    any_freq_in_out_(multi_target_input_.data(), output + offset, n, *this);
+    gain_.Process(output + offset, output + offset, n, output_gain_context_);
+    for (auto i = 0; i < kMaxNExtraTargets; ++i) {
+      auto* const extra_output = get_extra_output(i);
+      auto& extra = extra_targets_[i];
+      if (!extra) {
+        if (extra_output != nullptr) {
+          std::memset(extra_output + offset, 0, sizeof(float) * n);
+        }
+        continue;
+      }
+      auto* const dst = extra_output != nullptr ? extra_output + offset
+                                                : multi_target_scratch_.data();
+      extra->any_freq_in_out(multi_target_input_.data(), dst, n, *this, i);
+      gain_.Process(dst, dst, n, extra->output_gain_context);
+    }
+  }
+  return ErrorCode::kSuccess;
+}
+
 void ProcessorCore2::Process1(const float* const input, float* const output) {
+  ProcessBatch(input, output, 1);
+}
+
+void ProcessorCore2::ProcessBatch(const float* const input, float* const output,
+                                  const int n_hops) {
+  const auto first_seq = hop_count_;
+  hop_count_ += n_hops;
+  if (pipeline_.IsActive()) {
+    // 推論はワーカースレッドに任せ、ここでは受け渡しのみを行う
+    pipeline_.Process(input, output, n_hops);
+    return;
+  }
+  InferGated(input, output, n_hops, HasExtraTargets() ? first_seq : -1);
+}
+
+// 無音のフレームは推論を省略し、連続する有音のフレームをまとめて推論する。
+// リサンプラーはフレームの外側にあるので、省略しても状態は途切れない
+void ProcessorCore2::InferGated(const float* const input, float* const output,
+                                const int n_hops,
+                                const std::int64_t first_seq) {
+  if (is_pitch_calibrating_) {
+    CalibratePitch(input, n_hops);
+    std::memset(output, 0, sizeof(float) * BEATRICE_OUT_HOP_LENGTH * n_hops);
+    return;
+  }
+  const auto is_recording = first_seq >= 0;
+  std::array<bool, resampler::kMaxNBatchBlocks> is_active;
+  auto n_active_hops = 0;
+  for (auto i = 0; i < n_hops; ++i) {
+    is_active[i] = silence_gate_.Update(input + i * BEATRICE_IN_HOP_LENGTH);
+    n_active_hops += is_active[i];
+  }
+  // 再開時に流し込めるフレーム数。1 回の処理で推論するフレームが増えすぎないよう、
+  // 平均的な負荷から見積もって、このバッチの予算に収まる分だけとする
+  constexpr auto kPreRollHops = decltype(silence_gate_)::kPreRollHops;
+  auto n_pre_roll_budget = kPreRollHops;
+  if (const auto load = governor_.GetAverageLoad(); load > 0.0) {
+    const auto n_affordable = static_cast<int>(
+        std::chrono::duration<double>(kHopTimeBudget) / kHopDuration *
+        n_hops / load);
+    n_pre_roll_budget =
+        std::clamp(n_affordable - n_active_hops, 0, kPreRollHops);
+  }
+  auto n_gated_hops = 0;
+  for (auto begin = 0; begin < n_hops;) {
+    const auto* const hop_input = input + begin * BEATRICE_IN_HOP_LENGTH;
+    if (!is_active[begin]) {
+      std::memset(output + begin * BEATRICE_OUT_HOP_LENGTH, 0,
+                  sizeof(float) * BEATRICE_OUT_HOP_LENGTH);
+      silence_gate_.Skip(hop_input);
+      ++n_gated_hops;
+      ++begin;
+      continue;
+    }
+    auto end = begin + 1;
+    while (end < n_hops && is_active[end]) {
+      ++end;
+    }
+    if (silence_gate_.IsGated()) {
+      // 止まっていた状態に直前の入力を流し込んでから再開する。出力は捨てる。
+      // 予算に収まらない分は古い方から諦める
+      alignas(64) std::array<float, BEATRICE_IN_HOP_LENGTH * kPreRollHops>
+          pre_roll_input;
+      alignas(64) std::array<float, BEATRICE_OUT_HOP_LENGTH * kPreRollHops>
+          pre_roll_output;
+      const auto n =
+          silence_gate_.Resume(pre_roll_input.data(), n_pre_roll_budget);
+      n_pre_roll_budget -= n;
+      if (n > 0) {
+        Infer(pre_roll_input.data(), pre_roll_output.data(), n, -1, true);
+      }
+    }
+    Infer(hop_input, output + begin * BEATRICE_OUT_HOP_LENGTH, end - begin,
+          is_recording ? first_seq + begin : -1);
+    begin = end;
+  }
+  if (n_gated_hops > 0) {
+    // 推論を省略した分の時間で後回しにした処理を進める
+    deferred_tasks_.Run(DeferredTaskScheduler<kNDeferredTasks>::Clock::now() +
+                        kHopTimeBudget * n_gated_hops);
+  }
+}
+
+// 追加の目標話者の n_hops フレームを生成する。
+// 対応するフレームの解析結果はメインの処理で記録済みのものを使う
+void ProcessorCore2::ProcessExtraBatch(const float* const input,
+                                       float* const output, const int n_hops,
+                                       const int index) {
+  auto& extra = *extra_targets_[index];
+  const auto speaker = extra_target_speakers_[index];
+  // モーフィング結果が届くまでは、メインと同様に重みを抽選確率として用いる
+  const auto is_codebook_lottery_enabled =
+      speaker == n_speakers_ && codebook_morpher_.Current() == nullptr;
+  if (!is_codebook_lottery_enabled) {
+    const auto* const codebook = GetCodebook(speaker, extra.widened_codebook);
+    // 単精度に戻した codebook は話者が変わっても同じ領域にある
+    if (extra.codebook != codebook || extra.codebook_speaker != speaker) {
+      Beatrice20rc0_SetCodebook(extra.phone_context, codebook);
+      extra.codebook = codebook;
+      extra.codebook_speaker = speaker;
+    }
+  }
+  alignas(64) std::array<float, BEATRICE_20RC0_PHONE_CHANNELS> phone;
+  for (auto i = 0; i < n_hops; ++i) {
+    const auto seq = extra.hop_count++;
+    const auto& analysis = analysis_ring_[seq % kAnalysisRingSize];
+    auto* const hop_output = output + i * BEATRICE_OUT_HOP_LENGTH;
+    if (!extra.is_ready || analysis.seq != seq) {
+      std::memset(hop_output, 0, sizeof(float) * BEATRICE_OUT_HOP_LENGTH);
+      continue;
+    }
+    // VQ を使わなければ音素は話者に依存しないので、メインのものを使う
+    const auto* phone_input = analysis.phone.data();
+    if (GetEffectiveVQNumNeighbors() > 0) {
+      if (is_codebook_lottery_enabled) {
+        const auto idx =
+            speaker_morphing_codebook_lottery_(extra.codebook_lottery_engine);
+        Beatrice20rc0_SetCodebook(extra.phone_context,
+                                  GetCodebook(idx, extra.widened_codebook));
+        // 結果が届いたら設定し直す
+        extra.codebook = nullptr;
+      }
+      Beatrice20rc0_ExtractPhone1(phone_extractor_,
+                                  input + i * BEATRICE_IN_HOP_LENGTH,
+                                  phone.data(), extra.phone_context);
+      phone_input = phone.data();
+    }
+    const auto quantized_pitch =
+        extra_target_pitch_mappings_[index](analysis.quantized_pitch);
+    Beatrice20rc0_GenerateWaveform1(
+        waveform_generator_, phone_input, &quantized_pitch,
+        analysis.pitch_feature.data(), hop_output, extra.waveform_context);
+  }
+}
+
+auto ProcessorCore2::HasExtraTargets() const -> bool {
+  return std::ranges::any_of(extra_targets_,
+                             [](const auto& extra) { return !!extra; });
+}
+
+auto ProcessorCore2::IsMorphedCodebookUsed() const -> bool {
   if (target_speaker_ == n_speakers_) {
-    // モーフィング処理
-    // codebookについては色々処理の候補があるのでマクロで分岐
-
-#if 0
-    if (speaker_morphing_state_counter_ < kSphAvgMaxNState) {
-      // spherical average を使う場合
-      // 数が多くて計算量が重いので、時分割処理を行う。
-      auto start_idx = BEATRICE_20RC0_KV_LENGTH *
-                       speaker_morphing_state_counter_ / kSphAvgMaxNState;
-      auto end_idx = BEATRICE_20RC0_KV_LENGTH *
-                     (speaker_morphing_state_counter_ + 1) / kSphAvgMaxNState;
-      for (size_t i = start_idx; i < end_idx; ++i) {
-        sph_avgs_c_[i].SetWeights(
-            n_speakers_, speaker_morphing_weights_pruned_.data(),
-            speaker_morphing_weights_argsort_indices_.data());
-        for (size_t j = 0; j < kSphAvgMaxNUpdates; ++j) {
-          if (sph_avgs_c_[i].Update()) break;
-        }
-        sph_avgs_c_[i].GetResult(
-            BEATRICE_20RC0_PHONE_CHANNELS,
-            codebooks_.data() +
-                (n_speakers_ * BEATRICE_20RC0_CODEBOOK_SIZE + i) *
-                    BEATRICE_20RC0_PHONE_CHANNELS);
+    return true;
+  }
+  for (auto i = 0; i < kMaxNExtraTargets; ++i) {
+    if (extra_targets_[i] && extra_target_speakers_[i] == n_speakers_) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// 複数フレームをまとめて推論する。
+// 各ネットワークの重みがキャッシュに載ったまま処理できるように、
+// 全フレームの音素抽出、全フレームのピッチ推定、全フレームの波形生成の順に行う。
+// 各ネットワークの状態はフレーム順に更新されるので、
+// 1 フレームずつ処理した場合と同じ結果になる
+void ProcessorCore2::Infer(const float* const input, float* const output,
+                           const int n_hops, const std::int64_t first_seq,
+                           const bool is_pre_roll) {
+  assert(0 < n_hops && n_hops <= resampler::kMaxNBatchBlocks);
+  const auto hop_start = DeferredTaskScheduler<kNDeferredTasks>::Clock::now();
+
+  // モーフィング処理。負荷が高い間は codebook のモーフィングを後回しにする
+  if (is_codebook_morphing_requested_ &&
+      governor_.GetTier() < QualityTier::kDeferMorphing) {
+    is_codebook_morphing_requested_ = !codebook_morpher_.Request(
+        n_speakers_, speaker_morphing_weights_pruned_.data(),
+        speaker_morphing_weights_argsort_indices_.data(),
+        is_morphing_approximate_);
+  }
+  // 追加の目標話者もモーフィング結果を使っていれば、結果を受け取っておく
+  auto is_codebook_lottery_enabled = false;
+  if (IsMorphedCodebookUsed()) {
+    const auto* const codebook = codebook_morpher_.Poll();
+    if (target_speaker_ == n_speakers_) {
+      if (codebook != nullptr) {
+        // spherical average の計算結果が届いたので差し替える
+        Beatrice20rc0_SetCodebook(phone_context_, codebook);
+      } else if (codebook_morpher_.Current() == nullptr) {
+        is_codebook_lottery_enabled = true;
       }
-    } else if (speaker_morphing_state_counter_ == kSphAvgMaxNState) {
-      Beatrice20rc0_SetCodebook(
-          phone_context_,
-          codebooks_.data() + n_speakers_ * (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                             BEATRICE_20RC0_PHONE_CHANNELS));
-    }
-#elif 0
-    if (speaker_morphing_state_counter_ == 0) {
-      // 最大重みを持つ話者の情報をそのまま採用する場合
-      // この場合 codebook のサイズは
-      // (n_speaker_+1)ではなくて(n_speaker_)で十分
-      Beatrice20rc0_SetCodebook(
-          phone_context_,
-          codebooks_.data() + speaker_morphing_weights_argsort_indices_[0] *
-                                  (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                   BEATRICE_20RC0_PHONE_CHANNELS));
-    }
-#else
-    // 重みを抽選確率として用いて毎フレームランダムな話者ののものを抽選で選ぶ場合
-    // この場合も codebook のサイズは (n_speaker_+1)ではなくて(n_speaker_)で十分
-    speaker_morphing_codebook_lottery_.param(
-        std::discrete_distribution<int>::param_type(
-            speaker_morphing_weights_pruned_.begin(),
-            speaker_morphing_weights_pruned_.end()));
-    auto idx = speaker_morphing_codebook_lottery_(
-        speaker_morphing_codebook_lottery_engine_);
-    Beatrice20rc0_SetCodebook(
-        phone_context_,
-        codebooks_.data() + idx * (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                   BEATRICE_20RC0_PHONE_CHANNELS));
-#endif
-
-    if (speaker_morphing_state_counter_ == 0) {
-      // additive_speaker_embeddings については
-      // 重みの更新があった次のフレームで一気に更新する
-      sph_avg_a_.SetWeights(n_speakers_,
-                            speaker_morphing_weights_pruned_.data(),
-                            speaker_morphing_weights_argsort_indices_.data());
+    }
+  }
+
+  alignas(64) std::array<float, BEATRICE_20RC0_PHONE_CHANNELS *
+                                    resampler::kMaxNBatchBlocks> phone;
+  std::array<int, resampler::kMaxNBatchBlocks> quantized_pitch;
+  std::array<float, 4 * resampler::kMaxNBatchBlocks> pitch_feature;
+  // 音素抽出とピッチ推定は互いに独立なので、
+  // 有効であればピッチ推定をワーカースレッドで並行して行う
+  pitch_job_ = {.input = input,
+                .n_hops = n_hops,
+                .quantized_pitch = quantized_pitch.data(),
+                .pitch_feature = pitch_feature.data()};
+  const auto is_parallel = is_parallel_pitch_estimation_enabled_.load(
+      std::memory_order_relaxed);
+  if (is_parallel) {
+    pitch_worker_->Dispatch(
+        [](void* const self) {
+          static_cast<ProcessorCore2*>(self)->EstimatePitch();
+        },
+        this);
+  }
+  for (auto i = 0; i < n_hops; ++i) {
+    if (is_codebook_lottery_enabled) {
+      // 計算結果が届くまでは、重みを抽選確率として用いて
+      // 毎フレームランダムな話者のものを抽選で選ぶ
+      const auto idx = speaker_morphing_codebook_lottery_(
+          speaker_morphing_codebook_lottery_engine_);
+      Beatrice20rc0_SetCodebook(phone_context_,
+                                GetCodebook(idx, widened_codebook_));
+    }
+    Beatrice20rc0_ExtractPhone1(
+        phone_extractor_, input + i * BEATRICE_IN_HOP_LENGTH,
+        phone.data() + i * BEATRICE_20RC0_PHONE_CHANNELS, phone_context_);
+  }
+  if (is_parallel) {
+    pitch_worker_->Wait();
+  } else {
+    EstimatePitch();
+  }
+  if (first_seq >= 0) {
+    for (auto i = 0; i < n_hops; ++i) {
+      auto& analysis = analysis_ring_[(first_seq + i) % kAnalysisRingSize];
+      analysis.seq = first_seq + i;
+      std::memcpy(analysis.phone.data(),
+                  phone.data() + i * BEATRICE_20RC0_PHONE_CHANNELS,
+                  sizeof(float) * BEATRICE_20RC0_PHONE_CHANNELS);
+      analysis.quantized_pitch = quantized_pitch[i];
+      std::memcpy(analysis.pitch_feature.data(), pitch_feature.data() + i * 4,
+                  sizeof(float) * 4);
+    }
+  }
+  for (auto i = 0; i < n_hops; ++i) {
+    // PitchShift, IntonationIntensity, PitchCorrection
+    const auto mapped_quantized_pitch = pitch_mapping_(quantized_pitch[i]);
+    Beatrice20rc0_GenerateWaveform1(
+        waveform_generator_, phone.data() + i * BEATRICE_20RC0_PHONE_CHANNELS,
+        &mapped_quantized_pitch, pitch_feature.data() + i * 4,
+        output + i * BEATRICE_OUT_HOP_LENGTH, waveform_context_);
+  }
+
+  // 推論のみにかかった時間で負荷を測る
+  if (governor_.Update(
+          DeferredTaskScheduler<kNDeferredTasks>::Clock::now() - hop_start,
+          n_hops)) {
+    ApplyQualityTier();
+  }
+
+  // 残り時間で後回しにした処理を進める。
+  // 流し込みの分はもともと予算に含まれていないので進めない
+  if (!is_pre_roll) {
+    deferred_tasks_.Run(hop_start + kHopTimeBudget * n_hops);
+  }
+}
+
+// pitch_job_ の全フレームについてピッチを推定する。
+// 追加の目標話者と共有するため、ピッチシフトなどは適用しない。
+// ワーカースレッドから呼ばれる場合があるので、
+// pitch_job_ 以外ではピッチ推定用のメンバのみを触ること
+void ProcessorCore2::EstimatePitch() {
+  for (auto i = 0; i < pitch_job_.n_hops; ++i) {
+    Beatrice20rc0_EstimatePitch1(
+        pitch_estimator_, pitch_job_.input + i * BEATRICE_IN_HOP_LENGTH,
+        &pitch_job_.quantized_pitch[i], pitch_job_.pitch_feature + i * 4,
+        pitch_context_);
+  }
+}
+
+void ProcessorCore2::CalibratePitch(const float* const input,
+                                    const int n_hops) {
+  for (auto i = 0; i < n_hops; ++i) {
+    int quantized_pitch;
+    std::array<float, 4> pitch_feature;
+    Beatrice20rc0_EstimatePitch1(
+        pitch_estimator_, input + i * BEATRICE_IN_HOP_LENGTH, &quantized_pitch,
+        pitch_feature.data(), calibration_pitch_context_);
+    pitch_calibrator_.Add(quantized_pitch);
+  }
+}
+
+void ProcessorCore2::InitializeDeferredTasks() {
+  deferred_tasks_.SetTask(kRegisterKeyValue, [this] {
+    Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
+        embedding_setter_, GetKeyValueSpeakerEmbedding(target_speaker_),
+        embedding_context_);
+    embedding_context_speaker_ = target_speaker_;
+    key_value_speaker_embedding_set_count_ = 0;
+    deferred_tasks_.Schedule(kSetKeyValue);
+    deferred_tasks_.Schedule(kPrepareSpareContexts);
+    return false;
+  });
+  deferred_tasks_.SetTask(kSetKeyValue, [this] {
+    // 1 ブロックずつ設定する
+    SetKeyValueSpeakerEmbedding();
+    return key_value_speaker_embedding_set_count_ < BEATRICE_20RC0_N_BLOCKS;
+  });
+  deferred_tasks_.SetTask(kSetFormantShift, [this] {
+    SetFormantShiftEmbedding();
+    return false;
+  });
+  deferred_tasks_.SetTask(kMorphAdditive, [this] {
+    // additive_speaker_embeddings については一度に計算する
+    sph_avg_a_.SetWeights(n_speakers_,
+                          speaker_morphing_weights_pruned_.data(),
+                          speaker_morphing_weights_argsort_indices_.data());
+    // 負荷が高い間は設定に関わらず線形ブレンドで近似する
+    const auto morphing_quality =
+        governor_.GetTier() >= QualityTier::kApproximateMorphing
+            ? MorphingQuality::kFast
+            : morphing_quality_;
+    if (morphing_quality != MorphingQuality::kFast) {
       for (size_t j = 0; j < kSphAvgMaxNUpdates; ++j) {
         if (sph_avg_a_.Update()) break;
       }
-      sph_avg_a_.GetResult(
-          BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-          additive_speaker_embeddings_.data() +
-              n_speakers_ * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+    }
+    // kAuto の場合、additive_speaker_embeddings で測った線形ブレンドの
+    // 角度誤差が十分小さければ、他の埋め込みも線形ブレンドで済ませる
+    switch (morphing_quality) {
+      case MorphingQuality::kExact:
+        is_morphing_approximate_ = false;
+        break;
+      case MorphingQuality::kFast:
+        is_morphing_approximate_ = true;
+        break;
+      case MorphingQuality::kAuto:
+        is_morphing_approximate_ = sph_avg_a_.GetApproximationAngle() <=
+                                   kMorphingMaxApproximationAngle;
+        break;
+    }
+    sph_avg_a_.GetResult(BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+                         morphed_additive_speaker_embedding_.data());
+    if (target_speaker_ == n_speakers_) {
       Beatrice20rc0_SetAdditiveSpeakerEmbedding(
-          embedding_setter_,
-          additive_speaker_embeddings_.data() +
-              n_speakers_ * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+          embedding_setter_, morphed_additive_speaker_embedding_.data(),
           embedding_context_, waveform_context_);
     }
-
-    if (speaker_morphing_state_counter_ < kSphAvgMaxNState) {
-      // key_value_speaker_embeddings_ の spherical average については
-      // 重めの処理なので数フレームに分けて計算する
-      auto start_idx = BEATRICE_20RC0_KV_LENGTH *
-                       speaker_morphing_state_counter_ / kSphAvgMaxNState;
-      auto end_idx = BEATRICE_20RC0_KV_LENGTH *
-                     (speaker_morphing_state_counter_ + 1) / kSphAvgMaxNState;
-      for (size_t i = start_idx; i < end_idx; ++i) {
-        sph_avgs_k_[i].SetWeights(
-            n_speakers_, speaker_morphing_weights_pruned_.data(),
-            speaker_morphing_weights_argsort_indices_.data());
-        for (size_t j = 0; j < kSphAvgMaxNUpdates; ++j) {
-          if (sph_avgs_k_[i].Update()) break;
+    InvalidateExtraTargets(n_speakers_, false);
+    is_codebook_morphing_requested_ = true;
+    speaker_morphing_key_value_row_ = 0;
+    deferred_tasks_.Schedule(kMorphKeyValue);
+    return false;
+  });
+  deferred_tasks_.SetTask(kMorphKeyValue, [this] {
+    // key-value speaker embedding の spherical average については
+    // 数行ずつ計算する
+    const auto end_row = std::min(
+        speaker_morphing_key_value_row_ + kSphAvgKeyValueRowsPerStep,
+        BEATRICE_20RC0_KV_LENGTH);
+    for (auto i = speaker_morphing_key_value_row_; i < end_row; ++i) {
+      sph_avgs_k_[i].SetWeights(
+          n_speakers_, speaker_morphing_weights_pruned_.data(),
+          speaker_morphing_weights_argsort_indices_.data());
+      for (size_t j = 0; j < kSphAvgMaxNUpdates && !is_morphing_approximate_;
+           ++j) {
+        if (sph_avgs_k_[i].Update()) break;
+      }
+      sph_avgs_k_[i].GetResult(
+          BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
+          morphed_key_value_speaker_embedding_.data() +
+              i * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
+    }
+    speaker_morphing_key_value_row_ = end_row;
+    if (end_row < BEATRICE_20RC0_KV_LENGTH) {
+      return true;
+    }
+    // 古いモーフィング結果を登録したものは使えなくなる
+    InvalidateVoiceCache(n_speakers_);
+    InvalidateExtraTargets(n_speakers_, true);
+    if (target_speaker_ == n_speakers_) {
+      deferred_tasks_.Schedule(kRegisterKeyValue);
+    }
+    return false;
+  });
+  deferred_tasks_.SetTask(kPrepareSpareContexts, [this] {
+    // ResetContext() で差し替えられるよう、使用済みの状態を作り直し、
+    // 現在の話者の key-value speaker embedding を 1 ブロックずつ設定しておく
+    auto& spare = spare_contexts_;
+    if (!spare.is_fresh) {
+      RecreateSpareContexts();
+      return true;
+    }
+    if (embedding_context_speaker_ < 0 ||
+        embedding_context_speaker_ != target_speaker_) {
+      // 登録が済んだら kRegisterKeyValue から再度予約される
+      return false;
+    }
+    if (spare.key_value_speaker != embedding_context_speaker_) {
+      spare.key_value_speaker = embedding_context_speaker_;
+      spare.key_value_set_count = 0;
+    }
+    if (spare.key_value_set_count < BEATRICE_20RC0_N_BLOCKS) {
+      Beatrice20rc0_SetKeyValueSpeakerEmbedding(
+          embedding_setter_, spare.key_value_set_count++, embedding_context_,
+          spare.waveform);
+    }
+    return spare.key_value_set_count < BEATRICE_20RC0_N_BLOCKS;
+  });
+  deferred_tasks_.SetTask(kPrepareExtraTargets, [this] {
+    // 追加の目標話者の embedding を、登録、additive と formant shift、
+    // key-value の各ブロックの順に 1 単位ずつ設定する
+    for (auto i = 0; i < kMaxNExtraTargets; ++i) {
+      auto* const extra = extra_targets_[i].get();
+      if (extra == nullptr) {
+        continue;
+      }
+      const auto speaker = extra_target_speakers_[i];
+      if (extra->embedding_speaker != speaker) {
+        Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
+            embedding_setter_, GetKeyValueSpeakerEmbedding(speaker),
+            extra->embedding_context);
+        extra->embedding_speaker = speaker;
+        extra->key_value_set_count = 0;
+        return true;
+      }
+      if (!extra->is_embedding_set) {
+        const auto formant_index = static_cast<int>(
+            std::round(extra_target_formant_shifts_[i] * 2.0 + 4.0));
+        assert(0 <= formant_index && formant_index < 9);
+        Beatrice20rc0_SetAdditiveSpeakerEmbedding(
+            embedding_setter_, GetAdditiveSpeakerEmbedding(speaker),
+            extra->embedding_context, extra->waveform_context);
+        Beatrice20rc0_SetFormantShiftEmbedding(
+            embedding_setter_, GetFormantShiftEmbedding(formant_index),
+            extra->embedding_context, extra->waveform_context);
+        extra->is_embedding_set = true;
+        return true;
+      }
+      if (extra->key_value_set_count < BEATRICE_20RC0_N_BLOCKS) {
+        Beatrice20rc0_SetKeyValueSpeakerEmbedding(
+            embedding_setter_, extra->key_value_set_count++,
+            extra->embedding_context, extra->waveform_context);
+        if (extra->key_value_set_count == BEATRICE_20RC0_N_BLOCKS) {
+          extra->is_ready = true;
         }
-        sph_avgs_k_[i].GetResult(
-            BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-            key_value_speaker_embeddings_.data() +
-                (n_speakers_ * BEATRICE_20RC0_KV_LENGTH + i) *
-                    BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
+        return true;
       }
-    } else if (speaker_morphing_state_counter_ == kSphAvgMaxNState) {
-      Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
-          embedding_setter_,
-          key_value_speaker_embeddings_.data() +
-              n_speakers_ * (BEATRICE_20RC0_KV_LENGTH *
-                             BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS),
-          embedding_context_);
-      key_value_speaker_embedding_set_count_ = 0;
     }
+    return false;
+  });
+}
 
-    if (speaker_morphing_state_counter_ <= kSphAvgMaxNState) {
-      ++speaker_morphing_state_counter_;
+void ProcessorCore2::ApplyQualityTier() {
+  const auto tier = governor_.GetTier();
+  const auto vq_num_neighbors = GetEffectiveVQNumNeighbors();
+  Beatrice20rc0_SetVQNumNeighbors(phone_context_, vq_num_neighbors);
+  for (auto&& extra : extra_targets_) {
+    if (extra) {
+      Beatrice20rc0_SetVQNumNeighbors(extra->phone_context, vq_num_neighbors);
     }
   }
+  // モーフィングの更新は予約したまま止めておき、負荷が下がったら再開する
+  const auto is_morphing_deferred = tier >= QualityTier::kDeferMorphing;
+  deferred_tasks_.SetSuspended(kMorphAdditive, is_morphing_deferred);
+  deferred_tasks_.SetSuspended(kMorphKeyValue, is_morphing_deferred);
+}
 
-  // Beatrice20rc0_SetKeyValueSpeakerEmbedding は重めの処理なので
-  // 4 フレームかけて処理する
-  SetKeyValueSpeakerEmbedding();
+auto ProcessorCore2::GetEffectiveVQNumNeighbors() const -> int {
+  return governor_.GetTier() >= QualityTier::kNoVQ ? 0 : vq_num_neighbors_;
+}
 
-  std::array<float, BEATRICE_20RC0_PHONE_CHANNELS> phone;
-  Beatrice20rc0_ExtractPhone1(phone_extractor_, input, phone.data(),
-                              phone_context_);
-  int quantized_pitch;
-  std::array<float, 4> pitch_feature;
-  Beatrice20rc0_EstimatePitch1(pitch_estimator_, input, &quantized_pitch,
-                               pitch_feature.data(), pitch_context_);
-  constexpr auto kPitchBinsPerSemitone =
-      static_cast<double>(BEATRICE_PITCH_BINS_PER_OCTAVE) / 12.0;
-  // PitchShift, IntonationIntensity
-  auto tmp_quantized_pitch =
-      average_source_pitch_ +
-      (static_cast<double>(quantized_pitch) - average_source_pitch_) *
-          intonation_intensity_ +
-      kPitchBinsPerSemitone * pitch_shift_;
-  // PitchCorrection
-  if (pitch_correction_ != 0.0) {
-    const auto before_pitch_correction = tmp_quantized_pitch;
-    if (pitch_correction_type_ == 0) {
-      // x|x|^{-p}
-      const auto nearest_pitch =
-          (std::floor(tmp_quantized_pitch / kPitchBinsPerSemitone) + 0.5) *
-          kPitchBinsPerSemitone;
-      const auto normalized_delta =
-          (tmp_quantized_pitch - nearest_pitch) * (2.0 / kPitchBinsPerSemitone);
-      if (std::abs(normalized_delta) < 1e-4) {
-        tmp_quantized_pitch = nearest_pitch;
-      } else {
-        tmp_quantized_pitch =
-            nearest_pitch +
-            normalized_delta *
-                std::pow(std::abs(normalized_delta), -pitch_correction_) *
-                (kPitchBinsPerSemitone / 2.0);
-      }
-      assert(std::abs(tmp_quantized_pitch -
-                      std::round(tmp_quantized_pitch / kPitchBinsPerSemitone) *
-                          kPitchBinsPerSemitone) <=
-             std::abs(before_pitch_correction -
-                      std::round(tmp_quantized_pitch / kPitchBinsPerSemitone) *
-                          kPitchBinsPerSemitone) +
-                 1e-4);
-    } else if (pitch_correction_type_ == 1) {
-      // sgn(x)|x|^{1/(1-p)}
-      const auto nearest_pitch =
-          std::round(tmp_quantized_pitch / kPitchBinsPerSemitone) *
-          kPitchBinsPerSemitone;
-      const auto normalized_delta =
-          (tmp_quantized_pitch - nearest_pitch) * (2.0 / kPitchBinsPerSemitone);
-      if (pitch_correction_ > 1 - 1e-4) {
-        tmp_quantized_pitch = nearest_pitch;
-      } else if (normalized_delta >= 0.0) {
-        tmp_quantized_pitch =
-            nearest_pitch +
-            std::pow(normalized_delta, 1.0 / (1.0 - pitch_correction_)) *
-                (kPitchBinsPerSemitone / 2.0);
-      } else {
-        tmp_quantized_pitch =
-            nearest_pitch -
-            std::pow(-normalized_delta, 1.0 / (1.0 - pitch_correction_)) *
-                (kPitchBinsPerSemitone / 2.0);
-      }
-      assert(std::abs(tmp_quantized_pitch - nearest_pitch) <=
-             std::abs(before_pitch_correction - nearest_pitch) + 1e-4);
-    } else {
-      assert(false);
-    }
+auto ProcessorCore2::AcquireEmbeddingContext(const int new_speaker) -> bool {
+  if (embedding_context_speaker_ == new_speaker) {
+    return true;
+  }
+  // 現在の EmbeddingContext は登録済みの話者と共にとっておく
+  const auto is_hit = voice_cache_.Exchange(
+      embedding_context_, embedding_context_speaker_, new_speaker);
+  embedding_context_speaker_ = is_hit ? new_speaker : -1;
+  return is_hit;
+}
+
+void ProcessorCore2::InvalidateVoiceCache(const int speaker) {
+  voice_cache_.Invalidate(speaker);
+  if (speaker < 0 || embedding_context_speaker_ == speaker) {
+    embedding_context_speaker_ = -1;
+  }
+  if (speaker < 0 || spare_contexts_.key_value_speaker == speaker) {
+    spare_contexts_.key_value_speaker = -1;
+    spare_contexts_.key_value_set_count = 0;
   }
-  quantized_pitch =
-      std::clamp(static_cast<int>(std::round(tmp_quantized_pitch)), 1,
-                 BEATRICE_20RC0_PITCH_BINS - 1);
-  Beatrice20rc0_GenerateWaveform1(waveform_generator_, phone.data(),
-                                  &quantized_pitch, pitch_feature.data(),
-                                  output, waveform_context_);
 }
 
 auto ProcessorCore2::ResetContext() -> ErrorCode {
-  Beatrice20rc0_DestroyPhoneContext1(phone_context_);
-  Beatrice20rc0_DestroyPitchContext1(pitch_context_);
-  Beatrice20rc0_DestroyWaveformContext1(waveform_context_);
-  Beatrice20rc0_DestroyEmbeddingContext(embedding_context_);
-  phone_context_ = Beatrice20rc0_CreatePhoneContext1();
-  pitch_context_ = Beatrice20rc0_CreatePitchContext1();
-  waveform_context_ = Beatrice20rc0_CreateWaveformContext1();
-  embedding_context_ = Beatrice20rc0_CreateEmbeddingContext();
+  // 推論中のワーカーを止めてから状態を差し替える
+  StopPipeline();
+  // 未使用の状態と差し替えるだけにし、使用済みのものは
+  // 後回しにした処理で作り直す。作り直しが間に合っていなければここで行う
+  auto& spare = spare_contexts_;
+  if (!spare.is_fresh) {
+    RecreateSpareContexts();
+  }
+  const auto is_spare_key_value_ready =
+      spare.key_value_speaker == target_speaker_ &&
+      spare.key_value_speaker == embedding_context_speaker_ &&
+      spare.key_value_set_count == BEATRICE_20RC0_N_BLOCKS;
+  std::swap(phone_context_, spare.phone);
+  std::swap(pitch_context_, spare.pitch);
+  std::swap(waveform_context_, spare.waveform);
+  spare.is_fresh = false;
+  spare.key_value_speaker = -1;
+  spare.key_value_set_count = 0;
+  // EmbeddingContext は入力の履歴を持たないので、登録済みの話者ごと使い続ける
+  speaker_morphing_codebook_lottery_engine_.seed(random_seed_);
+  silence_gate_.Reset();
 
   // 目標話者を再設定
   auto error = SetTargetSpeaker(target_speaker_);
-  while (SetKeyValueSpeakerEmbedding());
+  if (error == ErrorCode::kSuccess && is_spare_key_value_ready) {
+    // key-value speaker embedding は差し替えた状態に設定済み
+    deferred_tasks_.Cancel(kSetKeyValue);
+    key_value_speaker_embedding_set_count_ = BEATRICE_20RC0_N_BLOCKS;
+  }
 
   // 各種パラメータを再設定
   if (const auto err = SetFormantShift(formant_shift_);
@@ -262,124 +657,622 @@ auto ProcessorCore2::ResetContext() -> ErrorCode {
       error == ErrorCode::kSuccess) {
     error = err;
   }
+  // 追加の目標話者の状態も作り直す。登録済みの話者はそのまま使う
+  for (auto&& extra : extra_targets_) {
+    if (extra) {
+      ResetExtraTargetContexts(*extra);
+      deferred_tasks_.Schedule(kPrepareExtraTargets);
+    }
+  }
+  if (is_ready_to_set_speaker_) {
+    // 軽いフォルマントシフトの設定だけはここで済ませ、
+    // key-value speaker embedding の設定などは処理の合間に行う
+    SetFormantShiftEmbedding();
+    deferred_tasks_.Cancel(kSetFormantShift);
+    deferred_tasks_.Schedule(kPrepareSpareContexts);
+  }
+  RestartPipeline();
 
   return error;
 }
 
-auto ProcessorCore2::LoadModel(const ModelConfig& /*config*/,
-                               const std::filesystem::path& new_model_file)
-    -> ErrorCode {
-  // IsLoaded() が false を返すようにする
-  model_file_.clear();
-  is_ready_to_set_speaker_ = false;
+void ProcessorCore2::RecreateSpareContexts() {
+  auto& spare = spare_contexts_;
+  if (spare.phone != nullptr) {
+    Beatrice20rc0_DestroyPhoneContext1(spare.phone);
+    Beatrice20rc0_DestroyPitchContext1(spare.pitch);
+    Beatrice20rc0_DestroyWaveformContext1(spare.waveform);
+  }
+  spare.phone = Beatrice20rc0_CreatePhoneContext1();
+  spare.pitch = Beatrice20rc0_CreatePitchContext1();
+  spare.waveform = Beatrice20rc0_CreateWaveformContext1();
+  spare.is_fresh = true;
+  spare.key_value_speaker = -1;
+  spare.key_value_set_count = 0;
+}
 
-  // 各種パラメータを読み込む
-  const auto d = new_model_file.parent_path();
-  if (const auto err = Beatrice20rc0_ReadPhoneExtractorParameters(
-          phone_extractor_,
-          reinterpret_cast<const char*>(
-              (d / "phone_extractor.bin").u8string().c_str()))) {
-    return static_cast<ErrorCode>(err);
+void ProcessorCore2::SetFormantShiftEmbedding() {
+  const auto index = static_cast<int>(std::round(formant_shift_ * 2.0 + 4.0));
+  Beatrice20rc0_SetFormantShiftEmbedding(embedding_setter_,
+                                         GetFormantShiftEmbedding(index),
+                                         embedding_context_, waveform_context_);
+}
+
+auto ProcessorCore2::UpdateExtraTarget(const int index) -> ErrorCode {
+  auto& extra = extra_targets_[index];
+  const auto speaker = extra_target_speakers_[index];
+  if (speaker < 0 || !is_ready_to_set_speaker_ || n_speakers_ < speaker) {
+    extra.reset();
+    return speaker < 0 || !is_ready_to_set_speaker_
+               ? ErrorCode::kSuccess
+               : ErrorCode::kSpeakerIDOutOfRange;
   }
-  if (const auto err = Beatrice20rc0_ReadPitchEstimatorParameters(
-          pitch_estimator_,
-          reinterpret_cast<const char*>(
-              (d / "pitch_estimator.bin").u8string().c_str()))) {
-    return static_cast<ErrorCode>(err);
+  if (!extra) {
+    extra = std::make_unique<ExtraTarget>(
+        any_freq_in_out_, output_gain_context_, hop_count_, random_seed_);
+    Beatrice20rc0_SetVQNumNeighbors(extra->phone_context,
+                                    GetEffectiveVQNumNeighbors());
+    if (model_->IsHalfPrecision()) {
+      extra->widened_codebook.data.resize(BEATRICE_20RC0_CODEBOOK_SIZE *
+                                          BEATRICE_20RC0_PHONE_CHANNELS);
+    }
   }
-  if (const auto err = Beatrice20rc0_ReadWaveformGeneratorParameters(
-          waveform_generator_,
-          reinterpret_cast<const char*>(
-              (d / "waveform_generator.bin").u8string().c_str()))) {
-    return static_cast<ErrorCode>(err);
+  if (extra->embedding_speaker != speaker) {
+    PrefetchSpeaker(speaker);
+    extra->embedding_speaker = -1;
+    extra->is_embedding_set = false;
+    extra->key_value_set_count = 0;
   }
-  if (const auto err = Beatrice20rc0_ReadEmbeddingSetterParameters(
-          embedding_setter_,
-          reinterpret_cast<const char*>(
-              (d / "embedding_setter.bin").u8string().c_str()))) {
-    return static_cast<ErrorCode>(err);
+  deferred_tasks_.Schedule(kPrepareExtraTargets);
+  return ErrorCode::kSuccess;
+}
+
+void ProcessorCore2::ResetExtraTargetContexts(ExtraTarget& extra) const {
+  Beatrice20rc0_DestroyPhoneContext1(extra.phone_context);
+  Beatrice20rc0_DestroyWaveformContext1(extra.waveform_context);
+  extra.phone_context = Beatrice20rc0_CreatePhoneContext1();
+  extra.waveform_context = Beatrice20rc0_CreateWaveformContext1();
+  Beatrice20rc0_SetVQNumNeighbors(extra.phone_context,
+                                  GetEffectiveVQNumNeighbors());
+  extra.codebook = nullptr;
+  extra.codebook_speaker = -1;
+  extra.codebook_lottery_engine.seed(random_seed_);
+  extra.is_embedding_set = false;
+  extra.key_value_set_count = 0;
+  extra.is_ready = false;
+}
+
+void ProcessorCore2::InvalidateExtraTargets(const int speaker,
+                                            const bool is_key_value_changed) {
+  for (auto i = 0; i < kMaxNExtraTargets; ++i) {
+    auto* const extra = extra_targets_[i].get();
+    if (extra == nullptr || extra_target_speakers_[i] != speaker) {
+      continue;
+    }
+    if (is_key_value_changed) {
+      extra->embedding_speaker = -1;
+    }
+    extra->is_embedding_set = false;
+    extra->key_value_set_count = 0;
+    deferred_tasks_.Schedule(kPrepareExtraTargets);
+  }
+}
+
+auto ProcessorCore2::GetCodebook(const int speaker,
+                                 WidenedCodebook& widened) const
+    -> const float* {
+  constexpr auto kCodebookElements =
+      BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS;
+  assert(0 <= speaker && speaker <= n_speakers_);
+  if (speaker == n_speakers_) {
+    // 結果が届くまでは、最も重みの大きい話者のもので代用する
+    if (const auto* const morphed = codebook_morpher_.Current()) {
+      return morphed;
+    }
+    return GetCodebook(speaker_morphing_weights_argsort_indices_[0], widened);
+  }
+  if (!model_->IsHalfPrecision()) {
+    return model_->GetCodebooks() + speaker * kCodebookElements;
+  }
+  // 同じ話者を戻し済みであればそのまま使う
+  if (widened.speaker != speaker) {
+    assert(widened.data.size() == kCodebookElements);
+    ConvertToFloat(model_->GetHalfCodebooks() + speaker * kCodebookElements,
+                   widened.data.data(), kCodebookElements);
+    widened.speaker = speaker;
+  }
+  return widened.data.data();
+}
+
+auto ProcessorCore2::GetAdditiveSpeakerEmbedding(const int speaker) const
+    -> const float* {
+  assert(0 <= speaker && speaker <= n_speakers_);
+  if (speaker == n_speakers_) {
+    return morphed_additive_speaker_embedding_.data();
+  }
+  return model_->GetAdditiveSpeakerEmbeddings() +
+         speaker * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS;
+}
+
+auto ProcessorCore2::GetKeyValueSpeakerEmbedding(const int speaker)
+    -> const float* {
+  constexpr auto kKeyValueElements =
+      BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+  assert(0 <= speaker && speaker <= n_speakers_);
+  if (speaker == n_speakers_) {
+    return morphed_key_value_speaker_embedding_.data();
+  }
+  if (!model_->IsHalfPrecision()) {
+    return model_->GetKeyValueSpeakerEmbeddings() +
+           speaker * kKeyValueElements;
+  }
+  assert(widened_key_value_speaker_embedding_.size() == kKeyValueElements);
+  ConvertToFloat(
+      model_->GetHalfKeyValueSpeakerEmbeddings() + speaker * kKeyValueElements,
+      widened_key_value_speaker_embedding_.data(), kKeyValueElements);
+  return widened_key_value_speaker_embedding_.data();
+}
+
+auto ProcessorCore2::GetFormantShiftEmbedding(const int formant_index) const
+    -> const float* {
+  assert(0 <= formant_index && formant_index < 9);
+  return model_->GetFormantShiftEmbeddings() +
+         formant_index * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS;
+}
+
+template <typename F>
+void ProcessorCore2::ForEachSpeakerMemory(const int speaker, F&& fn) const {
+  assert(0 <= speaker && speaker <= n_speakers_);
+  if (speaker < n_speakers_) {
+    model_->ForEachSpeakerMemory(speaker, fn);
+    return;
+  }
+  for (const auto* const v :
+       {&morphed_additive_speaker_embedding_,
+        &morphed_key_value_speaker_embedding_}) {
+    fn(v->data(), sizeof(float) * v->size());
+  }
+}
+
+void ProcessorCore2::PrefetchSpeaker(const int speaker) const {
+  // メモリマップされていなければ、全話者分が既に読み込まれている
+  if (speaker < 0 || n_speakers_ <= speaker || !model_->IsEmbeddingMapped()) {
+    return;
+  }
+  ForEachSpeakerMemory(speaker, PrefetchMemory);
+}
+
+void ProcessorCore2::UpdateModelMemoryLock() {
+  UnlockModelMemory();
+  if (!is_model_memory_lock_enabled_ || !model_) {
+    return;
+  }
+  model_->AcquireMemoryLock();
+  is_model_memory_locked_ = true;
+  // 固定できなくても、ページアウトされうるだけなので無視する
+  for (const auto* const v :
+       {&morphed_additive_speaker_embedding_,
+        &morphed_key_value_speaker_embedding_, &widened_codebook_.data,
+        &widened_key_value_speaker_embedding_}) {
+    if (v->empty()) {
+      continue;
+    }
+    static_cast<void>(
+        model_memory_lock_.Lock(v->data(), sizeof(float) * v->size()));
+  }
+}
+
+void ProcessorCore2::UnlockModelMemory() {
+  model_memory_lock_.UnlockAll();
+  if (is_model_memory_locked_) {
+    model_->ReleaseMemoryLock();
+    is_model_memory_locked_ = false;
   }
+}
+
+auto ProcessorCore2Model::GetFiles(const std::filesystem::path& directory)
+    -> std::vector<std::filesystem::path> {
+  return {directory / "phone_extractor.bin", directory / "pitch_estimator.bin",
+          directory / "waveform_generator.bin",
+          directory / "embedding_setter.bin",
+          directory / "speaker_embeddings.bin"};
+}
+
+auto ProcessorCore2Model::Load(const std::filesystem::path& d,
+                               const bool half_precision) -> ErrorCode {
+  const auto file = [&d](const char* const name) {
+    return (d / name).u8string();
+  };
+  const auto phone_extractor_file = file("phone_extractor.bin");
+  const auto pitch_estimator_file = file("pitch_estimator.bin");
+  const auto waveform_generator_file = file("waveform_generator.bin");
+  const auto embedding_setter_file = file("embedding_setter.bin");
+  const auto c_str = [](const std::u8string& s) {
+    return reinterpret_cast<const char*>(s.c_str());
+  };
+  // 各種パラメータと話者埋め込みは互いに依存しないので、並行して読み込む。
+  // 読み込み先はそれぞれ別のオブジェクトである
+  return RunParallelTasks(5, [&](const std::size_t i) {
+    switch (i) {
+      case 0:
+        return static_cast<ErrorCode>(
+            Beatrice20rc0_ReadPhoneExtractorParameters(
+                phone_extractor_, c_str(phone_extractor_file)));
+      case 1:
+        return static_cast<ErrorCode>(
+            Beatrice20rc0_ReadPitchEstimatorParameters(
+                pitch_estimator_, c_str(pitch_estimator_file)));
+      case 2:
+        return static_cast<ErrorCode>(
+            Beatrice20rc0_ReadWaveformGeneratorParameters(
+                waveform_generator_, c_str(waveform_generator_file)));
+      case 3:
+        return static_cast<ErrorCode>(
+            Beatrice20rc0_ReadEmbeddingSetterParameters(
+                embedding_setter_, c_str(embedding_setter_file)));
+      default:
+        return LoadEmbeddings(d, half_precision);
+    }
+  });
+}
 
-  // 話者埋め込みを読み込む
+auto ProcessorCore2Model::LoadEmbeddings(const std::filesystem::path& d,
+                                         const bool half_precision)
+    -> ErrorCode {
+  // キャッシュファイルがあれば、そちらをマップする。
+  // 半精度に変換できないモデルは単精度のものを使う
+  const auto source = d / "speaker_embeddings.bin";
+  if (MapEmbeddingCache(source, half_precision, false) ||
+      (half_precision && MapEmbeddingCache(source, false, true))) {
+    return ErrorCode::kSuccess;
+  }
   if (const auto err = Beatrice20rc0_ReadNSpeakers(
-          reinterpret_cast<const char*>(
-              (d / "speaker_embeddings.bin").u8string().c_str()),
+          reinterpret_cast<const char*>(source.u8string().c_str()),
           &n_speakers_)) {
     return static_cast<ErrorCode>(err);
   }
-  // ここで (n_speakers_ + 1) なのは、末尾にモーフィング結果を格納するため
-  codebooks_.resize((n_speakers_ + 1) * (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                         BEATRICE_20RC0_PHONE_CHANNELS));
-  additive_speaker_embeddings_.resize(
-      (n_speakers_ + 1) * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
-  formant_shift_embeddings_.resize(9 *
-                                   BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
-  key_value_speaker_embeddings_.resize(
-      (n_speakers_ + 1) * (BEATRICE_20RC0_KV_LENGTH *
-                           BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS));
+  // 一旦単精度で読み込む
+  is_half_precision_ = false;
+  const auto layout = EmbeddingLayout(n_speakers_, false);
+  embedding_storage_.assign(layout.size, std::byte{0});
+  const auto at = [base = embedding_storage_.data()](const std::size_t offset) {
+    return reinterpret_cast<float*>(base + offset);
+  };
   if (const auto err = Beatrice20rc0_ReadSpeakerEmbeddings(
-          reinterpret_cast<const char*>(
-              (d / "speaker_embeddings.bin").u8string().c_str()),
-          codebooks_.data(), additive_speaker_embeddings_.data(),
-          formant_shift_embeddings_.data(),
-          key_value_speaker_embeddings_.data())) {
+          reinterpret_cast<const char*>(source.u8string().c_str()),
+          at(layout.codebooks), at(layout.additive), at(layout.formant_shift),
+          at(layout.key_value))) {
     return static_cast<ErrorCode>(err);
   }
+  // 変換できなければ単精度のまま使う
+  const auto is_incompressible = half_precision && !CompressEmbeddings();
+  SetEmbeddingPointers(embedding_storage_.data());
+  // 書き出せたらマップし直し、読み込んだ分は手放す。
+  // 書き出せなくても、読み込んだものをそのまま使えばよい
+  if (WriteEmbeddingCache(source, is_incompressible) &&
+      MapEmbeddingCache(source, is_half_precision_, is_incompressible)) {
+    embedding_storage_ = AlignedVector<std::byte, 64>();
+  }
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2Model::CompressEmbeddings() -> bool {
+  constexpr auto kCodebookElements =
+      BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS;
+  constexpr auto kKeyValueElements =
+      BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+  const auto n = static_cast<std::size_t>(n_speakers_);
+  const auto src_layout = EmbeddingLayout(n_speakers_, false);
+  const auto* const src = embedding_storage_.data();
+  const auto* const codebooks =
+      reinterpret_cast<const float*>(src + src_layout.codebooks);
+  const auto* const key_value =
+      reinterpret_cast<const float*>(src + src_layout.key_value);
+  // 半精度にすると無限大になってしまう値や NaN があれば変換しない
+  const auto fits = [](const float* const data, const std::size_t size) {
+    return std::all_of(data, data + size, [](const float x) {
+      return std::abs(x) <= kFloat16Max;
+    });
+  };
+  if (!fits(codebooks, n * kCodebookElements) ||
+      !fits(key_value, n * kKeyValueElements)) {
+    return false;
+  }
+  const auto dst_layout = EmbeddingLayout(n_speakers_, true);
+  auto storage = AlignedVector<std::byte, 64>(dst_layout.size, std::byte{0});
+  auto* const dst = storage.data();
+  ConvertToFloat16(codebooks,
+                   reinterpret_cast<Float16*>(dst + dst_layout.codebooks),
+                   n * kCodebookElements);
+  // additive と formant shift は小さいので単精度のままにする
+  std::memcpy(dst + dst_layout.additive, src + src_layout.additive,
+              dst_layout.key_value - dst_layout.additive);
+  ConvertToFloat16(key_value,
+                   reinterpret_cast<Float16*>(dst + dst_layout.key_value),
+                   n * kKeyValueElements);
+  embedding_storage_ = std::move(storage);
+  is_half_precision_ = true;
+  return true;
+}
+
+auto ProcessorCore2Model::EmbeddingLayout(const int n_speakers,
+                                          const bool half_precision)
+    -> Layout {
+  // 64 バイト境界に揃える
+  const auto align = [](const std::size_t bytes) {
+    constexpr auto kAlign = std::size_t{64};
+    return (bytes + kAlign - 1) / kAlign * kAlign;
+  };
+  const auto n = static_cast<std::size_t>(n_speakers);
+  const auto large_element_size =
+      half_precision ? sizeof(Float16) : sizeof(float);
+  auto layout = Layout();
+  layout.codebooks = 0;
+  layout.additive = align(
+      layout.codebooks + large_element_size * n *
+                             (BEATRICE_20RC0_CODEBOOK_SIZE *
+                              BEATRICE_20RC0_PHONE_CHANNELS));
+  layout.formant_shift =
+      align(layout.additive +
+            sizeof(float) * n * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  layout.key_value =
+      align(layout.formant_shift +
+            sizeof(float) * 9 * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  layout.size = align(
+      layout.key_value + large_element_size * n *
+                             (BEATRICE_20RC0_KV_LENGTH *
+                              BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS));
+  return layout;
+}
+
+void ProcessorCore2Model::SetEmbeddingPointers(const std::byte* const base) {
+  const auto layout = EmbeddingLayout(n_speakers_, is_half_precision_);
+  embedding_base_ = base;
+  codebooks_ = nullptr;
+  half_codebooks_ = nullptr;
+  key_value_speaker_embeddings_ = nullptr;
+  half_key_value_speaker_embeddings_ = nullptr;
+  if (is_half_precision_) {
+    half_codebooks_ =
+        reinterpret_cast<const Float16*>(base + layout.codebooks);
+    half_key_value_speaker_embeddings_ =
+        reinterpret_cast<const Float16*>(base + layout.key_value);
+  } else {
+    codebooks_ = reinterpret_cast<const float*>(base + layout.codebooks);
+    key_value_speaker_embeddings_ =
+        reinterpret_cast<const float*>(base + layout.key_value);
+  }
+  additive_speaker_embeddings_ =
+      reinterpret_cast<const float*>(base + layout.additive);
+  formant_shift_embeddings_ =
+      reinterpret_cast<const float*>(base + layout.formant_shift);
+}
+
+auto ProcessorCore2Model::GetEmbeddingCacheFile(
+    const std::filesystem::path& source, const bool half_precision)
+    -> std::filesystem::path {
+  auto ec = std::error_code();
+  const auto canonical = std::filesystem::canonical(source, ec);
+  if (ec) {
+    return {};
+  }
+  const auto directory =
+      std::filesystem::temp_directory_path(ec) / "beatrice-embedding-cache";
+  if (ec) {
+    return {};
+  }
+  const auto hash = std::hash<std::u8string>()(canonical.u8string());
+  auto name = std::array<char, 32>();
+  // 格納している精度ごとに別のファイルにする
+  std::snprintf(name.data(), name.size(),
+                half_precision ? "%016llx-f16.bin" : "%016llx.bin",
+                static_cast<unsigned long long>(hash));  // NOLINT(runtime/int)
+  return directory / name.data();
+}
+
+auto ProcessorCore2Model::MapEmbeddingCache(
+    const std::filesystem::path& source, const bool half_precision,
+    const bool require_incompressible) -> bool {
+  const auto cache_file = GetEmbeddingCacheFile(source, half_precision);
+  if (cache_file.empty() || !embedding_cache_.Open(cache_file)) {
+    return false;
+  }
+  // 元のファイルと対応しているかを確かめる
+  const auto is_valid = [&] {
+    if (embedding_cache_.GetSize() < kEmbeddingCacheHeaderSize) {
+      return false;
+    }
+    auto header = EmbeddingCacheHeader();
+    std::memcpy(&header, embedding_cache_.GetData(), sizeof(header));
+    auto ec = std::error_code();
+    const auto canonical = std::filesystem::canonical(source, ec).u8string();
+    const auto source_size = std::filesystem::file_size(source, ec);
+    const auto source_time = std::filesystem::last_write_time(source, ec);
+    if (ec || header.magic != kEmbeddingCacheMagic ||
+        header.format_version != kEmbeddingCacheFormatVersion ||
+        header.n_speakers <= 0 || header.source_size != source_size ||
+        header.is_half_precision != (half_precision ? 1U : 0U) ||
+        (require_incompressible && header.is_incompressible == 0U) ||
+        header.source_time != source_time.time_since_epoch().count() ||
+        header.source_path_length != canonical.size() ||
+        sizeof(header) + canonical.size() > kEmbeddingCacheHeaderSize ||
+        std::memcmp(embedding_cache_.GetData() + sizeof(header),
+                    canonical.data(), canonical.size()) != 0) {
+      return false;
+    }
+    return embedding_cache_.GetSize() ==
+           kEmbeddingCacheHeaderSize +
+               EmbeddingLayout(header.n_speakers, half_precision).size;
+  }();
+  if (!is_valid) {
+    embedding_cache_.Close();
+    return false;
+  }
+  auto header = EmbeddingCacheHeader();
+  std::memcpy(&header, embedding_cache_.GetData(), sizeof(header));
+  n_speakers_ = header.n_speakers;
+  is_half_precision_ = half_precision;
+  SetEmbeddingPointers(embedding_cache_.GetData() + kEmbeddingCacheHeaderSize);
+  // 使われていないものから消されるよう、使ったことを記録する
+  TouchCacheEntry(cache_file);
+  return true;
+}
+
+auto ProcessorCore2Model::WriteEmbeddingCache(
+    const std::filesystem::path& source, const bool is_incompressible) const
+    -> bool {
+  const auto cache_file = GetEmbeddingCacheFile(source, is_half_precision_);
+  if (cache_file.empty()) {
+    return false;
+  }
+  auto ec = std::error_code();
+  const auto canonical = std::filesystem::canonical(source, ec).u8string();
+  const auto source_size = std::filesystem::file_size(source, ec);
+  const auto source_time = std::filesystem::last_write_time(source, ec);
+  if (ec || sizeof(EmbeddingCacheHeader) + canonical.size() >
+                kEmbeddingCacheHeaderSize) {
+    return false;
+  }
+  std::filesystem::create_directories(cache_file.parent_path(), ec);
+  if (ec) {
+    return false;
+  }
+  auto header_block = std::vector<char>(kEmbeddingCacheHeaderSize, 0);
+  const auto header = EmbeddingCacheHeader{
+      .magic = kEmbeddingCacheMagic,
+      .format_version = kEmbeddingCacheFormatVersion,
+      .n_speakers = n_speakers_,
+      .source_size = source_size,
+      .source_time = source_time.time_since_epoch().count(),
+      .is_half_precision = is_half_precision_ ? 1U : 0U,
+      .is_incompressible = is_incompressible ? 1U : 0U,
+      .source_path_length = static_cast<std::uint32_t>(canonical.size()),
+  };
+  std::memcpy(header_block.data(), &header, sizeof(header));
+  std::memcpy(header_block.data() + sizeof(header), canonical.data(),
+              canonical.size());
+
+  // 他のプロセスが読んでいる途中のファイルを壊さないよう、
+  // 別名で書き出してから置き換える
+  auto temporary_file = cache_file;
+  temporary_file += ".tmp" + std::to_string(std::hash<const void*>()(this));
+  {
+    auto ofs = std::ofstream(temporary_file, std::ios::binary);
+    ofs.write(header_block.data(), header_block.size());
+    ofs.write(reinterpret_cast<const char*>(embedding_storage_.data()),
+              embedding_storage_.size());
+    if (!ofs) {
+      ofs.close();
+      std::filesystem::remove(temporary_file, ec);
+      return false;
+    }
+  }
+  std::filesystem::rename(temporary_file, cache_file, ec);
+  if (ec) {
+    std::filesystem::remove(temporary_file, ec);
+    return false;
+  }
+  TrimCacheDirectory(cache_file.parent_path(), kEmbeddingCacheMaxTotalSize,
+                     cache_file);
+  return true;
+}
+
+auto ProcessorCore2::LoadModel(const ModelConfig& /*config*/,
+                               const std::filesystem::path& new_model_file)
+    -> ErrorCode {
+  StopPipeline();
+  // IsLoaded() が false を返すようにする
+  model_file_.clear();
+  is_ready_to_set_speaker_ = false;
+  // モデルを手放す前にワーカーから切り離す
+  codebook_morpher_.SetCodebooks(0, static_cast<const float*>(nullptr));
+  deferred_tasks_.Clear();
+  InvalidateVoiceCache(-1);
+  for (auto&& extra : extra_targets_) {
+    extra.reset();
+  }
+  // 固定したまま領域を確保し直さないよう、先に解除しておく
+  UnlockModelMemory();
+  model_.reset();
+  phone_extractor_ = nullptr;
+  pitch_estimator_ = nullptr;
+  waveform_generator_ = nullptr;
+  embedding_setter_ = nullptr;
+  n_speakers_ = 0;
 
-  // モーフィング結果格納用の領域はファイルからの読み込み時に初期化されないので念の為ここで初期化しておく
-  std::fill_n(codebooks_.data() + n_speakers_ * (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                                 BEATRICE_20RC0_PHONE_CHANNELS),
-              BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS,
-              0.0f);
-  std::fill_n(additive_speaker_embeddings_.data() +
-                  n_speakers_ * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-              BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS, 0.0f);
-  std::fill_n(
-      key_value_speaker_embeddings_.data() +
-          n_speakers_ * (BEATRICE_20RC0_KV_LENGTH *
-                         BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS),
+  // 他のインスタンスが同じモデルを同じ精度で読み込み済みであれば、
+  // それを共有する
+  const auto d = new_model_file.parent_path();
+  const auto half_precision = is_half_precision_embedding_enabled_;
+  auto model = std::shared_ptr<const ProcessorCore2Model>();
+  if (const auto err = ModelCache<ProcessorCore2Model>::GetInstance().Load(
+          ProcessorCore2Model::GetFiles(d), half_precision ? "f16" : "f32",
+          [&d, half_precision](ProcessorCore2Model& m) {
+            return m.Load(d, half_precision);
+          },
+          model);
+      err != ErrorCode::kSuccess) {
+    return err;
+  }
+  model_ = std::move(model);
+  phone_extractor_ = model_->GetPhoneExtractor();
+  pitch_estimator_ = model_->GetPitchEstimator();
+  waveform_generator_ = model_->GetWaveformGenerator();
+  embedding_setter_ = model_->GetEmbeddingSetter();
+  n_speakers_ = model_->GetNSpeakers();
+
+  // モーフィング結果の格納用の領域はインスタンスごとに持つ
+  morphed_additive_speaker_embedding_.assign(
+      BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS, 0.0f);
+  morphed_key_value_speaker_embedding_.assign(
       BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
       0.0f);
+  // 半精度の場合は単精度に戻す領域も持つ
+  widened_codebook_.speaker = -1;
+  if (model_->IsHalfPrecision()) {
+    widened_codebook_.data.assign(
+        BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS, 0.0f);
+    widened_key_value_speaker_embedding_.assign(
+        BEATRICE_20RC0_KV_LENGTH *
+            BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
+        0.0f);
+  } else {
+    widened_codebook_.data = AlignedVector<float, 64>();
+    widened_key_value_speaker_embedding_ = AlignedVector<float, 64>();
+  }
 
-#if 0
-  // codebook モーフィング用に sph_avg を初期化する
-  std::vector<float> codebook_block(n_speakers_ *
-                                    BEATRICE_20RC0_PHONE_CHANNELS);
-  for (size_t i = 0; i < BEATRICE_20RC0_CODEBOOK_SIZE; ++i) {
-    for (size_t j = 0; j < n_speakers_; ++j) {
-      std::copy_n(codebooks_.data() + (j * BEATRICE_20RC0_CODEBOOK_SIZE + i) *
-                                          BEATRICE_20RC0_PHONE_CHANNELS,
-                  BEATRICE_20RC0_PHONE_CHANNELS,
-                  codebook_block.data() + j * BEATRICE_20RC0_PHONE_CHANNELS);
-    }
-    sph_avgs_c_[i].Initialize(n_speakers_, BEATRICE_20RC0_PHONE_CHANNELS,
-                              codebook_block.data(), kSphAvgMaxNSpeakers);
+  // codebook モーフィング用のワーカーに codebook を渡す
+  if (model_->IsHalfPrecision()) {
+    codebook_morpher_.SetCodebooks(n_speakers_, model_->GetHalfCodebooks());
+  } else {
+    codebook_morpher_.SetCodebooks(n_speakers_, model_->GetCodebooks());
   }
-#endif
+  is_codebook_morphing_requested_ = false;
 
   // additive_speaker_embeddings モーフィング用の sph_avg を初期化する
   sph_avg_a_.Initialize(n_speakers_,
                         BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-                        additive_speaker_embeddings_.data(),
+                        model_->GetAdditiveSpeakerEmbeddings(),
                         std::min(n_speakers_, kSphAvgMaxNSpeakers));
 
   // key-value モーフィング用に sph_avg を初期化する
-  std::vector<float> key_value_block(
-      n_speakers_ * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
-  for (size_t i = 0; i < BEATRICE_20RC0_KV_LENGTH; ++i) {
-    for (size_t j = 0; j < n_speakers_; ++j) {
-      std::copy_n(key_value_speaker_embeddings_.data() +
-                      (j * BEATRICE_20RC0_KV_LENGTH + i) *
-                          BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-                  BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-                  key_value_block.data() +
-                      j * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
-    }
-    sph_avgs_k_[i].Initialize(
-        n_speakers_, BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
-        key_value_block.data(), std::min(n_speakers_, kSphAvgMaxNSpeakers));
-  }
-  speaker_morphing_state_counter_ = INT_MAX;
+  // i 番目の sph_avg は各話者の i 番目の行を共有のモデルから直接参照する
+  // 半精度の場合は、使う行だけをその都度単精度に戻す
+  const auto initialize_sph_avgs_k = [this](const auto* const key_value) {
+    for (size_t i = 0; i < BEATRICE_20RC0_KV_LENGTH; ++i) {
+      sph_avgs_k_[i].Initialize(
+          n_speakers_, BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
+          key_value + i * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS,
+          std::min(n_speakers_, kSphAvgMaxNSpeakers), 2,
+          BEATRICE_20RC0_KV_LENGTH *
+              BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS);
+    }
+  };
+  if (model_->IsHalfPrecision()) {
+    initialize_sph_avgs_k(model_->GetHalfKeyValueSpeakerEmbeddings());
+  } else {
+    initialize_sph_avgs_k(model_->GetKeyValueSpeakerEmbeddings());
+  }
 
   is_ready_to_set_speaker_ = true;
 
@@ -387,10 +1280,96 @@ auto ProcessorCore2::LoadModel(const ModelConfig& /*config*/,
   if (const auto err = SetTargetSpeaker(0); err != ErrorCode::kSuccess) {
     return err;
   }
-  while (SetKeyValueSpeakerEmbedding());
+  // 範囲外の追加の目標話者は無効にしておく
+  for (auto i = 0; i < kMaxNExtraTargets; ++i) {
+    static_cast<void>(UpdateExtraTarget(i));
+  }
+  deferred_tasks_.RunAll();
+  UpdateModelMemoryLock();
 
   model_file_ = new_model_file;
+  RestartPipeline();
+
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::WarmUp(const int n_hops) -> ErrorCode {
+  // 後回しにした処理を進めるので、その間はワーカーを止めておく
+  StopPipeline();
+  if (!IsLoaded()) {
+    return RestartPipeline(), ErrorCode::kSuccess;
+  }
+  // 使う話者の埋め込みを読み、最初のフレームでページフォールトが
+  // 起きないようにする。他の話者の分は使われるまで読み込まない
+  ForEachSpeakerMemory(target_speaker_, PrefaultMemory);
+  for (auto i = 0; i < kMaxNExtraTargets; ++i) {
+    if (const auto speaker = extra_target_speakers_[i];
+        0 <= speaker && speaker <= n_speakers_) {
+      ForEachSpeakerMemory(speaker, PrefaultMemory);
+    }
+  }
+  PrefaultMemory(
+      GetFormantShiftEmbedding(0),
+      sizeof(float) * 9 * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+  // パラメータの反映で後回しになった話者の設定などを済ませておく
+  deferred_tasks_.RunAll();
+  if (n_hops <= 0) {
+    return RestartPipeline(), ErrorCode::kSuccess;
+  }
+
+  // 本番の状態を変えないよう、使い捨てのコンテキストで推論する
+  auto* const phone_context = Beatrice20rc0_CreatePhoneContext1();
+  auto* const pitch_context = Beatrice20rc0_CreatePitchContext1();
+  auto* const waveform_context = Beatrice20rc0_CreateWaveformContext1();
+  auto* const embedding_context = Beatrice20rc0_CreateEmbeddingContext();
+  Beatrice20rc0_SetVQNumNeighbors(phone_context, GetEffectiveVQNumNeighbors());
+  // phone_context は使い捨てなので、戻した codebook もここで持つ
+  auto widened_codebook = WidenedCodebook();
+  if (model_->IsHalfPrecision()) {
+    widened_codebook.data.resize(BEATRICE_20RC0_CODEBOOK_SIZE *
+                                 BEATRICE_20RC0_PHONE_CHANNELS);
+  }
+  Beatrice20rc0_SetCodebook(phone_context,
+                            GetCodebook(target_speaker_, widened_codebook));
+  Beatrice20rc0_SetAdditiveSpeakerEmbedding(
+      embedding_setter_, GetAdditiveSpeakerEmbedding(target_speaker_),
+      embedding_context, waveform_context);
+  Beatrice20rc0_SetFormantShiftEmbedding(embedding_setter_,
+                                         GetFormantShiftEmbedding(4),
+                                         embedding_context, waveform_context);
+  Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
+      embedding_setter_, GetKeyValueSpeakerEmbedding(target_speaker_),
+      embedding_context);
+  for (auto block = 0; block < BEATRICE_20RC0_N_BLOCKS; ++block) {
+    Beatrice20rc0_SetKeyValueSpeakerEmbedding(
+        embedding_setter_, block, embedding_context, waveform_context);
+  }
 
+  // 無音では省略される計算があるかもしれないので、小さなノイズを入力する
+  auto engine = std::mt19937(kDefaultRandomSeed);
+  auto dist = std::uniform_real_distribution<float>(-1e-2f, 1e-2f);
+  alignas(64) std::array<float, BEATRICE_IN_HOP_LENGTH> input;
+  alignas(64) std::array<float, BEATRICE_20RC0_PHONE_CHANNELS> phone;
+  std::array<float, 4> pitch_feature;
+  alignas(64) std::array<float, BEATRICE_OUT_HOP_LENGTH> output;
+  for (auto i = 0; i < n_hops; ++i) {
+    std::ranges::generate(input, [&] { return dist(engine); });
+    auto quantized_pitch = 0;
+    Beatrice20rc0_ExtractPhone1(phone_extractor_, input.data(), phone.data(),
+                                phone_context);
+    Beatrice20rc0_EstimatePitch1(pitch_estimator_, input.data(),
+                                 &quantized_pitch, pitch_feature.data(),
+                                 pitch_context);
+    Beatrice20rc0_GenerateWaveform1(waveform_generator_, phone.data(),
+                                    &quantized_pitch, pitch_feature.data(),
+                                    output.data(), waveform_context);
+  }
+
+  Beatrice20rc0_DestroyPhoneContext1(phone_context);
+  Beatrice20rc0_DestroyPitchContext1(pitch_context);
+  Beatrice20rc0_DestroyWaveformContext1(waveform_context);
+  Beatrice20rc0_DestroyEmbeddingContext(embedding_context);
+  RestartPipeline();
   return ErrorCode::kSuccess;
 }
 
@@ -398,12 +1377,189 @@ auto ProcessorCore2::SetSampleRate(const double new_sample_rate) -> ErrorCode {
   if (new_sample_rate == any_freq_in_out_.GetSampleRate()) {
     return ErrorCode::kSuccess;
   }
+  StopPipeline();
   any_freq_in_out_.SetSampleRate(new_sample_rate);
   input_gain_context_.SetSampleRate(new_sample_rate);
   output_gain_context_.SetSampleRate(new_sample_rate);
+  for (auto&& extra : extra_targets_) {
+    if (extra) {
+      extra->any_freq_in_out = any_freq_in_out_;
+      extra->output_gain_context.SetSampleRate(new_sample_rate);
+      extra->hop_count = hop_count_;
+    }
+  }
+  // 遅延がサンプリング周波数に依存するので作り直す
+  RestartPipeline();
   return ErrorCode::kSuccess;
 }
 
+auto ProcessorCore2::SetMaxBlockSize(const int new_max_block_size)
+    -> ErrorCode {
+  if (new_max_block_size == max_block_size_) {
+    return ErrorCode::kSuccess;
+  }
+  max_block_size_ = std::max(new_max_block_size, 0);
+  RestartPipeline();
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::GetLatencySamples() const -> int {
+  return static_cast<int>(std::round(
+      pipeline_.GetDepth() * any_freq_in_out_.GetSampleRate() *
+      BEATRICE_IN_HOP_LENGTH / BEATRICE_IN_SAMPLE_RATE));
+}
+
+// 空の状態のパイプラインを作り直す。無効であれば一時停止させておく
+void ProcessorCore2::RestartPipeline() {
+  StopPipeline();
+  // 1 回のコールバックで揃い得るフレーム数だけ遅らせれば、
+  // ワーカーは次のコールバックまでにそれらを処理すればよくなる。
+  // ブロックの境界とフレームの境界がずれる分として 1 フレーム足す
+  const auto sample_rate = any_freq_in_out_.GetSampleRate();
+  const auto hops_per_block =
+      sample_rate > 0.0
+          ? static_cast<int>(std::ceil(max_block_size_ *
+                                       BEATRICE_IN_SAMPLE_RATE /
+                                       (sample_rate * BEATRICE_IN_HOP_LENGTH)))
+          : 0;
+  pipeline_.Restart(
+      hops_per_block + 1,
+      [](void* const self, const float* const input, float* const output,
+         const int n_hops) {
+        auto& core = *static_cast<ProcessorCore2*>(self);
+        // 届いている設定を反映してから推論する
+        core.ApplyPostedState();
+        core.InferGated(input, output, n_hops, -1);
+        return true;
+      },
+      this);
+}
+
+void ProcessorCore2::StopPipeline() {
+  if (!pipeline_.Stop()) {
+    return;
+  }
+  ApplyPostedState();
+  SyncExtraTargetsWithMain();
+}
+
+void ProcessorCore2::UpdatePipelineMode() {
+  if (!pipeline_.UpdateMode()) {
+    return;
+  }
+  ApplyPostedState();
+  SyncExtraTargetsWithMain();
+}
+
+void ProcessorCore2::SyncExtraTargetsWithMain() {
+  for (auto&& extra : extra_targets_) {
+    if (extra) {
+      extra->any_freq_in_out = any_freq_in_out_;
+      extra->output_gain_context = output_gain_context_;
+      extra->hop_count = hop_count_;
+    }
+  }
+}
+
+auto ProcessorCore2::PostState(const StateSlot slot, const double value)
+    -> bool {
+  if (pipeline_.IsWorkerThread() || !pipeline_.IsActive()) {
+    return false;
+  }
+  state_mailbox_.Post(slot, value);
+  return true;
+}
+
+void ProcessorCore2::ApplyPostedState() {
+  // 止めたときは、ワーカーが反映しなかった追加の目標話者の分も含めて全て調べる
+  const auto is_stopped = !pipeline_.IsWorkerThread();
+  if (!state_mailbox_.BeginTake() && !is_stopped) {
+    return;
+  }
+  auto value = 0.0;
+  const auto take = [this, &value](const std::size_t slot) {
+    return state_mailbox_.Take(slot, value);
+  };
+  const auto to_int = [&value] { return static_cast<int>(value); };
+  // 値の範囲は置く前に確かめてあるので、ここではエラーを無視する
+  if (take(kStateVoiceCacheSize)) {
+    static_cast<void>(SetVoiceCacheSize(to_int()));
+  }
+  if (take(kStatePipelinedProcessing)) {
+    static_cast<void>(SetPipelinedProcessing(value != 0.0));
+  }
+  if (take(kStatePitchCalibration)) {
+    static_cast<void>(SetPitchCalibration(value != 0.0));
+  }
+  if (take(kStateAdaptiveQuality)) {
+    static_cast<void>(SetAdaptiveQuality(value != 0.0));
+  }
+  if (take(kStateRandomSeed)) {
+    static_cast<void>(SetRandomSeed(static_cast<unsigned int>(value)));
+  }
+  if (take(kStateMorphingQuality)) {
+    static_cast<void>(SetMorphingQuality(to_int()));
+  }
+  if (take(kStateTargetSpeaker)) {
+    static_cast<void>(SetTargetSpeaker(to_int()));
+  }
+  if (take(kStateFormantShift)) {
+    static_cast<void>(SetFormantShift(value));
+  }
+  if (take(kStatePitchShift)) {
+    static_cast<void>(SetPitchShift(value));
+  }
+  if (take(kStateAverageSourcePitch)) {
+    static_cast<void>(SetAverageSourcePitch(value));
+  }
+  if (take(kStateIntonationIntensity)) {
+    static_cast<void>(SetIntonationIntensity(value));
+  }
+  if (take(kStatePitchCorrection)) {
+    static_cast<void>(SetPitchCorrection(value));
+  }
+  if (take(kStatePitchCorrectionType)) {
+    static_cast<void>(SetPitchCorrectionType(to_int()));
+  }
+  if (take(kStateMinSourcePitch)) {
+    static_cast<void>(SetMinSourcePitch(value));
+  }
+  if (take(kStateMaxSourcePitch)) {
+    static_cast<void>(SetMaxSourcePitch(value));
+  }
+  if (take(kStateVQNumNeighbors)) {
+    static_cast<void>(SetVQNumNeighbors(to_int()));
+  }
+  if (take(kStateSilenceThreshold)) {
+    static_cast<void>(SetSilenceThreshold(value));
+  }
+  // モーフィングの重みは全て受け取ってから、まとめて反映する
+  auto is_weight_changed = false;
+  for (auto i = 0; i < kMaxNSpeakers; ++i) {
+    if (take(kStateSpeakerMorphingWeight + i)) {
+      speaker_morphing_weights_[i] = static_cast<float>(value);
+      is_weight_changed = true;
+    }
+  }
+  if (is_weight_changed && is_ready_to_set_speaker_) {
+    UpdateSpeakerMorphingWeights();
+  }
+  if (!is_stopped) {
+    return;
+  }
+  for (auto i = 0; i < kMaxNExtraTargets; ++i) {
+    if (take(kStateExtraTargetSpeaker + i)) {
+      static_cast<void>(SetExtraTargetSpeaker(i, to_int()));
+    }
+    if (take(kStateExtraTargetFormantShift + i)) {
+      static_cast<void>(SetExtraTargetFormantShift(i, value));
+    }
+    if (take(kStateExtraTargetPitchShift + i)) {
+      static_cast<void>(SetExtraTargetPitchShift(i, value));
+    }
+  }
+}
+
 auto ProcessorCore2::SetTargetSpeaker(const int new_target_speaker_id)
     -> ErrorCode {
   if (!is_ready_to_set_speaker_) {
@@ -412,53 +1568,47 @@ auto ProcessorCore2::SetTargetSpeaker(const int new_target_speaker_id)
   if (new_target_speaker_id < 0 || n_speakers_ + 1 <= new_target_speaker_id) {
     return ErrorCode::kSpeakerIDOutOfRange;
   }
-  assert(static_cast<int>(codebooks_.size()) ==
-         (n_speakers_ + 1) *
-             (BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS));
-  assert(static_cast<int>(additive_speaker_embeddings_.size()) ==
-         (n_speakers_ + 1) * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
-  assert(static_cast<int>(key_value_speaker_embeddings_.size()) ==
-         (n_speakers_ + 1) * (BEATRICE_20RC0_KV_LENGTH *
-                              BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS));
+  if (PostState(kStateTargetSpeaker, new_target_speaker_id)) {
+    return ErrorCode::kSuccess;
+  }
+  assert(model_ && model_->GetNSpeakers() == n_speakers_);
+  PrefetchSpeaker(new_target_speaker_id);
+  const auto is_registered = AcquireEmbeddingContext(new_target_speaker_id);
   Beatrice20rc0_SetCodebook(
-      phone_context_, codebooks_.data() + new_target_speaker_id *
-                                              (BEATRICE_20RC0_CODEBOOK_SIZE *
-                                               BEATRICE_20RC0_PHONE_CHANNELS));
+      phone_context_, GetCodebook(new_target_speaker_id, widened_codebook_));
   Beatrice20rc0_SetAdditiveSpeakerEmbedding(
-      embedding_setter_,
-      additive_speaker_embeddings_.data() +
-          new_target_speaker_id * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+      embedding_setter_, GetAdditiveSpeakerEmbedding(new_target_speaker_id),
       embedding_context_, waveform_context_);
-  Beatrice20rc0_RegisterKeyValueSpeakerEmbedding(
-      embedding_setter_,
-      key_value_speaker_embeddings_.data() +
-          new_target_speaker_id *
-              (BEATRICE_20RC0_KV_LENGTH *
-               BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS),
-      embedding_context_);
   target_speaker_ = new_target_speaker_id;
-  key_value_speaker_embedding_set_count_ = 0;
+  deferred_tasks_.Schedule(kSetFormantShift);
+  deferred_tasks_.Schedule(kPrepareSpareContexts);
+  if (is_registered) {
+    // 登録済みであれば各ブロックへの設定だけでよい
+    deferred_tasks_.Cancel(kRegisterKeyValue);
+    key_value_speaker_embedding_set_count_ = 0;
+    deferred_tasks_.Schedule(kSetKeyValue);
+  } else {
+    // key-value speaker embedding の登録は重いので後回しにする
+    deferred_tasks_.Schedule(kRegisterKeyValue);
+  }
   return ErrorCode::kSuccess;
 }
 
 auto ProcessorCore2::SetFormantShift(const double new_formant_shift)
     -> ErrorCode {
+  if (PostState(kStateFormantShift, new_formant_shift)) {
+    return ErrorCode::kSuccess;
+  }
   formant_shift_ = std::clamp(new_formant_shift, -2.0, 2.0);
-  const auto index = static_cast<int>(std::round(formant_shift_ * 2.0 + 4.0));
-  assert(0 <= index && index < 9);
-  assert(static_cast<int>(formant_shift_embeddings_.size()) ==
-         9 * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
-  Beatrice20rc0_SetFormantShiftEmbedding(
-      embedding_setter_,
-      formant_shift_embeddings_.data() +
-          index * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
-      embedding_context_, waveform_context_);
+  deferred_tasks_.Schedule(kSetFormantShift);
   return ErrorCode::kSuccess;
 }
 
 auto ProcessorCore2::SetPitchShift(const double new_pitch_shift) -> ErrorCode {
-  pitch_shift_ = std::clamp(new_pitch_shift, -24.0, 24.0);
-  return ErrorCode::kSuccess;
+  if (PostState(kStatePitchShift, new_pitch_shift)) {
+    return ErrorCode::kSuccess;
+  }
+  return pitch_mapping_.SetPitchShift(new_pitch_shift);
 }
 
 auto ProcessorCore2::SetInputGain(const double new_input_gain) -> ErrorCode {
@@ -468,6 +1618,15 @@ auto ProcessorCore2::SetInputGain(const double new_input_gain) -> ErrorCode {
 
 auto ProcessorCore2::SetOutputGain(const double new_output_gain) -> ErrorCode {
   output_gain_context_.SetTargetGain(new_output_gain);
+  if (pipeline_.IsActive()) {
+    // 追加の目標話者の分はパイプライン処理を止めたときに揃える
+    return ErrorCode::kSuccess;
+  }
+  for (auto&& extra : extra_targets_) {
+    if (extra) {
+      extra->output_gain_context.SetTargetGain(new_output_gain);
+    }
+  }
   return ErrorCode::kSuccess;
 }
 
@@ -480,49 +1639,273 @@ auto ProcessorCore2::SetSpeakerMorphingWeight(int target_speaker_id,
   if (target_speaker_id < 0 || target_speaker_id >= kMaxNSpeakers) {
     return ErrorCode::kSpeakerIDOutOfRange;
   }
+  if (PostState(static_cast<StateSlot>(kStateSpeakerMorphingWeight +
+                                       target_speaker_id),
+                morphing_weight)) {
+    return ErrorCode::kSuccess;
+  }
   speaker_morphing_weights_[target_speaker_id] = morphing_weight;
 
   if (target_speaker_id < n_speakers_) {
-    /* 非ゼロ weight の個数が設定値を超えないように、大きい方から順番に残す */
-    auto& indices = speaker_morphing_weights_argsort_indices_;
-    std::iota(indices.data(), indices.data() + n_speakers_, 0);
-    std::sort(indices.data(), indices.data() + n_speakers_,
-              [this](size_t a, size_t b) {
-                return speaker_morphing_weights_[a] >
-                       speaker_morphing_weights_[b];
-              });
-    for (size_t i = 0; i < kSphAvgMaxNSpeakers; ++i) {
-      speaker_morphing_weights_pruned_[indices[i]] =
-          speaker_morphing_weights_[indices[i]];
-    }
-    for (size_t i = kSphAvgMaxNSpeakers; i < n_speakers_; ++i) {
-      speaker_morphing_weights_pruned_[indices[i]] = 0.0;
-    }
-
-    // ここでsph_avg_a_などの重みを更新(sph_avg_.SetWeights())してしまうと、
-    // モデル読み込み時に一気にkMaxNSpeakersの数だけ重みが設定されるため処理が重くなるので、
-    // フラグだけ立てて次のフレームから更新するようにする。
-    speaker_morphing_state_counter_ = 0;
+    UpdateSpeakerMorphingWeights();
   }
   return ErrorCode::kSuccess;
 }
 
-auto ProcessorCore2::SetAverageSourcePitch(const double new_average_pitch)
+auto ProcessorCore2::SetSpeakerMorphingWeights(
+    const std::span<const double> weights) -> ErrorCode {
+  if (!is_ready_to_set_speaker_) {
+    return ErrorCode::kModelNotLoaded;
+  }
+  const auto n =
+      std::min(weights.size(), static_cast<std::size_t>(kMaxNSpeakers));
+  if (n > 0 && PostState(kStateSpeakerMorphingWeight, weights[0])) {
+    for (std::size_t i = 1; i < n; ++i) {
+      state_mailbox_.Post(kStateSpeakerMorphingWeight + i, weights[i]);
+    }
+    return ErrorCode::kSuccess;
+  }
+  std::copy_n(weights.begin(), n, speaker_morphing_weights_.begin());
+  UpdateSpeakerMorphingWeights();
+  return ErrorCode::kSuccess;
+}
+
+void ProcessorCore2::UpdateSpeakerMorphingWeights() {
+  // 非ゼロ weight の個数が設定値を超えないように、大きい方から順番に残す。
+  // 使われるのは上位 kSphAvgMaxNSpeakers 個の順位だけなので、
+  // その分だけ部分的に並べる
+  auto& indices = speaker_morphing_weights_argsort_indices_;
+  const auto n_kept = std::min(n_speakers_, kSphAvgMaxNSpeakers);
+  std::iota(indices.data(), indices.data() + n_speakers_, 0);
+  std::partial_sort(indices.data(), indices.data() + n_kept,
+                    indices.data() + n_speakers_, [this](int a, int b) {
+                      return speaker_morphing_weights_[a] >
+                             speaker_morphing_weights_[b];
+                    });
+  for (auto i = 0; i < n_kept; ++i) {
+    speaker_morphing_weights_pruned_[indices[i]] =
+        speaker_morphing_weights_[indices[i]];
+    // モーフィングで読む話者の埋め込みを先に読み込ませておく
+    if (speaker_morphing_weights_[indices[i]] > 0.0f) {
+      PrefetchSpeaker(indices[i]);
+    }
+  }
+  for (auto i = n_kept; i < n_speakers_; ++i) {
+    speaker_morphing_weights_pruned_[indices[i]] = 0.0;
+  }
+
+  speaker_morphing_codebook_lottery_.Build(
+      n_kept, speaker_morphing_weights_pruned_.data(),
+      speaker_morphing_weights_argsort_indices_.data());
+
+  // ここでsph_avg_a_などの重みを更新(sph_avg_.SetWeights())してしまうと、
+  // モデル読み込み時に一気にkMaxNSpeakersの数だけ重みが設定されるため処理が重くなるので、
+  // 後回しにしてフレームの残り時間で更新するようにする。
+  deferred_tasks_.Cancel(kMorphKeyValue);
+  deferred_tasks_.Schedule(kMorphAdditive);
+}
+
+auto ProcessorCore2::SetMorphingQuality(const int new_morphing_quality)
+    -> ErrorCode {
+  if (new_morphing_quality < 0 || new_morphing_quality > 2) {
+    return ErrorCode::kInvalidMorphingQuality;
+  }
+  if (PostState(kStateMorphingQuality, new_morphing_quality)) {
+    return ErrorCode::kSuccess;
+  }
+  morphing_quality_ = static_cast<MorphingQuality>(new_morphing_quality);
+  if (is_ready_to_set_speaker_) {
+    // 現在の重みでモーフィングをやり直す
+    deferred_tasks_.Cancel(kMorphKeyValue);
+    deferred_tasks_.Schedule(kMorphAdditive);
+  }
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetVoiceCacheSize(const int new_voice_cache_size)
+    -> ErrorCode {
+  if (PostState(kStateVoiceCacheSize, new_voice_cache_size)) {
+    return ErrorCode::kSuccess;
+  }
+  // EmbeddingContext は全て作ってあるので、使う数を変えるだけにする
+  voice_cache_.SetSize(new_voice_cache_size);
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetParallelPitchEstimation(
+    const bool new_parallel_pitch_estimation) -> ErrorCode {
+  // 次のフレームの区切りから反映される
+  is_parallel_pitch_estimation_enabled_.store(new_parallel_pitch_estimation,
+                                              std::memory_order_relaxed);
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetPipelinedProcessing(
+    const bool new_pipelined_processing) -> ErrorCode {
+  // 他の設定と順序が入れ替わらないよう、ワーカーを介して反映する
+  if (PostState(kStatePipelinedProcessing, new_pipelined_processing)) {
+    return ErrorCode::kSuccess;
+  }
+  // 切り替えはオーディオスレッドが次の処理の初めに行う
+  pipeline_.SetEnabled(new_pipelined_processing);
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetSilenceThreshold(const double new_silence_threshold)
+    -> ErrorCode {
+  if (PostState(kStateSilenceThreshold, new_silence_threshold)) {
+    return ErrorCode::kSuccess;
+  }
+  silence_gate_.SetThreshold(new_silence_threshold);
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetAdaptiveQuality(const bool new_adaptive_quality)
+    -> ErrorCode {
+  if (PostState(kStateAdaptiveQuality, new_adaptive_quality)) {
+    return ErrorCode::kSuccess;
+  }
+  if (governor_.SetEnabled(new_adaptive_quality)) {
+    ApplyQualityTier();
+  }
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetLockModelMemory(const bool new_lock_model_memory)
+    -> ErrorCode {
+  // 固定や解除はオーディオスレッドで行えない重い処理なので、
+  // 記録だけしておき、次にモデルを読み込んだときから反映する
+  is_model_memory_lock_enabled_ = new_lock_model_memory;
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetHalfPrecisionEmbeddings(
+    const bool new_half_precision_embeddings) -> ErrorCode {
+  is_half_precision_embedding_enabled_ = new_half_precision_embeddings;
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetPitchCalibration(const bool new_pitch_calibration)
+    -> ErrorCode {
+  if (PostState(kStatePitchCalibration, new_pitch_calibration)) {
+    return ErrorCode::kSuccess;
+  }
+  if (new_pitch_calibration == is_pitch_calibrating_) {
+    return ErrorCode::kSuccess;
+  }
+  // 結果は次に測り始めるまで残しておく
+  if (new_pitch_calibration) {
+    pitch_calibrator_.Reset();
+  }
+  is_pitch_calibrating_ = new_pitch_calibration;
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::GetSourcePitchStatistics() const
+    -> SourcePitchStatistics {
+  return pitch_calibrator_.GetStatistics();
+}
+
+auto ProcessorCore2::GetQualityTier() const -> int {
+  return static_cast<int>(governor_.GetTier());
+}
+
+auto ProcessorCore2::GetDeadlineMissCount() const -> int {
+  return governor_.GetDeadlineMissCount();
+}
+
+auto ProcessorCore2::SetRandomSeed(const unsigned int new_seed) -> ErrorCode {
+  if (PostState(kStateRandomSeed, new_seed)) {
+    return ErrorCode::kSuccess;
+  }
+  random_seed_ = new_seed;
+  speaker_morphing_codebook_lottery_engine_.seed(random_seed_);
+  for (auto&& extra : extra_targets_) {
+    if (extra) {
+      extra->codebook_lottery_engine.seed(random_seed_);
+    }
+  }
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorCore2::SetExtraTargetSpeaker(const int index,
+                                           const int new_target_speaker_id)
+    -> ErrorCode {
+  if (index < 0 || kMaxNExtraTargets <= index) {
+    return ErrorCode::kSpeakerIDOutOfRange;
+  }
+  if (PostState(static_cast<StateSlot>(kStateExtraTargetSpeaker + index),
+                new_target_speaker_id)) {
+    return ErrorCode::kSuccess;
+  }
+  extra_target_speakers_[index] = new_target_speaker_id;
+  return UpdateExtraTarget(index);
+}
+
+auto ProcessorCore2::SetExtraTargetFormantShift(const int index,
+                                                const double new_formant_shift)
     -> ErrorCode {
-  average_source_pitch_ = std::clamp(new_average_pitch, 0.0, 128.0);
+  if (index < 0 || kMaxNExtraTargets <= index) {
+    return ErrorCode::kSpeakerIDOutOfRange;
+  }
+  if (PostState(static_cast<StateSlot>(kStateExtraTargetFormantShift + index),
+                new_formant_shift)) {
+    return ErrorCode::kSuccess;
+  }
+  extra_target_formant_shifts_[index] =
+      std::clamp(new_formant_shift, -2.0, 2.0);
+  if (auto& extra = extra_targets_[index]) {
+    extra->is_embedding_set = false;
+    deferred_tasks_.Schedule(kPrepareExtraTargets);
+  }
   return ErrorCode::kSuccess;
 }
 
+auto ProcessorCore2::SetExtraTargetPitchShift(const int index,
+                                              const double new_pitch_shift)
+    -> ErrorCode {
+  if (index < 0 || kMaxNExtraTargets <= index) {
+    return ErrorCode::kSpeakerIDOutOfRange;
+  }
+  if (PostState(static_cast<StateSlot>(kStateExtraTargetPitchShift + index),
+                new_pitch_shift)) {
+    return ErrorCode::kSuccess;
+  }
+  return extra_target_pitch_mappings_[index].SetPitchShift(new_pitch_shift);
+}
+
+// 以下のピッチの設定は追加の目標話者にも共通して適用する
+auto ProcessorCore2::SetAverageSourcePitch(const double new_average_pitch)
+    -> ErrorCode {
+  if (PostState(kStateAverageSourcePitch, new_average_pitch)) {
+    return ErrorCode::kSuccess;
+  }
+  for (auto&& mapping : extra_target_pitch_mappings_) {
+    static_cast<void>(mapping.SetAverageSourcePitch(new_average_pitch));
+  }
+  return pitch_mapping_.SetAverageSourcePitch(new_average_pitch);
+}
+
 auto ProcessorCore2::SetIntonationIntensity(
     const double new_intonation_intensity) -> ErrorCode {
-  intonation_intensity_ = new_intonation_intensity;
-  return ErrorCode::kSuccess;
+  if (PostState(kStateIntonationIntensity, new_intonation_intensity)) {
+    return ErrorCode::kSuccess;
+  }
+  for (auto&& mapping : extra_target_pitch_mappings_) {
+    static_cast<void>(mapping.SetIntonationIntensity(new_intonation_intensity));
+  }
+  return pitch_mapping_.SetIntonationIntensity(new_intonation_intensity);
 }
 
 auto ProcessorCore2::SetPitchCorrection(const double new_pitch_correction)
     -> ErrorCode {
-  pitch_correction_ = std::clamp(new_pitch_correction, 0.0, 1.0);
-  return ErrorCode::kSuccess;
+  if (PostState(kStatePitchCorrection, new_pitch_correction)) {
+    return ErrorCode::kSuccess;
+  }
+  for (auto&& mapping : extra_target_pitch_mappings_) {
+    static_cast<void>(mapping.SetPitchCorrection(new_pitch_correction));
+  }
+  return pitch_mapping_.SetPitchCorrection(new_pitch_correction);
 }
 
 auto ProcessorCore2::SetPitchCorrectionType(const int new_pitch_correction_type)
@@ -530,12 +1913,26 @@ auto ProcessorCore2::SetPitchCorrectionType(const int new_pitch_correction_type)
   if (new_pitch_correction_type < 0 || new_pitch_correction_type > 1) {
     return ErrorCode::kInvalidPitchCorrectionType;
   }
-  pitch_correction_type_ = new_pitch_correction_type;
+  if (PostState(kStatePitchCorrectionType, new_pitch_correction_type)) {
+    return ErrorCode::kSuccess;
+  }
+  if (const auto err =
+          pitch_mapping_.SetPitchCorrectionType(new_pitch_correction_type);
+      err != ErrorCode::kSuccess) {
+    return err;
+  }
+  for (auto&& mapping : extra_target_pitch_mappings_) {
+    static_cast<void>(
+        mapping.SetPitchCorrectionType(new_pitch_correction_type));
+  }
   return ErrorCode::kSuccess;
 }
 
 auto ProcessorCore2::SetMinSourcePitch(const double new_min_source_pitch)
     -> ErrorCode {
+  if (PostState(kStateMinSourcePitch, new_min_source_pitch)) {
+    return ErrorCode::kSuccess;
+  }
   min_source_pitch_ = std::clamp(new_min_source_pitch, 0.0, 128.0);
   Beatrice20rc0_SetMinQuantizedPitch(
       pitch_context_,
@@ -548,6 +1945,9 @@ auto ProcessorCore2::SetMinSourcePitch(const double new_min_source_pitch)
 
 auto ProcessorCore2::SetMaxSourcePitch(const double new_max_source_pitch)
     -> ErrorCode {
+  if (PostState(kStateMaxSourcePitch, new_max_source_pitch)) {
+    return ErrorCode::kSuccess;
+  }
   max_source_pitch_ = std::clamp(new_max_source_pitch, 0.0, 128.0);
   Beatrice20rc0_SetMaxQuantizedPitch(
       pitch_context_,
@@ -560,8 +1960,11 @@ auto ProcessorCore2::SetMaxSourcePitch(const double new_max_source_pitch)
 
 auto ProcessorCore2::SetVQNumNeighbors(const int new_vq_num_neighbors)
     -> ErrorCode {
+  if (PostState(kStateVQNumNeighbors, new_vq_num_neighbors)) {
+    return ErrorCode::kSuccess;
+  }
   vq_num_neighbors_ = std::clamp(new_vq_num_neighbors, 0, 8);
-  Beatrice20rc0_SetVQNumNeighbors(phone_context_, vq_num_neighbors_);
+  ApplyQualityTier();
   return ErrorCode::kSuccess;
 }
 
@@ -4,72 +4,337 @@
 #define BEATRICE_COMMON_PROCESSOR_CORE_2_H_
 
 #include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
 #include <random>
+#include <span>
 #include <vector>
 
 #include "beatricelib/beatrice.h"
 
 // Beatrice
+#include "common/alias_table.h"
+#include "common/codebook_morpher.h"
+#include "common/cpu_governor.h"
+#include "common/deferred_task_scheduler.h"
 #include "common/error.h"
+#include "common/float16.h"
 #include "common/gain.h"
+#include "common/mapped_file.h"
+#include "common/memory_residency.h"
+#include "common/model_cache.h"
 #include "common/model_config.h"
+#include "common/parallel_worker.h"
+#include "common/pipeline_driver.h"
+#include "common/pitch_calibrator.h"
+#include "common/pitch_mapping.h"
 #include "common/processor_core.h"
 #include "common/resample.h"
+#include "common/silence_gate.h"
 #include "common/spherical_average.h"
+#include "common/state_mailbox.h"
+#include "common/voice_cache.h"
 
 namespace beatrice::common {
 
+// ProcessorCore2 が読み込むモデルの重みと話者埋め込み。
+// ModelCache で複数のインスタンスに共有されるので、読み込み後は変更しない。
+// モーフィング結果などインスタンスごとのものは ProcessorCore2 側で持つ。
+// 話者埋め込みは一度読み込んだらそのままの配置でキャッシュファイルに書き出し、
+// 次からはそれをメモリマップして、使われた話者の分だけを読み込む。
+// 話者埋め込みの大部分を占める codebook と key-value は半精度でも保持できる
+class ProcessorCore2Model {
+ public:
+  ProcessorCore2Model()
+      : phone_extractor_(Beatrice20rc0_CreatePhoneExtractor()),
+        pitch_estimator_(Beatrice20rc0_CreatePitchEstimator()),
+        waveform_generator_(Beatrice20rc0_CreateWaveformGenerator()),
+        embedding_setter_(Beatrice20rc0_CreateEmbeddingSetter()) {}
+  ~ProcessorCore2Model() {
+    Beatrice20rc0_DestroyPhoneExtractor(phone_extractor_);
+    Beatrice20rc0_DestroyPitchEstimator(pitch_estimator_);
+    Beatrice20rc0_DestroyWaveformGenerator(waveform_generator_);
+    Beatrice20rc0_DestroyEmbeddingSetter(embedding_setter_);
+  }
+  ProcessorCore2Model(const ProcessorCore2Model&) = delete;
+  auto operator=(const ProcessorCore2Model&) -> ProcessorCore2Model& = delete;
+
+  // directory 内の各ファイルから読み込む。half_precision が true であれば
+  // codebook と key-value speaker embedding を半精度で保持する。
+  // ただし半精度で表せない値を含む場合は単精度のままにする。
+  // 各ファイルは並行して読み込む
+  auto Load(const std::filesystem::path& directory, bool half_precision)
+      -> ErrorCode;
+  // Load() が読むファイルの一覧。ModelCache のキーに使う
+  static auto GetFiles(const std::filesystem::path& directory)
+      -> std::vector<std::filesystem::path>;
+
+  [[nodiscard]] auto GetPhoneExtractor() const
+      -> const Beatrice20rc0_PhoneExtractor* {
+    return phone_extractor_;
+  }
+  [[nodiscard]] auto GetPitchEstimator() const
+      -> const Beatrice20rc0_PitchEstimator* {
+    return pitch_estimator_;
+  }
+  [[nodiscard]] auto GetWaveformGenerator() const
+      -> const Beatrice20rc0_WaveformGenerator* {
+    return waveform_generator_;
+  }
+  [[nodiscard]] auto GetEmbeddingSetter() const
+      -> const Beatrice20rc0_EmbeddingSetter* {
+    return embedding_setter_;
+  }
+  [[nodiscard]] auto GetNSpeakers() const -> int { return n_speakers_; }
+  // codebook と key-value speaker embedding を半精度で保持しているか。
+  // 保持している精度の方のみ nullptr 以外を返す
+  [[nodiscard]] auto IsHalfPrecision() const -> bool {
+    return is_half_precision_;
+  }
+  // 全話者分が連続して並んでいる
+  [[nodiscard]] auto GetCodebooks() const -> const float* {
+    return codebooks_;
+  }
+  [[nodiscard]] auto GetHalfCodebooks() const -> const Float16* {
+    return half_codebooks_;
+  }
+  [[nodiscard]] auto GetAdditiveSpeakerEmbeddings() const -> const float* {
+    return additive_speaker_embeddings_;
+  }
+  [[nodiscard]] auto GetFormantShiftEmbeddings() const -> const float* {
+    return formant_shift_embeddings_;
+  }
+  [[nodiscard]] auto GetKeyValueSpeakerEmbeddings() const -> const float* {
+    return key_value_speaker_embeddings_;
+  }
+  [[nodiscard]] auto GetHalfKeyValueSpeakerEmbeddings() const
+      -> const Float16* {
+    return half_key_value_speaker_embeddings_;
+  }
+  // 話者埋め込みがキャッシュファイルからメモリマップされているか
+  [[nodiscard]] auto IsEmbeddingMapped() const -> bool {
+    return embedding_cache_.IsOpen();
+  }
+
+  // 話者埋め込みなどの領域に fn(data, bytes) を適用する
+  template <typename F>
+  void ForEachMemory(F&& fn) const {
+    const auto layout = EmbeddingLayout(n_speakers_, is_half_precision_);
+    fn(embedding_base_ + layout.codebooks, layout.additive - layout.codebooks);
+    fn(embedding_base_ + layout.additive,
+       layout.formant_shift - layout.additive);
+    fn(embedding_base_ + layout.formant_shift,
+       layout.key_value - layout.formant_shift);
+    fn(embedding_base_ + layout.key_value, layout.size - layout.key_value);
+  }
+  // 話者 speaker の codebook, additive, key-value の各領域に
+  // fn(data, bytes) を適用する
+  template <typename F>
+  void ForEachSpeakerMemory(const int speaker, F&& fn) const {
+    assert(0 <= speaker && speaker < n_speakers_);
+    const auto layout = EmbeddingLayout(n_speakers_, is_half_precision_);
+    const auto element_size =
+        is_half_precision_ ? sizeof(Float16) : sizeof(float);
+    constexpr auto kCodebookElements =
+        BEATRICE_20RC0_CODEBOOK_SIZE * BEATRICE_20RC0_PHONE_CHANNELS;
+    constexpr auto kKeyValueElements =
+        BEATRICE_20RC0_KV_LENGTH * BEATRICE_20RC0_KV_SPEAKER_EMBEDDING_CHANNELS;
+    fn(embedding_base_ + layout.codebooks +
+           speaker * element_size * kCodebookElements,
+       element_size * kCodebookElements);
+    fn(additive_speaker_embeddings_ +
+           speaker * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS,
+       sizeof(float) * BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS);
+    fn(embedding_base_ + layout.key_value +
+           speaker * element_size * kKeyValueElements,
+       element_size * kKeyValueElements);
+  }
+  // 共有しているインスタンスのうち 1 つでも固定を求めていれば、
+  // 話者埋め込みなどを物理メモリに固定しておく。
+  // 固定は重ねられないので、参照カウントで管理する
+  void AcquireMemoryLock() const {
+    const auto lock = std::lock_guard(memory_lock_mtx_);
+    if (memory_lock_count_++ == 0) {
+      // 固定できなくても、ページアウトされうるだけなので無視する
+      ForEachMemory([this](const void* const data, const std::size_t bytes) {
+        static_cast<void>(memory_lock_.Lock(data, bytes));
+      });
+    }
+  }
+  void ReleaseMemoryLock() const {
+    const auto lock = std::lock_guard(memory_lock_mtx_);
+    assert(memory_lock_count_ > 0);
+    if (--memory_lock_count_ == 0) {
+      memory_lock_.UnlockAll();
+    }
+  }
+
+ private:
+  Beatrice20rc0_PhoneExtractor* phone_extractor_;
+  Beatrice20rc0_PitchEstimator* pitch_estimator_;
+  Beatrice20rc0_WaveformGenerator* waveform_generator_;
+  Beatrice20rc0_EmbeddingSetter* embedding_setter_;
+  // キャッシュファイルの先頭に置く情報。元のファイルが変わったら作り直す
+  struct EmbeddingCacheHeader {
+    std::array<char, 8> magic;
+    std::uint32_t format_version;
+    std::int32_t n_speakers;
+    std::uint64_t source_size;
+    std::int64_t source_time;
+    // codebook と key-value が半精度か
+    std::uint32_t is_half_precision;
+    // 半精度を求められたが、表せない値があったので単精度のままにしたか
+    std::uint32_t is_incompressible;
+    // この後に元のファイルのパスが UTF-8 で続く
+    std::uint32_t source_path_length;
+  };
+  static constexpr auto kEmbeddingCacheMagic =
+      std::array<char, 8>{'B', 'T', 'R', 'C', 'E', 'M', 'B', '\0'};
+  static constexpr std::uint32_t kEmbeddingCacheFormatVersion = 3;
+  // 話者埋め込みがページ境界から始まるよう、先頭の情報はこの大きさにする
+  static constexpr std::size_t kEmbeddingCacheHeaderSize = 4096;
+  // キャッシュファイルの合計の大きさの上限。超えたら使われていないものから消す
+  static constexpr std::uintmax_t kEmbeddingCacheMaxTotalSize =
+      std::uintmax_t{2} << 30;
+  // 話者埋め込みの配置 [バイト単位]。各領域は 64 バイト境界から始まる
+  struct Layout {
+    std::size_t codebooks;
+    std::size_t additive;
+    std::size_t formant_shift;
+    std::size_t key_value;
+    std::size_t size;
+  };
+  static auto EmbeddingLayout(int n_speakers, bool half_precision) -> Layout;
+  // 話者埋め込みを読み込む。各ネットワークのパラメータとは独立に読める
+  auto LoadEmbeddings(const std::filesystem::path& directory,
+                      bool half_precision) -> ErrorCode;
+  static auto GetEmbeddingCacheFile(const std::filesystem::path& source,
+                                    bool half_precision)
+      -> std::filesystem::path;
+  // 指定した精度の有効なキャッシュファイルがあればメモリマップする。
+  // require_incompressible であれば、半精度に変換できなかったために
+  // 単精度で書き出されたものに限る
+  auto MapEmbeddingCache(const std::filesystem::path& source,
+                         bool half_precision, bool require_incompressible)
+      -> bool;
+  // embedding_storage_ の内容を、格納している精度のキャッシュファイルに
+  // 書き出し、合計の大きさが上限を超えていれば古いものを消す
+  auto WriteEmbeddingCache(const std::filesystem::path& source,
+                           bool is_incompressible) const -> bool;
+  // 単精度で読み込んだ embedding_storage_ の codebook と key-value を
+  // 半精度に変換する。半精度で表せない値があれば何もせず false を返す
+  auto CompressEmbeddings() -> bool;
+  void SetEmbeddingPointers(const std::byte* base);
+
+  int n_speakers_ = 0;
+  bool is_half_precision_ = false;
+  // 話者埋め込みは embedding_cache_ か embedding_storage_ のどちらかにあり、
+  // 以下のポインタはその中を指す
+  MappedFile embedding_cache_;
+  AlignedVector<std::byte, 64> embedding_storage_;
+  const std::byte* embedding_base_ = nullptr;
+  const float* codebooks_ = nullptr;
+  const Float16* half_codebooks_ = nullptr;
+  const float* additive_speaker_embeddings_ = nullptr;
+  const float* formant_shift_embeddings_ = nullptr;
+  const float* key_value_speaker_embeddings_ = nullptr;
+  const Float16* half_key_value_speaker_embeddings_ = nullptr;
+  mutable std::mutex memory_lock_mtx_;
+  mutable int memory_lock_count_ = 0;
+  mutable MemoryLock memory_lock_;
+};
+
 // 2.0.0-rc.0 用の信号処理クラス
 class ProcessorCore2 : public ProcessorCoreBase {
  public:
-  static constexpr int kSphAvgMaxNSpeakers = 8;
+  static constexpr int kSphAvgMaxNSpeakers = 16;
+  static constexpr unsigned int kDefaultRandomSeed = 5489U;
+  // 話者切り替え用にとっておく EmbeddingContext の最大数
+  static constexpr int kMaxVoiceCacheSize = 8;
+  static constexpr int kDefaultVoiceCacheSize = 2;
 
   explicit ProcessorCore2(const double sample_rate)
       : ProcessorCoreBase(),
         any_freq_in_out_(sample_rate),
-        phone_extractor_(Beatrice20rc0_CreatePhoneExtractor()),
-        pitch_estimator_(Beatrice20rc0_CreatePitchEstimator()),
-        waveform_generator_(Beatrice20rc0_CreateWaveformGenerator()),
-        embedding_setter_(Beatrice20rc0_CreateEmbeddingSetter()),
         gain_(),
         phone_context_(Beatrice20rc0_CreatePhoneContext1()),
         pitch_context_(Beatrice20rc0_CreatePitchContext1()),
         waveform_context_(Beatrice20rc0_CreateWaveformContext1()),
         embedding_context_(Beatrice20rc0_CreateEmbeddingContext()),
+        spare_contexts_(),
         input_gain_context_(sample_rate),
         output_gain_context_(sample_rate),
         speaker_morphing_weights_{0.0f},
         speaker_morphing_weights_pruned_{0.0f},
         speaker_morphing_weights_argsort_indices_{0},
-#if 0
-        sph_avgs_c_(),
-#else
-        speaker_morphing_codebook_lottery_engine_(std::random_device{}()),
-        speaker_morphing_codebook_lottery_(
-            speaker_morphing_weights_pruned_.begin(),
-            speaker_morphing_weights_pruned_.end()),
-#endif
+        codebook_morpher_(),
+        speaker_morphing_codebook_lottery_engine_(random_seed_),
+        speaker_morphing_codebook_lottery_(),
         sph_avg_a_(),
-        sph_avgs_k_() {
+        sph_avgs_k_(),
+        deferred_tasks_(),
+        governor_(kHopDuration),
+        calibration_pitch_context_(Beatrice20rc0_CreatePitchContext1()),
+        voice_cache_(Beatrice20rc0_CreateEmbeddingContext,
+                     Beatrice20rc0_DestroyEmbeddingContext),
+        extra_target_speakers_(),
+        extra_target_formant_shifts_{0.0},
+        extra_target_pitch_mappings_(),
+        extra_targets_(),
+        analysis_ring_() {
+    extra_target_speakers_.fill(-1);
+    pitch_worker_ = std::make_unique<ParallelWorker>();
+    // 範囲を測るため、Min/Max Source Pitch による制限は掛けない
+    Beatrice20rc0_SetMinQuantizedPitch(calibration_pitch_context_, 1);
+    Beatrice20rc0_SetMaxQuantizedPitch(calibration_pitch_context_,
+                                       BEATRICE_20RC0_PITCH_BINS - 1);
+    InitializeDeferredTasks();
+    RecreateSpareContexts();
+    const auto error_code = SetVoiceCacheSize(kDefaultVoiceCacheSize);
+    assert(error_code == ErrorCode::kSuccess);
   }
   ~ProcessorCore2() override {
-    Beatrice20rc0_DestroyPhoneExtractor(phone_extractor_);
-    Beatrice20rc0_DestroyPitchEstimator(pitch_estimator_);
-    Beatrice20rc0_DestroyWaveformGenerator(waveform_generator_);
-    Beatrice20rc0_DestroyEmbeddingSetter(embedding_setter_);
+    // モデルや状態を破棄する前にワーカーを止める
+    pipeline_.Stop();
+    for (auto&& extra : extra_targets_) {
+      extra.reset();
+    }
+    if (is_model_memory_locked_) {
+      model_->ReleaseMemoryLock();
+    }
     Beatrice20rc0_DestroyPhoneContext1(phone_context_);
     Beatrice20rc0_DestroyPitchContext1(pitch_context_);
     Beatrice20rc0_DestroyWaveformContext1(waveform_context_);
     Beatrice20rc0_DestroyEmbeddingContext(embedding_context_);
+    Beatrice20rc0_DestroyPhoneContext1(spare_contexts_.phone);
+    Beatrice20rc0_DestroyPitchContext1(spare_contexts_.pitch);
+    Beatrice20rc0_DestroyWaveformContext1(spare_contexts_.waveform);
+    Beatrice20rc0_DestroyPitchContext1(calibration_pitch_context_);
   }
   [[nodiscard]] auto GetVersion() const -> int override;
   auto Process(const float* input, float* output, int n_samples)
       -> ErrorCode override;
+  auto ProcessMultiTarget(const float* input, float* output,
+                          float* const* extra_outputs, int n_extra_outputs,
+                          int n_samples) -> ErrorCode override;
   auto ResetContext() -> ErrorCode override;
   auto LoadModel(const ModelConfig& /*config*/,
                  const std::filesystem::path& /*file*/) -> ErrorCode override;
   auto SetSampleRate(double /*sample_rate*/) -> ErrorCode override;
+  auto SetMaxBlockSize(int /*max_block_size*/) -> ErrorCode override;
+  auto WarmUp(int /*n_hops*/) -> ErrorCode override;
+  [[nodiscard]] auto GetLatencySamples() const -> int override;
+  [[nodiscard]] auto IsSilenceGated() const -> bool override { return true; }
+  [[nodiscard]] auto GetQualityTier() const -> int override;
+  [[nodiscard]] auto GetDeadlineMissCount() const -> int override;
+  [[nodiscard]] auto GetSourcePitchStatistics() const
+      -> SourcePitchStatistics override;
   auto SetTargetSpeaker(int /*target_speaker*/) -> ErrorCode override;
   auto SetFormantShift(double /*formant_shift*/) -> ErrorCode override;
   auto SetPitchShift(double /*pitch_shift*/) -> ErrorCode override;
@@ -86,14 +351,89 @@ class ProcessorCore2 : public ProcessorCoreBase {
   auto SetMinSourcePitch(double /*min_source_pitch*/) -> ErrorCode override;
   auto SetMaxSourcePitch(double /*max_source_pitch*/) -> ErrorCode override;
   auto SetVQNumNeighbors(int /*vq_num_neighbors*/) -> ErrorCode override;
+  auto SetMorphingQuality(int /*morphing_quality*/) -> ErrorCode override;
+  auto SetVoiceCacheSize(int /*voice_cache_size*/) -> ErrorCode override;
+  auto SetParallelPitchEstimation(bool /*parallel_pitch_estimation*/)
+      -> ErrorCode override;
+  auto SetPipelinedProcessing(bool /*pipelined_processing*/)
+      -> ErrorCode override;
+  auto SetSilenceThreshold(double /*silence_threshold*/)
+      -> ErrorCode override;
+  auto SetPitchCalibration(bool /*pitch_calibration*/) -> ErrorCode override;
+  auto SetAdaptiveQuality(bool /*adaptive_quality*/) -> ErrorCode override;
+  auto SetLockModelMemory(bool /*lock_model_memory*/) -> ErrorCode override;
+  auto SetHalfPrecisionEmbeddings(bool /*half_precision_embeddings*/)
+      -> ErrorCode override;
+  auto SetRandomSeed(unsigned int /*seed*/) -> ErrorCode override;
+  auto SetExtraTargetSpeaker(int /*index*/, int /*target_speaker*/)
+      -> ErrorCode override;
+  auto SetExtraTargetFormantShift(int /*index*/, double /*formant_shift*/)
+      -> ErrorCode override;
+  auto SetExtraTargetPitchShift(int /*index*/, double /*pitch_shift*/)
+      -> ErrorCode override;
   auto SetSpeakerMorphingWeight(int /*target_speaker*/,
                                 double /*morphing weight*/
                                 )      // NOLINT(whitespace/parens)
       -> ErrorCode override;
+  auto SetSpeakerMorphingWeights(std::span<const double> /*weights*/)
+      -> ErrorCode override;
 
  private:
   static constexpr int kSphAvgMaxNUpdates = 4;
-  static constexpr int kSphAvgMaxNState = 4;
+  // key-value の spherical average を 1 単位で何行ずつ計算するか
+  static constexpr int kSphAvgKeyValueRowsPerStep = 16;
+  static constexpr auto kHopDuration = std::chrono::microseconds(
+      1000000 * BEATRICE_IN_HOP_LENGTH / BEATRICE_IN_SAMPLE_RATE);
+  // 1 フレームのうち、推論と後回しにした処理に使ってよい時間。
+  // 超えるとリアルタイムで処理できなくなるので、余裕を持って半分とする
+  static constexpr auto kHopTimeBudget = kHopDuration / 2;
+  // ProcessMultiTarget() で各出力の処理を交互に進める単位 [サンプル]
+  static constexpr int kMultiTargetChunkSize = 1024;
+  // 追加の目標話者と共有する解析結果をとっておくフレーム数。
+  // 1 チャンクで揃い得るフレーム数より十分大きくする
+  static constexpr int kAnalysisRingSize = 64;
+
+  // 後回しにする処理。値が小さいものから優先して実行する
+  enum DeferredTask : std::size_t {
+    kRegisterKeyValue,
+    kSetKeyValue,
+    kSetFormantShift,
+    kMorphAdditive,
+    kMorphKeyValue,
+    kPrepareSpareContexts,
+    kPrepareExtraTargets,
+    kNDeferredTasks,
+  };
+
+  // パイプライン処理中にワーカーへ渡す設定値の置き場所。
+  // ワーカーは追加の目標話者より前のものを、この順にフレームの区切りで反映する。
+  // 追加の目標話者はパイプライン処理中は処理しないので、止めたときに反映する
+  enum StateSlot : std::size_t {
+    kStateVoiceCacheSize,
+    kStatePipelinedProcessing,
+    kStatePitchCalibration,
+    kStateAdaptiveQuality,
+    kStateRandomSeed,
+    kStateMorphingQuality,
+    kStateTargetSpeaker,
+    kStateFormantShift,
+    kStatePitchShift,
+    kStateAverageSourcePitch,
+    kStateIntonationIntensity,
+    kStatePitchCorrection,
+    kStatePitchCorrectionType,
+    kStateMinSourcePitch,
+    kStateMaxSourcePitch,
+    kStateVQNumNeighbors,
+    kStateSilenceThreshold,
+    kStateSpeakerMorphingWeight,
+    kStateExtraTargetSpeaker = kStateSpeakerMorphingWeight + kMaxNSpeakers,
+    kStateExtraTargetFormantShift =
+        kStateExtraTargetSpeaker + kMaxNExtraTargets,
+    kStateExtraTargetPitchShift =
+        kStateExtraTargetFormantShift + kMaxNExtraTargets,
+    kNStateSlots = kStateExtraTargetPitchShift + kMaxNExtraTargets,
+  };
 
   class ConvertWithModelBlockSize {
    public:
@@ -102,38 +442,82 @@ class ProcessorCore2 : public ProcessorCoreBase {
                     ProcessorCore2& processor_core) const {
       processor_core.Process1(input, output);
     }
+    void Batch(const float* const input, float* const output,
+               const int n_hops, ProcessorCore2& processor_core) const {
+      processor_core.ProcessBatch(input, output, n_hops);
+    }
+    // 追加の目標話者の処理
+    void operator()(const float* const input, float* const output,
+                    ProcessorCore2& processor_core, const int index) const {
+      processor_core.ProcessExtraBatch(input, output, 1, index);
+    }
+    void Batch(const float* const input, float* const output,
+               const int n_hops, ProcessorCore2& processor_core,
+               const int index) const {
+      processor_core.ProcessExtraBatch(input, output, n_hops, index);
+    }
   };
+  using AnyFreqInOut = resampler::AnyFreqInOut<ConvertWithModelBlockSize>;
 
   std::filesystem::path model_file_;
   int target_speaker_ = 0;
   int formant_shift_ = 0;
-  double pitch_shift_ = 0.0;
   int n_speakers_ = 0;
-  double average_source_pitch_ = 52.0;
-  double intonation_intensity_ = 1.0;
-  double pitch_correction_ = 0.0;
-  int pitch_correction_type_ = 0;
   double min_source_pitch_ = 33.125;
   double max_source_pitch_ = 80.875;
   int vq_num_neighbors_ = 0;
+  unsigned int random_seed_ = kDefaultRandomSeed;
 
-  resampler::AnyFreqInOut<ConvertWithModelBlockSize> any_freq_in_out_;
+  AnyFreqInOut any_freq_in_out_;
+  PitchMapping<BEATRICE_20RC0_PITCH_BINS> pitch_mapping_;
 
-  // モデル
-  Beatrice20rc0_PhoneExtractor* phone_extractor_;
-  Beatrice20rc0_PitchEstimator* pitch_estimator_;
-  Beatrice20rc0_WaveformGenerator* waveform_generator_;
-  Beatrice20rc0_EmbeddingSetter* embedding_setter_;
-  AlignedVector<float, 64> codebooks_;
-  AlignedVector<float, 64> additive_speaker_embeddings_;
-  AlignedVector<float, 64> formant_shift_embeddings_;
-  AlignedVector<float, 64> key_value_speaker_embeddings_;
+  // モデル。同じモデルを読み込んだ他のインスタンスと共有する。
+  // 以下のポインタは model_ の持つものを指す
+  std::shared_ptr<const ProcessorCore2Model> model_;
+  const Beatrice20rc0_PhoneExtractor* phone_extractor_ = nullptr;
+  const Beatrice20rc0_PitchEstimator* pitch_estimator_ = nullptr;
+  const Beatrice20rc0_WaveformGenerator* waveform_generator_ = nullptr;
+  const Beatrice20rc0_EmbeddingSetter* embedding_setter_ = nullptr;
+  // モーフィング結果。話者番号 n_speakers_ として扱う。
+  // codebook の結果は codebook_morpher_ が持つ
+  AlignedVector<float, 64> morphed_additive_speaker_embedding_;
+  AlignedVector<float, 64> morphed_key_value_speaker_embedding_;
+  // 次に読み込むモデルの codebook と key-value を半精度で保持するか
+  bool is_half_precision_embedding_enabled_ = false;
+  // 半精度で保持している codebook を単精度に戻したもの。
+  // Beatrice20rc0_SetCodebook() に渡した codebook は参照され続けるので、
+  // 設定先の PhoneContext1 ごとに持ち、戻した話者を覚えておく
+  struct WidenedCodebook {
+    AlignedVector<float, 64> data;
+    int speaker = -1;
+  };
+  // phone_context_ 用
+  WidenedCodebook widened_codebook_;
+  // 半精度の key-value speaker embedding を登録の直前に単精度に戻す一時領域。
+  // 登録の際にコピーされるので 1 つでよい
+  AlignedVector<float, 64> widened_key_value_speaker_embedding_;
   Gain gain_;
   // 状態
   Beatrice20rc0_PhoneContext1* phone_context_;
   Beatrice20rc0_PitchContext1* pitch_context_;
   Beatrice20rc0_WaveformContext1* waveform_context_;
   Beatrice20rc0_EmbeddingContext* embedding_context_;
+  // embedding_context_ に key-value speaker embedding が登録済みの話者。
+  // 登録前であれば -1
+  int embedding_context_speaker_ = -1;
+  // ResetContext() ですぐに差し替えられるよう、
+  // 未使用の状態を 1 組作っておく
+  struct SpareContexts {
+    Beatrice20rc0_PhoneContext1* phone = nullptr;
+    Beatrice20rc0_PitchContext1* pitch = nullptr;
+    Beatrice20rc0_WaveformContext1* waveform = nullptr;
+    // 一度も推論に使われていないか
+    bool is_fresh = false;
+    // waveform に key-value speaker embedding を設定中の話者。無ければ -1
+    int key_value_speaker = -1;
+    int key_value_set_count = 0;
+  };
+  SpareContexts spare_contexts_;
   Gain::Context input_gain_context_;
   Gain::Context output_gain_context_;
   int key_value_speaker_embedding_set_count_ = 0;
@@ -143,13 +527,20 @@ class ProcessorCore2 : public ProcessorCoreBase {
   std::array<float, kMaxNSpeakers> speaker_morphing_weights_;
   std::array<float, kMaxNSpeakers> speaker_morphing_weights_pruned_;
   std::array<int, kMaxNSpeakers> speaker_morphing_weights_argsort_indices_;
-  int speaker_morphing_state_counter_ = INT_MAX;
-#if 0
-  std::array<SphericalAverage<float>, BEATRICE_20RC0_CODEBOOK_SIZE> sph_avgs_c_;
-#elif 1
+  int speaker_morphing_key_value_row_ = 0;
+  MorphingQuality morphing_quality_ = MorphingQuality::kExact;
+  // 現在の重みについて、key-value と codebook を線形ブレンドで近似するか
+  bool is_morphing_approximate_ = false;
+  // codebook の spherical average はワーカースレッドで計算する
+  CodebookMorpher<BEATRICE_20RC0_CODEBOOK_SIZE, BEATRICE_20RC0_PHONE_CHANNELS,
+                  kSphAvgMaxNSpeakers>
+      codebook_morpher_;
+  bool is_codebook_morphing_requested_ = false;
+  // 最初のモーフィング結果が計算されるまでは、
+  // 重みを抽選確率として用いてフレームごとに話者の codebook を抽選する。
+  // 抽選表は重みの更新時にだけ作り直す
   std::mt19937 speaker_morphing_codebook_lottery_engine_;
-  std::discrete_distribution<int> speaker_morphing_codebook_lottery_;
-#endif
+  AliasTable<kSphAvgMaxNSpeakers> speaker_morphing_codebook_lottery_;
   SphericalAverage<float, BEATRICE_WAVEFORM_GENERATOR_HIDDEN_CHANNELS>
       sph_avg_a_;
   std::array<
@@ -157,8 +548,186 @@ class ProcessorCore2 : public ProcessorCoreBase {
       BEATRICE_20RC0_KV_LENGTH>
       sph_avgs_k_;
 
+  DeferredTaskScheduler<kNDeferredTasks> deferred_tasks_;
+  // 推論にかかった時間を測り、負荷に応じて品質を下げる
+  CpuGovernor governor_;
+  // 統計専用のピッチ推定の状態。オーディオスレッドで作らずに済むよう、
+  // 常に作っておく。統計を取るのは推論と同じスレッドで、
+  // パイプライン処理中の切り替えは state_mailbox_ を介して行う
+  Beatrice20rc0_PitchContext1* calibration_pitch_context_;
+  PitchCalibrator<BEATRICE_20RC0_PITCH_BINS> pitch_calibrator_;
+  bool is_pitch_calibrating_ = false;
+  // 有効であれば、話者埋め込みなどを物理メモリに固定しておく。
+  // 共有している分は model_ 側で固定する。固定は LoadModel() で行う
+  bool is_model_memory_lock_enabled_ = false;
+  bool is_model_memory_locked_ = false;
+  MemoryLock model_memory_lock_;
+
+  // ピッチ推定を並行して行うワーカー。
+  // オーディオスレッドでスレッドを作らずに済むよう、常に作っておき、
+  // 使うかどうかはフラグだけで切り替える
+  std::unique_ptr<ParallelWorker> pitch_worker_;
+  std::atomic<bool> is_parallel_pitch_estimation_enabled_ = false;
+  struct PitchJob {
+    const float* input = nullptr;
+    int n_hops = 0;
+    int* quantized_pitch = nullptr;
+    float* pitch_feature = nullptr;
+  };
+  PitchJob pitch_job_;
+
+  // パイプライン処理では推論を専用のワーカースレッドで行う。
+  // その間の設定の変更は state_mailbox_ を介してワーカーに渡し、
+  // オーディオスレッドが推論の状態に触れないようにする
+  using Pipeline =
+      PipelineDriver<BEATRICE_IN_HOP_LENGTH, BEATRICE_OUT_HOP_LENGTH>;
+  static_assert(Pipeline::Pipeline::kMaxBatchSize <=
+                resampler::kMaxNBatchBlocks);
+  Pipeline pipeline_;
+  int max_block_size_ = 0;
+  StateMailbox<kNStateSlots> state_mailbox_;
+
+  // 最近使った話者の key-value speaker embedding を登録済みの
+  // EmbeddingContext をとっておき、切り替え時の登録を省略する
+  VoiceCache<Beatrice20rc0_EmbeddingContext, kMaxVoiceCacheSize> voice_cache_;
+
+  // 無音区間の推論の省略
+  SilenceGate<BEATRICE_IN_HOP_LENGTH> silence_gate_;
+
+  // 追加の目標話者。
+  // ピッチ推定の結果と、VQ を使わない場合は音素抽出の結果も
+  // メインの出力と共有し、波形生成のみを話者ごとに行う。
+  // 設定値はモデルの読み込み前でも保持しておく
+  std::array<int, kMaxNExtraTargets> extra_target_speakers_;
+  std::array<double, kMaxNExtraTargets> extra_target_formant_shifts_;
+  std::array<PitchMapping<BEATRICE_20RC0_PITCH_BINS>, kMaxNExtraTargets>
+      extra_target_pitch_mappings_;
+  class ExtraTarget {
+   public:
+    // 入力のフレームの区切りがメインと揃うよう、リサンプラーは状態ごと複製する
+    ExtraTarget(const AnyFreqInOut& any_freq_in_out,
+                const Gain::Context& output_gain_context,
+                const std::int64_t hop_count, const unsigned int random_seed)
+        : any_freq_in_out(any_freq_in_out),
+          output_gain_context(output_gain_context),
+          phone_context(Beatrice20rc0_CreatePhoneContext1()),
+          waveform_context(Beatrice20rc0_CreateWaveformContext1()),
+          embedding_context(Beatrice20rc0_CreateEmbeddingContext()),
+          codebook_lottery_engine(random_seed),
+          hop_count(hop_count) {}
+    ~ExtraTarget() {
+      Beatrice20rc0_DestroyPhoneContext1(phone_context);
+      Beatrice20rc0_DestroyWaveformContext1(waveform_context);
+      Beatrice20rc0_DestroyEmbeddingContext(embedding_context);
+    }
+    ExtraTarget(const ExtraTarget&) = delete;
+    auto operator=(const ExtraTarget&) -> ExtraTarget& = delete;
+
+    AnyFreqInOut any_freq_in_out;
+    Gain::Context output_gain_context;
+    Beatrice20rc0_PhoneContext1* phone_context;
+    Beatrice20rc0_WaveformContext1* waveform_context;
+    Beatrice20rc0_EmbeddingContext* embedding_context;
+    // phone_context に設定済みの codebook とその話者
+    const float* codebook = nullptr;
+    int codebook_speaker = -1;
+    WidenedCodebook widened_codebook;
+    // モーフィング結果が届くまで codebook の抽選に使う
+    std::mt19937 codebook_lottery_engine;
+    // 次に処理するフレームの通し番号
+    std::int64_t hop_count;
+    // embedding_context に key-value speaker embedding を登録済みの話者。
+    // 登録前であれば -1
+    int embedding_speaker = -1;
+    // additive と formant shift の embedding を設定済みか
+    bool is_embedding_set = false;
+    int key_value_set_count = 0;
+    // 全ての embedding が一度揃うまでは無音を出力する
+    bool is_ready = false;
+  };
+  std::array<std::unique_ptr<ExtraTarget>, kMaxNExtraTargets> extra_targets_;
+  // メインの推論で得た解析結果。hop_count_ を通し番号として
+  // kAnalysisRingSize フレーム分をリングバッファに保持する
+  struct Analysis {
+    std::int64_t seq = -1;
+    alignas(64) std::array<float, BEATRICE_20RC0_PHONE_CHANNELS> phone;
+    // ピッチシフトなどを適用する前の量子化ピッチ
+    int quantized_pitch;
+    std::array<float, 4> pitch_feature;
+  };
+  std::array<Analysis, kAnalysisRingSize> analysis_ring_;
+  // メインの入力のフレームの通し番号
+  std::int64_t hop_count_ = 0;
+  alignas(64) std::array<float, kMultiTargetChunkSize> multi_target_input_;
+  alignas(64) std::array<float, kMultiTargetChunkSize> multi_target_scratch_;
+
   auto IsLoaded() -> bool { return !model_file_.empty(); }
   void Process1(const float* input, float* output);
+  void ProcessBatch(const float* input, float* output, int n_hops);
+  // 無音のフレームを省略しながら推論する。
+  // first_seq が非負であれば、解析結果を analysis_ring_ に記録する
+  void InferGated(const float* input, float* output, int n_hops,
+                  std::int64_t first_seq);
+  // first_seq が非負であれば、解析結果を analysis_ring_ に記録する。
+  // is_pre_roll であれば、後回しにした処理は進めない
+  void Infer(const float* input, float* output, int n_hops,
+             std::int64_t first_seq, bool is_pre_roll = false);
+  void ProcessExtraBatch(const float* input, float* output, int n_hops,
+                         int index);
+  [[nodiscard]] auto HasExtraTargets() const -> bool;
+  // メインか追加の目標話者がモーフィング結果の codebook を使うか
+  [[nodiscard]] auto IsMorphedCodebookUsed() const -> bool;
+  // extra_target_speakers_[index] の設定を extra_targets_ に反映する
+  auto UpdateExtraTarget(int index) -> ErrorCode;
+  void ResetExtraTargetContexts(ExtraTarget& extra) const;
+  // 話者 speaker を使う追加の目標話者の embedding を設定し直す
+  void InvalidateExtraTargets(int speaker, bool is_key_value_changed);
+  void RestartPipeline();
+  // ワーカーを止め、届いている設定を全て反映する
+  void StopPipeline();
+  // パイプライン処理の有効・無効の変更を反映する。オーディオスレッドから呼ぶ
+  void UpdatePipelineMode();
+  // パイプライン処理中に進めなかった追加の目標話者の入出力を、メインに揃える
+  void SyncExtraTargetsWithMain();
+  // ワーカーが動いていれば value を slot に置いて true を返す。
+  // このとき設定の反映はワーカーに任せる
+  auto PostState(StateSlot slot, double value) -> bool;
+  // state_mailbox_ に届いている設定を反映する
+  void ApplyPostedState();
+  void EstimatePitch();
+  // 推論を行わず、ピッチ推定の結果を pitch_calibrator_ に加える
+  void CalibratePitch(const float* input, int n_hops);
+  void InitializeDeferredTasks();
+  // governor_ の段階を各処理に反映する
+  void ApplyQualityTier();
+  // 品質の段階を考慮した、実際に使う VQ の近傍数
+  [[nodiscard]] auto GetEffectiveVQNumNeighbors() const -> int;
+  // embedding_context_ を new_speaker 用のものに切り替える。
+  // new_speaker の key-value speaker embedding が登録済みであれば true を返す
+  auto AcquireEmbeddingContext(int new_speaker) -> bool;
+  void InvalidateVoiceCache(int speaker);
+  void RecreateSpareContexts();
+  void SetFormantShiftEmbedding();
+  // speaker_morphing_weights_ から上位の話者を選び、モーフィングをやり直す
+  void UpdateSpeakerMorphingWeights();
+  // 話者 speaker の各埋め込み。speaker が n_speakers_ であればモーフィング結果。
+  // 半精度で保持している codebook は widened に戻して返す。
+  // codebook のモーフィング結果がまだ無ければ、最も重みの大きい話者のものを返す
+  auto GetCodebook(int speaker, WidenedCodebook& widened) const
+      -> const float*;
+  [[nodiscard]] auto GetAdditiveSpeakerEmbedding(int speaker) const
+      -> const float*;
+  // 半精度で保持している場合、返す領域は次に呼ぶまで有効
+  auto GetKeyValueSpeakerEmbedding(int speaker) -> const float*;
+  [[nodiscard]] auto GetFormantShiftEmbedding(int formant_index) const
+      -> const float*;
+  // 話者 speaker の埋め込みの各領域に fn(data, bytes) を適用する
+  template <typename F>
+  void ForEachSpeakerMemory(int speaker, F&& fn) const;
+  // メモリマップされた話者埋め込みの読み込みを前もって OS に依頼する
+  void PrefetchSpeaker(int speaker) const;
+  void UpdateModelMemoryLock();
+  void UnlockModelMemory();
 
   // Key-value speaker embedding を 1 ブロック設定する。
   // 既に全ブロック設定済みであれば何も処理を行わず false を返す。
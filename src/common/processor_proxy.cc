@@ -2,6 +2,18 @@
 
 #include "common/processor_proxy.h"
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <utility>
+#include <variant>
+
+#include "common/model_bundle.h"
+
 namespace beatrice::common {
 
 auto ProcessorProxy::GetParameter(const ParameterID param_id) const -> const
@@ -9,6 +21,294 @@ auto ProcessorProxy::GetParameter(const ParameterID param_id) const -> const
   return parameter_state_.GetValue(param_id);
 }
 
+auto ProcessorProxy::SetSampleRate(const double new_sample_rate) -> ErrorCode {
+  sample_rate_ = new_sample_rate;
+  if (is_model_loading_) {
+    // 読み込み中の ProcessorCore は古い設定で作られているので、依頼し直す
+    if (const auto err = SyncParameter(ParameterID::kModel);
+        err != ErrorCode::kSuccess) {
+      return err;
+    }
+  }
+  return core_->SetSampleRate(sample_rate_);
+}
+
+auto ProcessorProxy::SetMaxBlockSize(const int new_max_block_size)
+    -> ErrorCode {
+  max_block_size_ = new_max_block_size;
+  // クロスフェード用の領域はオーディオスレッドの外で確保しておく
+  crossfade_buffer_.resize(max_block_size_);
+  if (is_model_loading_) {
+    if (const auto err = SyncParameter(ParameterID::kModel);
+        err != ErrorCode::kSuccess) {
+      return err;
+    }
+  }
+  return core_->SetMaxBlockSize(max_block_size_);
+}
+
+auto ProcessorProxy::LoadModel(const std::filesystem::path& file)
+    -> ErrorCode {
+  if (is_offline_ || !is_active_) {
+    // 読み込みを待っても音は途切れないので、古いモデルや無音を出力しないよう
+    // その場で読み込む
+    if (core_loader_) {
+      core_loader_->Cancel();
+    }
+    is_model_loading_ = false;
+    auto error = ErrorCode::kSuccess;
+    auto core = PrepareCore(file, sample_rate_, max_block_size_,
+                            parameter_state_, error);
+    fading_core_.reset();
+    crossfade_position_ = kCrossfadeSamples;
+    core_ = std::move(core);
+    model_load_error_ = error;
+    return error;
+  }
+  if (!core_loader_) {
+    core_loader_ = std::make_unique<CoreLoader>();
+  }
+  is_model_loading_ = true;
+  // 読み込みの後も、受け取られるまではバックグラウンドのスレッドで
+  // 同じ ParameterState に変更を反映し続ける
+  auto parameter_state = std::make_shared<ParameterState>(parameter_state_);
+  core_loader_->Request(
+      [file, sample_rate = sample_rate_, max_block_size = max_block_size_,
+       parameter_state](ErrorCode& error) {
+        return PrepareCore(file, sample_rate, max_block_size,
+                           *parameter_state, error);
+      },
+      [this, parameter_state](std::unique_ptr<ProcessorCoreBase>& core) {
+        ApplyPostedParameters(loading_parameter_mailbox_, *parameter_state,
+                              core);
+      });
+  return ErrorCode::kSuccess;
+}
+
+auto ProcessorProxy::PrepareCore(const std::filesystem::path& file,
+                                 const double sample_rate,
+                                 const int max_block_size,
+                                 const ParameterState& parameter_state,
+                                 ErrorCode& error)
+    -> std::unique_ptr<ProcessorCoreBase> {
+  error = ErrorCode::kSuccess;
+  // モデルが選ばれていないのはエラーではない
+  if (file.empty()) {
+    return std::make_unique<ProcessorCoreUnloaded>();
+  }
+  if (!std::filesystem::exists(file)) {
+    error = ErrorCode::kFileOpenError;
+    return std::make_unique<ProcessorCoreUnloaded>();
+  }
+  // モデルバンドルであれば展開したものを読む
+  auto config_file = std::filesystem::path();
+  if (const auto err = ResolveModelFile(file, config_file);
+      err != ErrorCode::kSuccess) {
+    error = err;
+    return std::make_unique<ProcessorCoreUnloaded>();
+  }
+  auto core = std::unique_ptr<ProcessorCoreBase>();
+  try {
+    const auto toml_data = toml::parse(config_file);
+    const auto model_config = toml::get<ModelConfig>(toml_data);
+    switch (model_config.model.VersionInt()) {
+      case 0:
+        core = std::make_unique<ProcessorCore0>(sample_rate);
+        break;
+      case 1:
+        core = std::make_unique<ProcessorCore1>(sample_rate);
+        break;
+      case 2:
+        core = std::make_unique<ProcessorCore2>(sample_rate);
+        break;
+      default:
+        error = ErrorCode::kUnknownError;
+        return std::make_unique<ProcessorCoreUnloaded>();
+    }
+    // 話者埋め込みの精度とメモリの固定は読み込み時に決まるので、先に設定する
+    const auto half_precision_embeddings =
+        std::get<int>(parameter_state.GetValue(
+            ParameterID::kHalfPrecisionEmbeddings)) != 0;
+    const auto lock_model_memory =
+        std::get<int>(
+            parameter_state.GetValue(ParameterID::kLockModelMemory)) != 0;
+    if (error = core->SetMaxBlockSize(max_block_size);
+        error == ErrorCode::kSuccess) {
+      error = core->SetHalfPrecisionEmbeddings(half_precision_embeddings);
+    }
+    if (error == ErrorCode::kSuccess) {
+      error = core->SetLockModelMemory(lock_model_memory);
+    }
+    if (error == ErrorCode::kSuccess) {
+      error = core->LoadModel(model_config, config_file);
+    }
+    if (error != ErrorCode::kSuccess) {
+      return std::make_unique<ProcessorCoreUnloaded>();
+    }
+  } catch (const toml::file_io_error&) {
+    error = ErrorCode::kFileOpenError;
+    return std::make_unique<ProcessorCoreUnloaded>();
+  } catch (const toml::syntax_error&) {
+    error = ErrorCode::kTOMLSyntaxError;
+    return std::make_unique<ProcessorCoreUnloaded>();
+  } catch (const std::exception&) {
+    error = ErrorCode::kUnknownError;
+    return std::make_unique<ProcessorCoreUnloaded>();
+  }
+
+  // 依頼した時点のパラメータを反映する。
+  // その後の変更は ApplyPostedParameters() で反映される
+  auto proxy = ProcessorProxy(parameter_state, std::move(core));
+  static_cast<void>(proxy.SyncAllParameters(ParameterID::kModel));
+  // 音声処理に使われる前に、最初のフレームが遅れないよう温めておく
+  static_cast<void>(proxy.core_->WarmUp(static_cast<int>(std::round(
+      std::get<double>(parameter_state.GetValue(ParameterID::kWarmUpHops))))));
+  return std::move(proxy.core_);
+}
+
+void ProcessorProxy::ApplyPostedParameters(
+    ParameterMailbox& mailbox, ParameterState& parameter_state,
+    std::unique_ptr<ProcessorCoreBase>& core) {
+  if (!mailbox.BeginTake()) {
+    return;
+  }
+  auto proxy = ProcessorProxy(parameter_state, std::move(core));
+  proxy.BeginParameterBatch();
+  for (const auto& [param_id, param] : kSchema) {
+    auto value = 0.0;
+    if (!mailbox.Take(static_cast<std::size_t>(param_id), value)) {
+      continue;
+    }
+    if (std::holds_alternative<NumberParameter>(param)) {
+      static_cast<void>(proxy.SetParameter(param_id, value));
+    } else if (std::holds_alternative<ListParameter>(param)) {
+      static_cast<void>(
+          proxy.SetParameter(param_id, static_cast<int>(value)));
+    }
+  }
+  static_cast<void>(proxy.EndParameterBatch());
+  parameter_state = proxy.parameter_state_;
+  core = std::move(proxy.core_);
+}
+
+void ProcessorProxy::PublishLoadedCore() {
+  if (!core_loader_) {
+    return;
+  }
+  if (fading_core_) {
+    if (crossfade_position_ < kCrossfadeSamples ||
+        !core_loader_->Retire(fading_core_)) {
+      return;
+    }
+  }
+  // 差し替えた古い ProcessorCore を確実に手放せるときだけ差し替える
+  if (!is_model_loading_ || !core_loader_->CanRetire()) {
+    return;
+  }
+  auto error = ErrorCode::kSuccess;
+  auto core = core_loader_->TakeLoadedCore(error);
+  if (!core) {
+    return;
+  }
+  is_model_loading_ = false;
+  model_load_error_ = error;
+  fading_core_ = std::move(core_);
+  core_ = std::move(core);
+  // モデルが無かった場合はクロスフェードしない
+  crossfade_position_ =
+      fading_core_->GetVersion() < 0 ? kCrossfadeSamples : 0;
+
+  // バックグラウンドのスレッドが最後に反映した後の変更だけを反映する。
+  // 変更のたびに Wake() で反映させているので、残るのは受け渡しの直前の
+  // ものだけになる。届くのは数値とリストのパラメータのみで、それらの
+  // setter は通常の SetParameter() と同じくオーディオスレッドから呼べる。
+  // 重い処理が要るものは記録だけして、読み込み時か別のスレッドで反映する
+  if (!loading_parameter_mailbox_.BeginTake()) {
+    return;
+  }
+  BeginParameterBatch();
+  for (const auto& [param_id, param] : kSchema) {
+    auto value = 0.0;
+    if (loading_parameter_mailbox_.Take(static_cast<std::size_t>(param_id),
+                                        value)) {
+      static_cast<void>(SyncParameter(param_id));
+    }
+  }
+  static_cast<void>(EndParameterBatch());
+}
+
+auto ProcessorProxy::ProcessMultiTarget(const float* const input,
+                                        float* const output,
+                                        float* const* const extra_outputs,
+                                        const int n_extra_outputs,
+                                        const int n_samples) -> ErrorCode {
+  const auto chunk_size = static_cast<int>(crossfade_buffer_.size());
+  if (fading_core_ && chunk_size == 0) {
+    crossfade_position_ = kCrossfadeSamples;
+  }
+  auto error_code = ErrorCode::kSuccess;
+  auto offset = 0;
+  auto chunk_extra_outputs = std::array<float*, kMaxNExtraTargets>();
+  const auto n_chunk_extra_outputs =
+      std::min(n_extra_outputs, kMaxNExtraTargets);
+  const auto offset_extra_outputs = [&] {
+    for (auto i = 0; i < n_chunk_extra_outputs; ++i) {
+      chunk_extra_outputs[i] =
+          extra_outputs[i] == nullptr ? nullptr : extra_outputs[i] + offset;
+    }
+  };
+  // クロスフェード中は crossfade_buffer_ に収まる長さずつ処理する
+  while (offset < n_samples && fading_core_ &&
+         crossfade_position_ < kCrossfadeSamples) {
+    const auto n = std::min(n_samples - offset, chunk_size);
+    offset_extra_outputs();
+    if (const auto err =
+            ProcessCrossfade(input + offset, output + offset,
+                             chunk_extra_outputs.data(),
+                             n_chunk_extra_outputs, n);
+        err != ErrorCode::kSuccess) {
+      error_code = err;
+    }
+    offset += n;
+  }
+  if (offset == 0) {
+    return core_->ProcessMultiTarget(input, output, extra_outputs,
+                                     n_extra_outputs, n_samples);
+  }
+  if (offset < n_samples) {
+    offset_extra_outputs();
+    if (const auto err = core_->ProcessMultiTarget(
+            input + offset, output + offset, chunk_extra_outputs.data(),
+            n_chunk_extra_outputs, n_samples - offset);
+        err != ErrorCode::kSuccess) {
+      error_code = err;
+    }
+  }
+  return error_code;
+}
+
+auto ProcessorProxy::ProcessCrossfade(const float* const input,
+                                      float* const output,
+                                      float* const* const extra_outputs,
+                                      const int n_extra_outputs,
+                                      const int n_samples) -> ErrorCode {
+  // 入力と出力は同じ領域のことがあるので、古い方は複製した入力で処理する
+  std::copy_n(input, n_samples, crossfade_buffer_.data());
+  static_cast<void>(fading_core_->Process(
+      crossfade_buffer_.data(), crossfade_buffer_.data(), n_samples));
+  const auto error_code = core_->ProcessMultiTarget(
+      input, output, extra_outputs, n_extra_outputs, n_samples);
+  const auto n_fade =
+      std::min(n_samples, kCrossfadeSamples - crossfade_position_);
+  for (auto i = 0; i < n_fade; ++i) {
+    const auto t = static_cast<float>(crossfade_position_ + i) /
+                   static_cast<float>(kCrossfadeSamples);
+    output[i] = t * output[i] + (1.0f - t) * crossfade_buffer_[i];
+  }
+  crossfade_position_ += n_fade;
+  return error_code;
+}
+
 auto ProcessorProxy::SyncParameter(const ParameterID param_id) -> ErrorCode {
   const auto& parameter = kSchema.GetParameter(param_id);
   if (const auto* const number_parameter =
@@ -33,6 +333,7 @@ auto ProcessorProxy::SyncParameter(const ParameterID param_id) -> ErrorCode {
 auto ProcessorProxy::SyncAllParameters(const ParameterID ignore_param_id)
     -> ErrorCode {
   auto error_code = ErrorCode::kSuccess;
+  BeginParameterBatch();
   for (const auto& [param_id, param] : kSchema) {
     if (param_id == ignore_param_id) {
       continue;
@@ -41,11 +342,48 @@ auto ProcessorProxy::SyncAllParameters(const ParameterID ignore_param_id)
       error_code = err;
     }
   }
+  if (const auto err = EndParameterBatch(); err != ErrorCode::kSuccess) {
+    error_code = err;
+  }
   return error_code;
 }
 
+auto ProcessorProxy::EndParameterBatch() -> ErrorCode {
+  assert(parameter_batch_depth_ > 0);
+  if (--parameter_batch_depth_ > 0 || !is_speaker_morphing_weights_dirty_) {
+    return ErrorCode::kSuccess;
+  }
+  return SyncSpeakerMorphingWeights();
+}
+
+auto ProcessorProxy::SyncSpeakerMorphingWeights() -> ErrorCode {
+  if (parameter_batch_depth_ > 0) {
+    is_speaker_morphing_weights_dirty_ = true;
+    return ErrorCode::kSuccess;
+  }
+  is_speaker_morphing_weights_dirty_ = false;
+  auto weights = std::array<double, kMaxNSpeakers>();
+  for (auto i = 0; i < kMaxNSpeakers; ++i) {
+    weights[i] = std::get<double>(GetParameter(static_cast<ParameterID>(
+        static_cast<int>(ParameterID::kVoiceMorphWeights) + i)));
+  }
+  return core_->SetSpeakerMorphingWeights(weights);
+}
+
 auto ProcessorProxy::Read(std::istream& is) -> ErrorCode {
   const auto error_code_read = parameter_state_.ReadOrSetDefault(is, kSchema);
+  // SetParameter() を経ずに変わった値も、読み込み中の ProcessorCore に
+  // 渡るように、最新の値を入れ直す
+  for (const auto& [param_id, param] : kSchema) {
+    const auto& value = parameter_state_.GetValue(param_id);
+    if (const auto* const number = std::get_if<double>(&value)) {
+      loading_parameter_mailbox_.Post(static_cast<std::size_t>(param_id),
+                                      *number);
+    } else if (const auto* const index = std::get_if<int>(&value)) {
+      loading_parameter_mailbox_.Post(static_cast<std::size_t>(param_id),
+                                      static_cast<double>(*index));
+    }
+  }
   const auto error_code_sync = SyncAllParameters();
   return error_code_read == ErrorCode::kSuccess ? error_code_sync
                                                 : error_code_read;
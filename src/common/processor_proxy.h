@@ -3,8 +3,15 @@
 #ifndef BEATRICE_COMMON_PROCESSOR_PROXY_H_
 #define BEATRICE_COMMON_PROCESSOR_PROXY_H_
 
+#include <cstddef>
+#include <filesystem>
 #include <memory>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
 
+#include "common/core_loader.h"
 #include "common/error.h"
 #include "common/model_config.h"
 #include "common/parameter_schema.h"
@@ -13,6 +20,7 @@
 #include "common/processor_core_0.h"
 #include "common/processor_core_1.h"
 #include "common/processor_core_2.h"
+#include "common/state_mailbox.h"
 
 namespace beatrice::common {
 
@@ -21,68 +29,69 @@ namespace beatrice::common {
 // パラメータの変更は kSchema で定められた ID を介して行う。
 class ProcessorProxy {
  public:
-  explicit ProcessorProxy(const ParameterSchema& schema) : sample_rate_() {
+  // モデルの読み込み後、新旧の ProcessorCore の出力をクロスフェードする長さ
+  static constexpr int kCrossfadeSamples = 1024;
+
+  explicit ProcessorProxy(const ParameterSchema& schema)
+      : sample_rate_(), max_block_size_() {
     parameter_state_.SetDefaultValues(schema);
     core_ = std::make_unique<ProcessorCoreUnloaded>();
   }
   explicit ProcessorProxy(const ParameterState& parameter_state)
-      : sample_rate_(), parameter_state_(parameter_state) {
+      : sample_rate_(), max_block_size_(), parameter_state_(parameter_state) {
+    core_ = std::make_unique<ProcessorCoreUnloaded>();
     auto error_code = SyncAllParameters();
     assert(error_code == ErrorCode::kSuccess);
   }
   [[nodiscard]] auto GetSampleRate() const -> double { return sample_rate_; }
-  auto SetSampleRate(const double new_sample_rate) -> ErrorCode {
-    sample_rate_ = new_sample_rate;
-    return core_->SetSampleRate(sample_rate_);
-  }
+  auto SetSampleRate(double new_sample_rate) -> ErrorCode;
+  auto SetMaxBlockSize(int new_max_block_size) -> ErrorCode;
+  // 以下の 2 つのいずれかが成り立つ間は、モデルを同期的に読み込む
+  void SetOfflineProcessing(bool is_offline) { is_offline_ = is_offline; }
+  void SetActive(bool is_active) { is_active_ = is_active; }
   [[nodiscard]] auto GetParameter(ParameterID param_id) const -> const auto&;
   template <typename T>
   auto SetParameter(const ParameterID param_id, const T& value) -> ErrorCode {
     parameter_state_.SetValue(param_id, value);
-    return SyncParameter(param_id);
-  }
-  auto LoadModel(const std::filesystem::path& file) -> ErrorCode {
-    auto error_code = ErrorCode::kSuccess;
-    if (!std::filesystem::exists(file)) {
-      error_code = ErrorCode::kFileOpenError;
-      goto fail;
-    }
-    try {
-      const auto toml_data = toml::parse(file);
-      const auto model_config = toml::get<ModelConfig>(toml_data);
-      switch (model_config.model.VersionInt()) {
-        case 0:
-          core_ = std::make_unique<ProcessorCore0>(sample_rate_);
-          break;
-        case 1:
-          core_ = std::make_unique<ProcessorCore1>(sample_rate_);
-          break;
-        case 2:
-          core_ = std::make_unique<ProcessorCore2>(sample_rate_);
-          break;
-        default:
-          goto fail;
-      }
-      if (const auto err = core_->LoadModel(model_config, file);
-          err != ErrorCode::kSuccess) {
-        return err;
+    if constexpr (std::is_arithmetic_v<T>) {
+      loading_parameter_mailbox_.Post(static_cast<std::size_t>(param_id),
+                                      static_cast<double>(value));
+      // 差し替える前にバックグラウンドのスレッドで反映させる
+      if (is_model_loading_) {
+        core_loader_->Wake();
       }
-    } catch (const toml::file_io_error) {
-      error_code = ErrorCode::kFileOpenError;
-      goto fail;
-    } catch (const toml::syntax_error) {
-      error_code = ErrorCode::kTOMLSyntaxError;
-      goto fail;
-    } catch (const std::exception& e) {
-      error_code = ErrorCode::kUnknownError;
-      goto fail;
     }
-    return SyncAllParameters(ParameterID::kModel);
-
-  fail:
-    core_ = std::make_unique<ProcessorCoreUnloaded>();
-    return error_code;
+    return SyncParameter(param_id);
+  }
+  // モデルを読み込む。オフライン処理中か、まだ処理を始めていなければ
+  // その場で読み込んで差し替える。それ以外ではバックグラウンドのスレッドに
+  // 依頼し、読み込みとパラメータの反映、WarmUp() まで済ませた ProcessorCore が
+  // PublishLoadedCore() で core_ と差し替えられるまでは、今の core_ で処理する。
+  // 読み込みに失敗した場合は ProcessorCoreUnloaded に差し替えられ、
+  // その ErrorCode は GetModelLoadError() で得られる
+  auto LoadModel(const std::filesystem::path& file) -> ErrorCode;
+  // 読み込みの終わった ProcessorCore があれば core_ と差し替える。
+  // 読み込み中に変更されたパラメータは、ほとんどが差し替える前に
+  // バックグラウンドのスレッドで反映されている。
+  // オーディオスレッドからブロックの先頭で呼ぶ。待ちもメモリ確保も行わない
+  void PublishLoadedCore();
+  // 今の core_ を読み込んだときの結果
+  [[nodiscard]] auto GetModelLoadError() const -> ErrorCode {
+    return model_load_error_;
   }
+  // core_ で処理する。差し替えの直後は、古い ProcessorCore の出力から
+  // kCrossfadeSamples かけてクロスフェードする
+  auto ProcessMultiTarget(const float* input, float* output,
+                          float* const* extra_outputs, int n_extra_outputs,
+                          int n_samples) -> ErrorCode;
+  // BeginParameterBatch() から EndParameterBatch() までの間に変更された
+  // モーフィングの重みは、EndParameterBatch() でまとめて core_ に反映する。
+  // 入れ子にしてよく、最も外側の EndParameterBatch() で反映する
+  void BeginParameterBatch() { ++parameter_batch_depth_; }
+  auto EndParameterBatch() -> ErrorCode;
+  // parameter_state_ のモーフィングの重みを core_ に反映する。
+  // バッチ処理中であれば、反映を EndParameterBatch() まで遅らせる
+  auto SyncSpeakerMorphingWeights() -> ErrorCode;
   auto Read(std::istream& is) -> ErrorCode;
   auto Write(std::ostream& os) const -> ErrorCode;
   [[nodiscard]] auto GetParameterState() const -> const ParameterState&;
@@ -92,9 +101,54 @@ class ProcessorProxy {
   }
 
  private:
+  using ParameterMailbox =
+      StateMailbox<static_cast<std::size_t>(ParameterID::kSentinel)>;
+
   double sample_rate_;
+  int max_block_size_;
   ParameterState parameter_state_;
   std::unique_ptr<ProcessorCoreBase> core_;
+  int parameter_batch_depth_ = 0;
+  bool is_speaker_morphing_weights_dirty_ = false;
+
+  bool is_offline_ = false;
+  bool is_active_ = false;
+  ErrorCode model_load_error_ = ErrorCode::kSuccess;
+  // バックグラウンドでモデルを読み込み中か
+  bool is_model_loading_ = false;
+  // 数値のパラメータの変更を、読み込み中の ProcessorCore に反映させるために
+  // バックグラウンドのスレッドに渡す。常に最新の値を渡す
+  ParameterMailbox loading_parameter_mailbox_;
+  // 差し替え前の ProcessorCore。クロスフェードが済んだら破棄を依頼する
+  std::unique_ptr<ProcessorCoreBase> fading_core_;
+  int crossfade_position_ = 0;
+  std::vector<float> crossfade_buffer_;
+  // 最初にモデルを読み込むときに作る
+  std::unique_ptr<CoreLoader> core_loader_;
+
+  // 依頼した時点の設定で ProcessorCore を作り、パラメータの反映と
+  // WarmUp() まで済ませる。読み込みの結果を error に入れる
+  static auto PrepareCore(const std::filesystem::path& file,
+                          double sample_rate, int max_block_size,
+                          const ParameterState& parameter_state,
+                          ErrorCode& error)
+      -> std::unique_ptr<ProcessorCoreBase>;
+  // mailbox に届いているパラメータの変更を parameter_state と core に反映する。
+  // バックグラウンドのスレッドで呼ばれる
+  static void ApplyPostedParameters(ParameterMailbox& mailbox,
+                                    ParameterState& parameter_state,
+                                    std::unique_ptr<ProcessorCoreBase>& core);
+  // crossfade_buffer_ に収まる長さを、クロスフェードしながら処理する
+  auto ProcessCrossfade(const float* input, float* output,
+                        float* const* extra_outputs, int n_extra_outputs,
+                        int n_samples) -> ErrorCode;
+  // PrepareCore() で、作った core にパラメータを反映するために使う
+  ProcessorProxy(const ParameterState& parameter_state,
+                 std::unique_ptr<ProcessorCoreBase> core)
+      : sample_rate_(),
+        max_block_size_(),
+        parameter_state_(parameter_state),
+        core_(std::move(core)) {}
 
   // parameter_state_ の値を core_ に反映させる。
   // 原則として state と core は同期されており、
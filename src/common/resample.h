@@ -4,6 +4,7 @@
 #define BEATRICE_COMMON_RESAMPLE_H_
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -14,6 +15,9 @@
 
 namespace beatrice::resampler {
 
+// 複数ブロックをまとめて処理する場合の最大ブロック数
+inline constexpr int kMaxNBatchBlocks = 16;
+
 static inline auto NormalizedSinc(const double x) -> double {
   using std::numbers::pi;
   if (std::abs(x) < 1e-8) {
@@ -321,38 +325,96 @@ class ConvertStreamFunctionFrequency {
 };
 
 // n サンプル受け取って n サンプルを返す関数をラップして、
-// 任意のサンプル数受け取って同じ長さを返すオブジェクトにする
+// 任意のサンプル数受け取って同じ長さを返すオブジェクトにする。
+// Func が複数ブロックをまとめて処理する Batch() を持っていれば、
+// 1 回の呼び出しで揃ったブロックを kMaxBatchBlocks 個ずつまとめて渡す
 template <int n, class Func>
 class ConvertStreamFunctionBlockSize {
+ public:
+  static constexpr int kMaxBatchBlocks = kMaxNBatchBlocks;
+
+ private:
   alignas(64) std::array<float, n> buffer_;
   Func function_;
   int idx_buffer_ = 0;
+  // Batch() 用の作業領域
+  alignas(64) std::array<float, n * kMaxBatchBlocks> batch_input_;
+  alignas(64) std::array<float, n * kMaxBatchBlocks> batch_output_;
 
  public:
   explicit ConvertStreamFunctionBlockSize(Func function)
-      : buffer_(), function_(function) {}
+      : buffer_(), function_(function), batch_input_(), batch_output_() {}
 
   // input != output でなければならない
   template <class... Context>
   auto operator()(const float* const input, float* const output, const int n_io,
                   Context&&... context) {
     assert(input != output);
+    if constexpr (requires {
+                    function_.Batch(batch_input_.data(), batch_output_.data(),
+                                    1, context...);
+                  }) {
+      ProcessBatch(input, output, n_io, std::forward<Context>(context)...);
+    } else {
+      for (auto idx_io = 0; idx_io < n_io;) {
+        const auto n_samples_process =
+            std::min(n - idx_buffer_, n_io - idx_io);
+        std::memcpy(&output[idx_io], &buffer_[idx_buffer_],
+                    sizeof(float) * n_samples_process);
+        std::memcpy(&buffer_[idx_buffer_], &input[idx_io],
+                    sizeof(float) * n_samples_process);
+        idx_buffer_ += n_samples_process;
+        idx_io += n_samples_process;
+        if (idx_buffer_ == n) {
+          idx_buffer_ = 0;
+          alignas(64) std::array<float, n> processed_buffer;
+          function_(std::to_address(buffer_.begin()),
+                    std::to_address(processed_buffer.begin()),
+                    std::forward<Context>(context)...);
+          buffer_ = processed_buffer;
+        }
+      }
+    }
+  }
+
+ private:
+  // 1 ブロックずつ処理する場合と同じ出力になるように、
+  // 揃ったブロックをまとめて処理してから出力を書き出す。
+  // buffer_[0, idx_buffer_) は未処理の入力、
+  // buffer_[idx_buffer_, n) は出力待ちの処理済みサンプル
+  template <class... Context>
+  void ProcessBatch(const float* const input, float* const output,
+                    const int n_io, Context&&... context) {
     for (auto idx_io = 0; idx_io < n_io;) {
-      const auto n_samples_process = std::min(n - idx_buffer_, n_io - idx_io);
-      std::memcpy(&output[idx_io], &buffer_[idx_buffer_],
-                  sizeof(float) * n_samples_process);
-      std::memcpy(&buffer_[idx_buffer_], &input[idx_io],
-                  sizeof(float) * n_samples_process);
-      idx_buffer_ += n_samples_process;
-      idx_io += n_samples_process;
-      if (idx_buffer_ == n) {
-        idx_buffer_ = 0;
-        alignas(64) std::array<float, n> processed_buffer;
-        function_(std::to_address(buffer_.begin()),
-                  std::to_address(processed_buffer.begin()),
-                  std::forward<Context>(context)...);
-        buffer_ = processed_buffer;
+      const auto n_blocks =
+          std::min((idx_buffer_ + n_io - idx_io) / n, kMaxBatchBlocks);
+      if (n_blocks == 0) {
+        const auto n_samples_process = n_io - idx_io;
+        std::memcpy(&output[idx_io], &buffer_[idx_buffer_],
+                    sizeof(float) * n_samples_process);
+        std::memcpy(&buffer_[idx_buffer_], &input[idx_io],
+                    sizeof(float) * n_samples_process);
+        idx_buffer_ += n_samples_process;
+        return;
       }
+      // 入力を集める
+      const auto n_input = n_blocks * n - idx_buffer_;
+      std::memcpy(batch_input_.data(), buffer_.data(),
+                  sizeof(float) * idx_buffer_);
+      std::memcpy(&batch_input_[idx_buffer_], &input[idx_io],
+                  sizeof(float) * n_input);
+      function_.Batch(std::to_address(batch_input_.begin()),
+                      std::to_address(batch_output_.begin()), n_blocks,
+                      std::forward<Context>(context)...);
+      // 出力待ちだったものに続けて、最後のブロック以外の処理結果を出力する
+      std::memcpy(&output[idx_io], &buffer_[idx_buffer_],
+                  sizeof(float) * (n - idx_buffer_));
+      std::memcpy(&output[idx_io + n - idx_buffer_], batch_output_.data(),
+                  sizeof(float) * (n_blocks - 1) * n);
+      std::memcpy(buffer_.data(), &batch_output_[(n_blocks - 1) * n],
+                  sizeof(float) * n);
+      idx_buffer_ = 0;
+      idx_io += n_input;
     }
   }
 };
@@ -364,10 +426,13 @@ class ConvertStreamFunctionBlockSize {
 template <int n, class Func>
 class ConvertStreamFunctionFrom2In3OutTo6InOut {
   Func function_;
+  // Batch() 用の作業領域
+  alignas(64) std::array<float, 2 * n * kMaxNBatchBlocks> batch_function_in_;
+  alignas(64) std::array<float, 3 * n * kMaxNBatchBlocks> batch_function_out_;
 
  public:
   explicit ConvertStreamFunctionFrom2In3OutTo6InOut(Func function)
-      : function_(function) {}
+      : function_(function), batch_function_in_(), batch_function_out_() {}
 
   // input == output であってもよい
   template <class... Context>
@@ -386,6 +451,29 @@ class ConvertStreamFunctionFrom2In3OutTo6InOut {
       output[i * 2] = function_out[i];
     }
   }
+
+  // 6n サンプルのブロックを n_blocks 個まとめて処理する。
+  // Func が Batch() を持つ場合のみ使える
+  template <class... Context>
+  auto Batch(const float* const input, float* const output, const int n_blocks,
+             Context&&... context)
+    requires requires(Func& f, const float* i, float* o, int k,
+                      Context&&... c) { f.Batch(i, o, k, c...); }
+  {
+    assert(0 < n_blocks && n_blocks <= kMaxNBatchBlocks);
+    auto& function_in = batch_function_in_;
+    auto& function_out = batch_function_out_;
+    for (auto i = 0; i < 2 * n * n_blocks; ++i) {
+      function_in[i] = input[(i + 1) * 3 - 1];
+    }
+    function_.Batch(std::to_address(function_in.begin()),
+                    std::to_address(function_out.begin()), n_blocks,
+                    std::forward<Context>(context)...);
+    std::memset(output, 0, 6 * n * n_blocks * sizeof(float));
+    for (auto i = 0; i < 3 * n * n_blocks; ++i) {
+      output[i * 2] = function_out[i];
+    }
+  }
 };
 
 // ↑ 3 つの組み合わせ
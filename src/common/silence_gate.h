@@ -0,0 +1,96 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_SILENCE_GATE_H_
+#define BEATRICE_COMMON_SILENCE_GATE_H_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace beatrice::common {
+
+// 無音のフレームの推論を省略するための判定と、省略したフレームの入力の記録。
+// 省略したフレームは無音を出力し、入力だけを直近の kPreRollHops フレーム分
+// とっておく。推論を再開するときは、それを先に流し込んでから再開する
+template <int kHopLength>
+class SilenceGate {
+ public:
+  // 無音と判定されてからも推論を続けるフレーム数。語尾を切らないようにする
+  static constexpr int kHoldHops = 30;
+  // 推論を再開するときに、直前の無音区間から先に流し込んでおく最大のフレーム数
+  static constexpr int kPreRollHops = 4;
+
+  SilenceGate() : history_() {}
+
+  // 閾値を dB で設定する
+  void SetThreshold(const double threshold) {
+    threshold_power_ =
+        std::pow(10.0, std::clamp(threshold, -120.0, 0.0) / 10.0);
+  }
+
+  // 1 フレームの入力から、推論すべきかを判定する
+  auto Update(const float* const input) -> bool {
+    auto power = 0.0;
+    for (auto i = 0; i < kHopLength; ++i) {
+      power += static_cast<double>(input[i]) * input[i];
+    }
+    power /= kHopLength;
+    if (power >= threshold_power_) {
+      hold_count_ = kHoldHops;
+      return true;
+    }
+    if (hold_count_ > 0) {
+      --hold_count_;
+      return true;
+    }
+    return false;
+  }
+
+  // 推論を省略したフレームの入力を記録する
+  void Skip(const float* const input) {
+    std::memcpy(history_.data() + history_head_ * kHopLength, input,
+                sizeof(float) * kHopLength);
+    history_head_ = (history_head_ + 1) % kPreRollHops;
+    n_history_hops_ = std::min(n_history_hops_ + 1, kPreRollHops);
+    is_gated_ = true;
+  }
+
+  // 推論を省略している途中か
+  [[nodiscard]] auto IsGated() const -> bool { return is_gated_; }
+
+  // 推論を再開する。記録した入力のうち新しい方から最大 max_hops フレームを
+  // 古い順に pre_roll に入れ、その数を返す。残りは捨てる
+  auto Resume(float* const pre_roll, const int max_hops) -> int {
+    const auto n = std::min(n_history_hops_, max_hops);
+    for (auto i = 0; i < n; ++i) {
+      const auto idx =
+          (history_head_ - n + i + kPreRollHops) % kPreRollHops;
+      std::memcpy(pre_roll + i * kHopLength,
+                  history_.data() + idx * kHopLength,
+                  sizeof(float) * kHopLength);
+    }
+    is_gated_ = false;
+    n_history_hops_ = 0;
+    return n;
+  }
+
+  void Reset() {
+    hold_count_ = kHoldHops;
+    is_gated_ = false;
+    n_history_hops_ = 0;
+    history_head_ = 0;
+  }
+
+ private:
+  double threshold_power_ = 1e-12;
+  int hold_count_ = kHoldHops;
+  bool is_gated_ = false;
+  int n_history_hops_ = 0;
+  int history_head_ = 0;
+  alignas(64) std::array<float, kHopLength * kPreRollHops> history_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_SILENCE_GATE_H_
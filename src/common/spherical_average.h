@@ -7,25 +7,40 @@
 #include <immintrin.h>
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 
+#include "common/float16.h"
+
 /**
  * This class implements spherical averages
  * (https://mathweb.ucsd.edu/~sbuss/ResearchWeb/spheremean/index.html), which
  * correspond to spherical linear interpolation between two or more vectors.
  *
+ * The optimizer iterate always stays in the span of the selected points, so
+ * the iteration is carried out on N-dimensional coefficient vectors using the
+ * Gram matrix of the selected (normalized) points, which is computed once in
+ * SetWeights(). Vectors are expanded to M dimensions only in GetResult().
+ *
+ * The input points are not copied. The class keeps a non-owning strided view
+ * (base pointer and distance between consecutive points) into storage owned
+ * by the caller, which must outlive it and must not be reallocated.
+ * Normalization is applied through the Gram matrix, so no normalized copies
+ * of the points are made either. Points may also be stored as half-precision
+ * floats; they are then widened one at a time into stack buffers as needed.
+ *
  * Note: If the number of points is greater than the number of features
- * (under-determined system), the solution of the weights will not be unique and
- * will be unstable.
- * To make this class usable in such cases, it is necessary to combine it with
- * some least-squares solution solver (e.g. Eigen) to obtain the weights as
- * a minimum-norm solution, but this is not currently the case.
+ * (under-determined system), the coefficients will not be unique, although the
+ * iterate itself is still well-defined.
  */
 
 namespace beatrice::common {
@@ -50,7 +65,11 @@ class AlignedAllocator {
 
     // allocate aligned memory at N-byte boundaries
     // note that size must be a multiple of N
+#ifdef _WIN32
     void* ptr = _aligned_malloc(size, N);
+#else
+    void* ptr = std::aligned_alloc(N, (size + N - 1) / N * N);
+#endif
     // throw an exception if memory allocation fails
     if (ptr == nullptr) {
       throw std::bad_alloc();
@@ -58,7 +77,13 @@ class AlignedAllocator {
     return static_cast<T*>(ptr);
   }
 
-  void deallocate(T* ptr, std::size_t) noexcept { _aligned_free(ptr); }
+  void deallocate(T* ptr, std::size_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+  }
 
   template <class U>
   struct rebind {
@@ -91,12 +116,22 @@ class SphericalAverage {
         N_lim_(0),
         N_(0),
         K_(0),
+        H_(0),
+        L_(0),
         converged_(true),
         indices_(),
         w_(),
-        p_(),
-        p_raw_(),
+        p_(nullptr),
+        p_half_(nullptr),
+        stride_(M),
+        G_raw_(),
+        G_raw_prev_(),
+        G_(),
+        inv_norm_(),
+        prev_indices_(),
+        N_prev_(0),
         q_(),
+        q0_(),
         v_(),
         g_(),
         mem_idx_(0),
@@ -109,17 +144,27 @@ class SphericalAverage {
 
   SphericalAverage(size_t num_point_all, size_t num_feature,
                    const T* unnormalized_vectors, size_t num_point_limit = 0,
-                   size_t num_memory = 2)
+                   size_t num_memory = 2, size_t point_stride = M)
       : N_all_(num_point_all),
         N_lim_(0),
         N_(0),
         K_(num_memory),
+        H_(0),
+        L_(0),
         converged_(true),
         indices_(),
         w_(),
-        p_(),
-        p_raw_(),
+        p_(nullptr),
+        p_half_(nullptr),
+        stride_(M),
+        G_raw_(),
+        G_raw_prev_(),
+        G_(),
+        inv_norm_(),
+        prev_indices_(),
+        N_prev_(0),
         q_(),
+        q0_(),
         v_(),
         g_(),
         mem_idx_(0),
@@ -130,45 +175,28 @@ class SphericalAverage {
         r_(),
         a_() {
     Initialize(num_point_all, num_feature, unnormalized_vectors,
-               num_point_limit, num_memory);
+               num_point_limit, num_memory, point_stride);
   }
 
   ~SphericalAverage() = default;
 
+  // n 番目の点は unnormalized_vectors + n * point_stride から M 要素。
+  // 点のデータはコピーせずに参照するので、呼び出し側で保持し続けること。
   auto Initialize(size_t num_point_all, size_t num_feature,
                   const T* unnormalized_vectors, size_t num_point_limit = 0,
-                  size_t num_memory = 2) -> void {
-    N_all_ = num_point_all;
-    if (num_point_limit == 0 || num_point_limit > num_point_all) {
-      N_lim_ = num_point_all;
-    } else {
-      N_lim_ = num_point_limit;
-    }
-
-    assert(N_lim_ <= num_feature);
-    assert(M % (64 / sizeof(T)) == 0);  // M must be a multiple of 64/sizeof(T)
-    assert(num_feature == M);           // num_feature must be equal to M
-
-    N_ = 0;
-    K_ = num_memory;
-    indices_.resize(N_lim_, 0);         // size = N_lim_
-    w_.resize(N_lim_, (T)0.0);          // size = N_lim_
-    p_.resize(N_all_ * M, (T)0.0);      // size = N_all_ * M
-    p_raw_.resize(N_all_ * M, (T)0.0);  // size = N_all_ * M
-    q_.resize(M, (T)0.0);               // size = M
-    v_.resize(N_lim_, (T)0.0);          // size = N_lim_
-    g_.resize(M, (T)0.0);               // size = M
-    d_.resize(M, (T)0.0);               // size = M
-    s_.resize(K_ * M, (T)0.0);          // size = K*M
-    t_.resize(K_ * M, (T)0.0);          // size = K*M
-    r_.resize(K_, (T)0.0);              // size = K
-    a_.resize(K_, (T)0.0);              // size = K
-
-    std::copy_n(unnormalized_vectors, N_all_ * M, p_raw_.begin());
-    std::copy_n(unnormalized_vectors, N_all_ * M, p_.begin());
-    for (size_t n = 0; n < N_all_; n++) {
-      NormalizeVector(M, &p_[n * M]);
-    }
+                  size_t num_memory = 2, size_t point_stride = M) -> void {
+    InitializeStorage(num_point_all, num_feature, num_point_limit, num_memory,
+                      point_stride);
+    p_ = unnormalized_vectors;
+  }
+  // 点を半精度で保持している場合。使うたびに単精度に戻す
+  auto Initialize(size_t num_point_all, size_t num_feature,
+                  const Float16* unnormalized_vectors,
+                  size_t num_point_limit = 0, size_t num_memory = 2,
+                  size_t point_stride = M) -> void {
+    InitializeStorage(num_point_all, num_feature, num_point_limit, num_memory,
+                      point_stride);
+    p_half_ = unnormalized_vectors;
   }
 
   auto SetWeights(size_t num_point, const T* weights,
@@ -202,23 +230,26 @@ class SphericalAverage {
         }
       }
     }
+
+    UpdateGram();
+
+    std::memset(q_.data(), 0, sizeof(T) * L_);
     if (N_ > 0 && NormalizeWeight(N_, w_.data())) {
-      MulC(M, w_[0], &p_[indices_[0] * M], q_.data());
-      for (size_t n = 1; n < N_; n++) {
-        AddProductC(M, w_[n], &p_[indices_[n] * M], q_.data());
-      }
-      if (!NormalizeVector(M, q_.data())) {
+      std::memcpy(q_.data(), w_.data(), sizeof(T) * N_);
+      ApplyGram(q_.data());
+      if (!NormalizeReducedVector(q_.data())) {
         converged_ = true;
       }
     } else {
       converged_ = true;
     }
+    std::memcpy(q0_.data(), q_.data(), sizeof(T) * L_);
 
     if (!converged_) {
       mem_idx_ = 0;
       gamma_ = (T)1.0;
-      std::memset(s_.data(), 0, sizeof(T) * K_ * M);
-      std::memset(t_.data(), 0, sizeof(T) * K_ * M);
+      std::memset(s_.data(), 0, sizeof(T) * K_ * L_);
+      std::memset(t_.data(), 0, sizeof(T) * K_ * L_);
       std::memset(r_.data(), 0, sizeof(T) * K_);
       std::memset(a_.data(), 0, sizeof(T) * K_);
       UpdateVGD();
@@ -229,7 +260,7 @@ class SphericalAverage {
     if (converged_) {
       return true;
     }
-    T norm_d = sqrt(Dot(M, d_.data(), d_.data()));
+    T norm_d = sqrt(ReducedDot(d_.data(), d_.data()));
     if (norm_d >= 8 * std::numeric_limits<T>::epsilon()) {
       UpdateQS();
       UpdateVGDT();
@@ -240,15 +271,89 @@ class SphericalAverage {
     return converged_;
   }
 
+  // SetWeights() の直後の解 (正規化した点の重み付き線形和を正規化したもの)
+  // と現在の解とのなす角を返す。
+  // 収束後に呼べば、線形ブレンドで近似した場合の角度誤差になる。
+  auto GetApproximationAngle() -> T {
+    if (N_ == 0) {
+      return (T)0.0;
+    }
+    return acos(std::clamp(ReducedDot(q0_.data(), q_.data()), (T)-1.0,
+                           (T)1.0));
+  }
+
+  // M 次元に戻すのは結果を取り出すときのみ
   auto GetResult(size_t num_feature, T* dst_vector) -> void {
     assert(M == num_feature);
-    MulC(M, v_[0], &p_raw_[indices_[0] * M], dst_vector);
+    alignas(64) std::array<T, M> buffer;
+    MulC(M, v_[0], Point(indices_[0], buffer.data()), dst_vector);
     for (size_t n = 1; n < N_; n++) {
-      AddProductC(M, v_[n], &p_raw_[indices_[n] * M], dst_vector);
+      AddProductC(M, v_[n], Point(indices_[n], buffer.data()), dst_vector);
     }
   }
 
  private:
+  static constexpr size_t kAlignElems = 64 / sizeof(T);
+  static constexpr size_t kMaxReusableN = 64;
+
+  // 点の参照以外を初期化する
+  auto InitializeStorage(size_t num_point_all, size_t num_feature,
+                         size_t num_point_limit, size_t num_memory,
+                         size_t point_stride) -> void {
+    N_all_ = num_point_all;
+    if (num_point_limit == 0 || num_point_limit > num_point_all) {
+      N_lim_ = num_point_all;
+    } else {
+      N_lim_ = num_point_limit;
+    }
+
+    assert(M % kAlignElems == 0);  // M must be a multiple of 64/sizeof(T)
+    assert(num_feature == M);      // num_feature must be equal to M
+    assert(point_stride >= M && point_stride % kAlignElems == 0);
+
+    N_ = 0;
+    K_ = num_memory;
+    // 係数ベクトルとそのグラム行列による像を 64 バイト境界に揃えて並べる
+    H_ = (N_lim_ + kAlignElems - 1) / kAlignElems * kAlignElems;
+    L_ = 2 * H_;
+    indices_.resize(N_lim_, 0);         // size = N_lim_
+    w_.resize(N_lim_, (T)0.0);          // size = N_lim_
+    p_ = nullptr;
+    p_half_ = nullptr;
+    stride_ = point_stride;
+    G_raw_.resize(H_ * H_, (T)0.0);       // size = H * H
+    G_raw_prev_.resize(H_ * H_, (T)0.0);  // size = H * H
+    G_.resize(H_ * H_, (T)0.0);           // size = H * H
+    inv_norm_.resize(N_lim_, (T)0.0);     // size = N_lim_
+    prev_indices_.resize(N_lim_, 0);    // size = N_lim_
+    N_prev_ = 0;
+    q_.resize(L_, (T)0.0);              // size = L
+    q0_.resize(L_, (T)0.0);             // size = L
+    v_.resize(N_lim_, (T)0.0);          // size = N_lim_
+    g_.resize(L_, (T)0.0);              // size = L
+    d_.resize(L_, (T)0.0);              // size = L
+    s_.resize(K_ * L_, (T)0.0);         // size = K * L
+    t_.resize(K_ * L_, (T)0.0);         // size = K * L
+    r_.resize(K_, (T)0.0);              // size = K
+    a_.resize(K_, (T)0.0);              // size = K
+  }
+
+  // n 番目の点。半精度で保持している場合は buffer に単精度で戻して返す
+  inline auto Point(size_t n, T* buffer) const -> const T* {
+    if (p_half_ == nullptr) {
+      return p_ + n * stride_;
+    }
+    const auto* const src = p_half_ + n * stride_;
+    if constexpr (std::is_same_v<T, float>) {
+      ConvertToFloat(src, buffer, M);
+    } else {
+      for (size_t m = 0; m < M; ++m) {
+        buffer[m] = static_cast<T>(ToFloat(src[m]));
+      }
+    }
+    return buffer;
+  }
+
   inline auto Dot(size_t len, const T* x1, const T* x2) -> T {
     const T* __restrict xx1 = std::assume_aligned<64>(x1);
     const T* __restrict xx2 = std::assume_aligned<64>(x2);
@@ -293,11 +398,10 @@ class SphericalAverage {
     return y;
   }
 
-  inline auto NormalizeVector(size_t len, T* x) -> bool {
-    const T* __restrict xx = std::assume_aligned<64>(x);
-    T norm = sqrt(Dot(len, x, x));
-    if (norm > 0.0) {
-      T scale_factor = ((T)1.0) / norm;
+  inline auto NormalizeWeight(size_t len, T* x) -> bool {
+    T sum_x = Sum(len, x);
+    if (sum_x > 0.0) {
+      T scale_factor = ((T)1.0) / sum_x;
       MulC(len, scale_factor, x);
       return true;
     } else {
@@ -305,11 +409,78 @@ class SphericalAverage {
     }
   }
 
-  inline auto NormalizeWeight(size_t len, T* x) -> bool {
-    T sum_x = Sum(len, x);
-    if (sum_x > 0.0) {
-      T scale_factor = ((T)1.0) / sum_x;
-      MulC(len, scale_factor, x);
+  // 縮約表現のベクトルは長さ L で、前半 H 要素が選ばれた点に対する係数 c、
+  // 後半 H 要素がその像 Gc (すなわち各点との内積) を表す。
+  // 線形演算は両方に同じように作用するので、長さ L のまま扱えばよい。
+
+  // 係数 x[0:H] からその像 x[H:2H] を求める
+  inline auto ApplyGram(T* x) -> void {
+    for (size_t i = 0; i < N_; i++) {
+      x[H_ + i] = Dot(H_, &G_[i * H_], x);
+    }
+  }
+
+  // 選ばれた点を正規化したもののグラム行列を求める。
+  // 以降の反復は選ばれた点の張る部分空間内で閉じているので、
+  // M 次元のベクトルの代わりに N 次元の係数ベクトルで計算できる。
+  // 正規化前の内積を求めてから対角成分で割るので、正規化した点のコピーは不要。
+  // 重みだけが変わった場合など、前回と共通する点の組の内積は使い回す。
+  auto UpdateGram() -> void {
+    std::swap(G_raw_, G_raw_prev_);
+    std::memset(G_raw_.data(), 0, sizeof(T) * H_ * H_);
+    std::memset(G_.data(), 0, sizeof(T) * H_ * H_);
+    std::array<int, kMaxReusableN> prev_pos;
+    const auto n_reusable = std::min(N_, kMaxReusableN);
+    for (size_t i = 0; i < n_reusable; i++) {
+      prev_pos[i] = -1;
+      for (size_t j = 0; j < N_prev_; j++) {
+        if (prev_indices_[j] == indices_[i]) {
+          prev_pos[i] = static_cast<int>(j);
+          break;
+        }
+      }
+    }
+    alignas(64) std::array<T, M> buffer_i;
+    alignas(64) std::array<T, M> buffer_j;
+    for (size_t i = 0; i < N_; i++) {
+      const T* point_i = nullptr;
+      for (size_t j = 0; j <= i; j++) {
+        T g;
+        if (i < n_reusable && prev_pos[i] >= 0 && prev_pos[j] >= 0) {
+          g = G_raw_prev_[prev_pos[i] * H_ + prev_pos[j]];
+        } else {
+          // 半精度の場合も i 番目の点は 1 度だけ戻す
+          if (point_i == nullptr) {
+            point_i = Point(indices_[i], buffer_i.data());
+          }
+          g = Dot(M, point_i, Point(indices_[j], buffer_j.data()));
+        }
+        G_raw_[i * H_ + j] = G_raw_[j * H_ + i] = g;
+      }
+    }
+    for (size_t i = 0; i < N_; i++) {
+      const T norm = sqrt(G_raw_[i * H_ + i]);
+      inv_norm_[i] = norm > 0.0 ? ((T)1.0) / norm : (T)0.0;
+    }
+    for (size_t i = 0; i < N_; i++) {
+      for (size_t j = 0; j < N_; j++) {
+        G_[i * H_ + j] = G_raw_[i * H_ + j] * inv_norm_[i] * inv_norm_[j];
+      }
+    }
+    std::copy_n(indices_.begin(), N_, prev_indices_.begin());
+    N_prev_ = N_;
+  }
+
+  // 元の空間での内積 <x, y> = c_x^T G c_y
+  inline auto ReducedDot(const T* x, const T* y) -> T {
+    return Dot(H_, x, y + H_);
+  }
+
+  inline auto NormalizeReducedVector(T* x) -> bool {
+    T norm = sqrt(ReducedDot(x, x));
+    if (norm > 0.0) {
+      T scale_factor = ((T)1.0) / norm;
+      MulC(L_, scale_factor, x);
       return true;
     } else {
       return false;
@@ -337,82 +508,82 @@ class SphericalAverage {
     return y;
   }
 
-  inline auto ProjectVectorToPlane(size_t len, const T* __restrict x,
-                                   T* __restrict y) -> void {
-    T minus_inner_product = -Dot(len, x, y);
-    AddProductC(len, minus_inner_product, x, y);
+  inline auto ProjectVectorToPlane(const T* __restrict x, T* __restrict y)
+      -> void {
+    T minus_inner_product = -ReducedDot(x, y);
+    AddProductC(L_, minus_inner_product, x, y);
   }
 
   auto UpdateVGD(void) -> void {
     T sum_w_c_s = (T)0.0;
-    // std::fill_n(g_.begin(), M, (T)0.0);
-    std::memset(g_.data(), 0, sizeof(T) * M);
+    std::memset(g_.data(), 0, sizeof(T) * L_);
 
     for (size_t n = 0; n < N_; n++) {
-      T cos_th = Dot(M, &p_[indices_[n] * M], q_.data());
+      // q の像の n 番目の要素が p_n との内積になっている
+      T cos_th = std::clamp(q_[H_ + n], (T)-1.0, (T)1.0);
       T theta = acos(cos_th);
       T inv_sinc_th =
           ((T)1.0) / (Sinc(theta) + std::numeric_limits<T>::epsilon());
       sum_w_c_s += w_[n] * cos_th * inv_sinc_th;
       v_[n] = w_[n] * inv_sinc_th;
-      T a_n = -((T)2.0) * w_[n] * theta / sqrt(((T)1.0) - cos_th * cos_th);
-      AddProductC(M, a_n, &p_[indices_[n] * M], g_.data());
+      // theta / sin(theta) = 1 / sinc(theta)
+      g_[n] = -((T)2.0) * w_[n] * inv_sinc_th;
     }
+    ApplyGram(g_.data());
 
     T inv_sum_w_c_s =
         ((T)1.0) / (sum_w_c_s + std::numeric_limits<T>::epsilon());
     MulC(N_, inv_sum_w_c_s, v_.data());
 
-    ProjectVectorToPlane(M, q_.data(), g_.data());
+    ProjectVectorToPlane(q_.data(), g_.data());
 
-    // std::copy(g_.begin(), g_.end(), d_.begin());
-    std::memcpy(d_.data(), g_.data(), sizeof(T) * M);
+    std::memcpy(d_.data(), g_.data(), sizeof(T) * L_);
     for (size_t k = 0; k < K_; k++) {
       size_t idx = (mem_idx_ - k - 1 + K_) % K_;
-      a_[idx] = r_[idx] * Dot(M, &s_[idx * M], d_.data());
-      AddProductC(M, -a_[idx], &t_[idx * M], d_.data());
+      a_[idx] = r_[idx] * ReducedDot(&s_[idx * L_], d_.data());
+      AddProductC(L_, -a_[idx], &t_[idx * L_], d_.data());
     }
-    MulC(M, gamma_, d_.data());
+    MulC(L_, gamma_, d_.data());
     for (size_t k = 0; k < K_; k++) {
       size_t idx = (mem_idx_ + k) % K_;
-      T b = r_[idx] * Dot(M, &t_[idx * M], d_.data());
-      AddProductC(M, (a_[idx] - b), &s_[idx * M], d_.data());
+      T b = r_[idx] * ReducedDot(&t_[idx * L_], d_.data());
+      AddProductC(L_, (a_[idx] - b), &s_[idx * L_], d_.data());
     }
   }
 
   void UpdateVGDT(void) {
-    std::copy(g_.begin(), g_.end(), &t_[mem_idx_ * M]);
+    std::copy(g_.begin(), g_.end(), &t_[mem_idx_ * L_]);
 
     UpdateVGD();
 
-    T* __restrict tt = std::assume_aligned<64>(&t_[mem_idx_ * M]);
+    T* __restrict tt = std::assume_aligned<64>(&t_[mem_idx_ * L_]);
     const T* __restrict gg = std::assume_aligned<64>(g_.data());
-    for (size_t m = 0; m < M; ++m) {
-      tt[m] = gg[m] - tt[m];
+    for (size_t l = 0; l < L_; ++l) {
+      tt[l] = gg[l] - tt[l];
     }
-    ProjectVectorToPlane(M, q_.data(), &t_[mem_idx_ * M]);
+    ProjectVectorToPlane(q_.data(), &t_[mem_idx_ * L_]);
   }
 
   void UpdateQS(void) {
-    std::copy(q_.begin(), q_.end(), &s_[mem_idx_ * M]);
+    std::copy(q_.begin(), q_.end(), &s_[mem_idx_ * L_]);
 
     T* __restrict qq = std::assume_aligned<64>(q_.data());
     const T* __restrict dd = std::assume_aligned<64>(d_.data());
-    for (size_t m = 0; m < M; ++m) {
-      qq[m] -= dd[m];
+    for (size_t l = 0; l < L_; ++l) {
+      qq[l] -= dd[l];
     }
-    NormalizeVector(M, q_.data());
+    NormalizeReducedVector(q_.data());
 
-    T* __restrict ss = std::assume_aligned<64>(&s_[mem_idx_ * M]);
-    for (size_t m = 0; m < M; ++m) {
-      ss[m] = qq[m] - ss[m];
+    T* __restrict ss = std::assume_aligned<64>(&s_[mem_idx_ * L_]);
+    for (size_t l = 0; l < L_; ++l) {
+      ss[l] = qq[l] - ss[l];
     }
   }
 
   void UpdateGammaR(void) {
-    gamma_ = Dot(M, &s_[mem_idx_ * M], &t_[mem_idx_ * M]);
+    gamma_ = ReducedDot(&s_[mem_idx_ * L_], &t_[mem_idx_ * L_]);
     r_[mem_idx_] = ((T)1.0) / gamma_;
-    gamma_ /= Dot(M, &t_[mem_idx_ * M], &t_[mem_idx_ * M]);
+    gamma_ /= ReducedDot(&t_[mem_idx_ * L_], &t_[mem_idx_ * L_]);
     mem_idx_ += 1;
     if (mem_idx_ >= K_) {
       mem_idx_ = 0;
@@ -424,23 +595,35 @@ class SphericalAverage {
   size_t N_;
   // size_t M_;
   size_t K_;
+  size_t H_;  // N_lim を 64 バイト境界に切り上げたもの
+  size_t L_;  // 2 * H
 
   bool converged_;
 
   // vectors in original space
   std::vector<size_t> indices_;  // size = N_lim
   AlignedVector<T, 64> w_;       // size = N_lim
-  AlignedVector<T, 64> p_;       // size = N_all * M
-  AlignedVector<T, 64> p_raw_;   // size = N_all * M
-  AlignedVector<T, 64> q_;       // size = M
-  AlignedVector<T, 64> v_;       // size = N_lim
-  AlignedVector<T, 64> g_;       // size = M
+  const T* p_;                   // 呼び出し側が所有する点の先頭
+  const Float16* p_half_;        // 半精度の場合はこちらを使う
+  size_t stride_;                // 隣り合う点の間隔 (要素数)
+
+  // vectors in reduced coordinates
+  AlignedVector<T, 64> G_raw_;       // size = H * H
+  AlignedVector<T, 64> G_raw_prev_;  // size = H * H
+  AlignedVector<T, 64> G_;           // size = H * H
+  AlignedVector<T, 64> inv_norm_;    // size = N_lim
+  std::vector<size_t> prev_indices_;  // size = N_lim
+  size_t N_prev_;
+  AlignedVector<T, 64> q_;   // size = L
+  AlignedVector<T, 64> q0_;  // size = L, SetWeights() 直後の q
+  AlignedVector<T, 64> v_;  // size = N_lim
+  AlignedVector<T, 64> g_;  // size = L
 
   size_t mem_idx_;
   T gamma_;
-  AlignedVector<T, 64> d_;  // size = M
-  AlignedVector<T, 64> s_;  // size = K * M
-  AlignedVector<T, 64> t_;  // size = K * M
+  AlignedVector<T, 64> d_;  // size = L
+  AlignedVector<T, 64> s_;  // size = K * L
+  AlignedVector<T, 64> t_;  // size = K * L
   AlignedVector<T, 64> r_;  // size = K
   AlignedVector<T, 64> a_;  // size = K
 };
@@ -0,0 +1,60 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_SPSC_QUEUE_H_
+#define BEATRICE_COMMON_SPSC_QUEUE_H_
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+
+namespace beatrice::common {
+
+// 単一プロデューサ・単一コンシューマのロックフリーなキュー。
+// 要素は固定長の配列に確保しておき、追加や取り出しでメモリ確保は行わない。
+// TryPush() はプロデューサのスレッドのみから、
+// Size(), operator[], Pop() はコンシューマのスレッドのみから呼ぶこと。
+template <class T, std::size_t kCapacity>
+class SpscQueue {
+ public:
+  SpscQueue() : items_(), head_(0), tail_(0) {}
+  SpscQueue(const SpscQueue&) = delete;
+  auto operator=(const SpscQueue&) -> SpscQueue& = delete;
+
+  // 満杯なら何もせず false を返す
+  auto TryPush(const T& item) -> bool {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+      return false;
+    }
+    items_[tail % kCapacity] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  [[nodiscard]] auto Size() const -> std::size_t {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_relaxed);
+  }
+
+  // 先頭から i 番目の要素。i < Size() であること
+  [[nodiscard]] auto operator[](const std::size_t i) -> T& {
+    return items_[(head_.load(std::memory_order_relaxed) + i) % kCapacity];
+  }
+
+  // 先頭から n 個の要素を取り除く。n <= Size() であること
+  void Pop(const std::size_t n = 1) {
+    assert(n <= Size());
+    head_.store(head_.load(std::memory_order_relaxed) + n,
+                std::memory_order_release);
+  }
+
+ private:
+  std::array<T, kCapacity> items_;
+  alignas(64) std::atomic<std::size_t> head_;
+  alignas(64) std::atomic<std::size_t> tail_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_SPSC_QUEUE_H_
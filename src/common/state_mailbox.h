@@ -0,0 +1,54 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_STATE_MAILBOX_H_
+#define BEATRICE_COMMON_STATE_MAILBOX_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace beatrice::common {
+
+// あるスレッドで変更された設定値を、ロックを使わずに別のスレッドに渡すための
+// 郵便受け。スロットごとに最新の値だけを保持し、受け取られる前に
+// 上書きされた値は捨てられるが、最後に Post() した値は必ず届く。
+// 固定長の配列だけを使うので、メモリ確保も待ちも行わない。
+// Post() を呼ぶスレッド、Take() を呼ぶスレッドはそれぞれ同時には 1 つまでとすること
+template <std::size_t kNSlots>
+class StateMailbox {
+ public:
+  StateMailbox() : values_(), is_posted_(), has_any_(false) {}
+  StateMailbox(const StateMailbox&) = delete;
+  auto operator=(const StateMailbox&) -> StateMailbox& = delete;
+
+  void Post(const std::size_t slot, const double value) {
+    values_[slot].store(value, std::memory_order_relaxed);
+    is_posted_[slot].store(true, std::memory_order_release);
+    has_any_.store(true, std::memory_order_release);
+  }
+
+  // 前回の BeginTake() から Post() されたスロットがあるか。
+  // true であれば、続けて各スロットを Take() すること
+  [[nodiscard]] auto BeginTake() -> bool {
+    return has_any_.load(std::memory_order_relaxed) &&
+           has_any_.exchange(false, std::memory_order_acquire);
+  }
+  // slot に新しい値が届いていれば value に入れて true を返す
+  auto Take(const std::size_t slot, double& value) -> bool {
+    if (!is_posted_[slot].load(std::memory_order_relaxed) ||
+        !is_posted_[slot].exchange(false, std::memory_order_acquire)) {
+      return false;
+    }
+    value = values_[slot].load(std::memory_order_relaxed);
+    return true;
+  }
+
+ private:
+  std::array<std::atomic<double>, kNSlots> values_;
+  std::array<std::atomic<bool>, kNSlots> is_posted_;
+  std::atomic<bool> has_any_;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_STATE_MAILBOX_H_
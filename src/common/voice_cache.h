@@ -0,0 +1,99 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_COMMON_VOICE_CACHE_H_
+#define BEATRICE_COMMON_VOICE_CACHE_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+
+namespace beatrice::common {
+
+// 最近使った話者の設定を済ませた Context をとっておき、
+// 話者の切り替え時の設定を省略するためのキャッシュ。
+// Context はコンストラクタで kMaxSize 個作っておき、先頭の GetSize() 個を使う。
+// オーディオスレッドで作らずに済むよう、大きさを変えても作り直さない
+template <typename Context, int kMaxSize>
+class VoiceCache {
+ public:
+  using Create = Context* (*)();
+  using Destroy = void (*)(Context*);
+
+  VoiceCache(const Create create, const Destroy destroy)
+      : destroy_(destroy), entries_() {
+    for (auto&& entry : entries_) {
+      entry.context = create();
+    }
+  }
+  ~VoiceCache() {
+    for (auto&& entry : entries_) {
+      destroy_(entry.context);
+    }
+  }
+  VoiceCache(const VoiceCache&) = delete;
+  auto operator=(const VoiceCache&) -> VoiceCache& = delete;
+
+  [[nodiscard]] auto GetSize() const -> int { return size_; }
+  // 範囲外の値は丸める。使わなくなった分は空にする
+  void SetSize(const int new_size) {
+    const auto size = std::clamp(new_size, 0, kMaxSize);
+    for (auto i = size; i < size_; ++i) {
+      entries_[i].speaker = -1;
+      entries_[i].last_used = 0;
+    }
+    size_ = size;
+  }
+
+  // 話者 speaker を設定済みの context と入れ替えて true を返す。
+  // 無ければ最も長く使われていないものと入れ替えて false を返す。
+  // どちらの場合も、入れ替える前の context は話者 current_speaker
+  // (未設定なら -1) のものとしてとっておく。
+  // 大きさが 0 なら何もせずに false を返す
+  auto Exchange(Context*& context, const int current_speaker,
+                const int speaker) -> bool {
+    if (size_ == 0) {
+      return false;
+    }
+    auto* entry = &entries_[0];
+    for (auto i = 0; i < size_; ++i) {
+      if (entries_[i].speaker == speaker) {
+        entry = &entries_[i];
+        break;
+      }
+      if (entries_[i].last_used < entry->last_used) {
+        entry = &entries_[i];
+      }
+    }
+    const auto is_hit = entry->speaker == speaker;
+    std::swap(context, entry->context);
+    entry->speaker = current_speaker;
+    entry->last_used = ++clock_;
+    return is_hit;
+  }
+
+  // 話者 speaker (負なら全ての話者) のものを未設定として扱う
+  void Invalidate(const int speaker) {
+    for (auto i = 0; i < size_; ++i) {
+      if (speaker < 0 || entries_[i].speaker == speaker) {
+        entries_[i].speaker = -1;
+      }
+    }
+  }
+
+ private:
+  struct Entry {
+    Context* context = nullptr;
+    int speaker = -1;  // 未設定なら -1
+    std::uint64_t last_used = 0;
+  };
+
+  const Destroy destroy_;
+  std::array<Entry, kMaxSize> entries_;
+  int size_ = 0;
+  std::uint64_t clock_ = 0;
+};
+
+}  // namespace beatrice::common
+
+#endif  // BEATRICE_COMMON_VOICE_CACHE_H_
@@ -0,0 +1,173 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+// モデルの TOML ファイルと同じディレクトリ以下にあるファイルを、
+// 1 つのモデルバンドルにまとめるツール。
+// 使い方: beatrice_pack_model_bundle <model.toml> [<output.beatrice>]
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <system_error>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "common/error.h"
+#include "common/model_bundle.h"
+
+namespace {
+
+using beatrice::common::Crc32c;
+using beatrice::common::ErrorCode;
+using beatrice::common::kModelBundleAlignment;
+using beatrice::common::kModelBundleExtension;
+using beatrice::common::kModelBundleFormatVersion;
+using beatrice::common::kModelBundleMagic;
+using beatrice::common::kModelBundleMaxNameLength;
+using beatrice::common::ModelBundle;
+using beatrice::common::ModelBundleHeader;
+using beatrice::common::ModelBundleSection;
+
+auto AlignUp(const std::uint64_t n) -> std::uint64_t {
+  return (n + kModelBundleAlignment - 1) / kModelBundleAlignment *
+         kModelBundleAlignment;
+}
+
+auto ReadFile(const std::filesystem::path& file, std::vector<std::byte>& data)
+    -> bool {
+  auto ifs = std::ifstream(file, std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  auto chars = std::vector<char>(std::istreambuf_iterator<char>(ifs),
+                                 std::istreambuf_iterator<char>());
+  data.resize(chars.size());
+  std::memcpy(data.data(), chars.data(), chars.size());
+  return !ifs.bad();
+}
+
+// TOML を先頭に、それ以外はパスの順に並べる
+auto CollectFiles(const std::filesystem::path& config,
+                  const std::filesystem::path& output)
+    -> std::vector<std::filesystem::path> {
+  auto files = std::vector<std::filesystem::path>();
+  auto ec = std::error_code();
+  for (const auto& entry : std::filesystem::recursive_directory_iterator(
+           config.parent_path(), ec)) {
+    const auto& path = entry.path();
+    if (!entry.is_regular_file() ||
+        std::filesystem::equivalent(path, config, ec) ||
+        std::filesystem::equivalent(path, output, ec) ||
+        ModelBundle::IsBundleFile(path)) {
+      continue;
+    }
+    files.push_back(path);
+  }
+  std::ranges::sort(files);
+  files.insert(files.begin(), config);
+  return files;
+}
+
+}  // namespace
+
+auto main(int argc, char* argv[]) -> int {
+  if (argc < 2 || 3 < argc) {
+    std::fprintf(stderr,
+                 "usage: beatrice_pack_model_bundle <model.toml> "
+                 "[<output%s>]\n",
+                 kModelBundleExtension.data());
+    return 1;
+  }
+  const auto config = std::filesystem::absolute(argv[1]);
+  auto output = config;
+  if (argc == 3) {
+    output = std::filesystem::absolute(argv[2]);
+  } else {
+    output.replace_extension(kModelBundleExtension);
+  }
+  if (!ModelBundle::IsBundleFile(output)) {
+    std::fprintf(stderr, "output must have the extension %s\n",
+                 kModelBundleExtension.data());
+    return 1;
+  }
+  if (!std::filesystem::is_regular_file(config)) {
+    std::fprintf(stderr, "%s is not a file\n", argv[1]);
+    return 1;
+  }
+
+  // 索引を作る
+  const auto files = CollectFiles(config, output);
+  auto sections = std::vector<ModelBundleSection>(files.size());
+  auto offset = AlignUp(sizeof(ModelBundleHeader) +
+                        sizeof(ModelBundleSection) * files.size());
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    const auto name =
+        files[i].lexically_relative(config.parent_path()).generic_u8string();
+    if (name.size() > kModelBundleMaxNameLength) {
+      std::fprintf(stderr, "path too long: %s\n",
+                   reinterpret_cast<const char*>(name.c_str()));
+      return 1;
+    }
+    auto& section = sections[i];
+    section = ModelBundleSection();
+    section.offset = offset;
+    section.size = std::filesystem::file_size(files[i]);
+    section.name_length = static_cast<std::uint32_t>(name.size());
+    std::memcpy(section.name.data(), name.data(), name.size());
+    offset = AlignUp(offset + section.size);
+  }
+
+  // 各セクションの中身を読みながらチェックサムを求めて書き出す。
+  // 索引はチェックサムが揃ってから書き直す
+  auto ofs = std::ofstream(output, std::ios::binary);
+  const auto header = ModelBundleHeader{
+      .magic = kModelBundleMagic,
+      .format_version = kModelBundleFormatVersion,
+      .n_sections = static_cast<std::uint32_t>(sections.size()),
+  };
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  auto data = std::vector<std::byte>();
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    auto& section = sections[i];
+    if (!ReadFile(files[i], data) || data.size() != section.size) {
+      std::fprintf(stderr, "failed to read %s\n",
+                   reinterpret_cast<const char*>(files[i].u8string().c_str()));
+      return 1;
+    }
+    section.checksum = Crc32c(data.data(), data.size());
+    ofs.seekp(static_cast<std::streamoff>(section.offset));
+    ofs.write(reinterpret_cast<const char*>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+  }
+  // 末尾もセクションの境界に揃える
+  if (const auto end = static_cast<std::uint64_t>(ofs.tellp());
+      end != AlignUp(end)) {
+    ofs.seekp(static_cast<std::streamoff>(AlignUp(end) - 1));
+    ofs.put('\0');
+  }
+  ofs.seekp(sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(sections.data()),
+            static_cast<std::streamsize>(sizeof(ModelBundleSection) *
+                                         sections.size()));
+  ofs.close();
+  if (!ofs) {
+    std::fprintf(stderr, "failed to write %s\n",
+                 reinterpret_cast<const char*>(output.u8string().c_str()));
+    return 1;
+  }
+
+  // 書き出したものを読み直して確かめる
+  auto bundle = ModelBundle();
+  if (bundle.Open(output) != ErrorCode::kSuccess ||
+      bundle.Verify() != ErrorCode::kSuccess) {
+    std::fprintf(stderr, "verification failed: %s\n",
+                 reinterpret_cast<const char*>(output.u8string().c_str()));
+    return 1;
+  }
+  std::printf("packed %zu files into %s\n", files.size(),
+              reinterpret_cast<const char*>(output.u8string().c_str()));
+  return 0;
+}
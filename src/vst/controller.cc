@@ -178,6 +178,11 @@ auto PLUGIN_API Controller::setParamNormalized(
   for (auto&& editor : editors_) {
     editor->SyncValue(vst_param_id, plain_value_for_editor);
   }
+  // Processor が設定を反映して遅延が変わったので、ホストに問い合わせ直してもらう
+  if (param_id == common::ParameterID::kLatencySamples &&
+      componentHandler != nullptr) {
+    componentHandler->restartComponent(Steinberg::Vst::kLatencyChanged);
+  }
 
   return kResultTrue;
 }
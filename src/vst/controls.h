@@ -305,6 +305,8 @@ class FileSelector : public CTextLabel {
           CNewFileSelector::create(getFrame(), CNewFileSelector::kSelectFile);
       if (selector) {
         selector->addFileExtension(CFileExtension("TOML", "toml"));
+        selector->addFileExtension(
+            CFileExtension("Beatrice Model Bundle", "beatrice"));
         selector->run(this);  // notify に送られる
         selector->forget();
       }
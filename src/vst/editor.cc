@@ -9,6 +9,8 @@
 #include <algorithm>
 #include <cstring>
 #include <memory>
+#include <sstream>
+#include <string>
 
 #include "beatricelib/beatrice.h"
 #include "vst3sdk/pluginterfaces/vst/vsttypes.h"
@@ -23,6 +25,7 @@
 
 // Beatrice
 #include "common/error.h"
+#include "common/model_bundle.h"
 #include "common/parameter_schema.h"
 #include "common/processor_core_2.h"
 #include "vst/controller.h"
@@ -128,6 +131,8 @@ auto PLUGIN_API Editor::open(void* const parent,
              1.0f, 0.125f);
   MakeSlider(context, static_cast<ParamID>(ParameterID::kMaxSourcePitch), 2,
              1.0f, 0.125f);
+  MakeCombobox(context, static_cast<ParamID>(ParameterID::kPitchCalibration),
+               kTransparentCColor, kDarkColorScheme.on_surface);
   EndGroup(context);
   BeginGroup(context, u8"Pitch Shift");
   MakeSlider(context, static_cast<ParamID>(ParameterID::kPitchShift), 2, 1.0f,
@@ -141,6 +146,15 @@ auto PLUGIN_API Editor::open(void* const parent,
   MakeCombobox(context, static_cast<ParamID>(ParameterID::kPitchCorrectionType),
                kTransparentCColor, kDarkColorScheme.on_surface);
   EndGroup(context);
+  // 各出力のフォルマントシフトとピッチシフトはホストから操作する
+  BeginGroup(context, u8"Extra Outputs");
+  for (auto i = 0; i < common::kMaxNExtraTargets; ++i) {
+    MakeCombobox(context,
+                 static_cast<ParamID>(
+                     static_cast<int>(ParameterID::kExtraTargetVoiceBase) + i),
+                 kTransparentCColor, kDarkColorScheme.on_surface);
+  }
+  EndGroup(context);
   EndColumn(context);
 
   BeginColumn(context, kColumnWidth, kDarkColorScheme.surface_2);
@@ -152,6 +166,26 @@ auto PLUGIN_API Editor::open(void* const parent,
              0.5f);
   MakeSlider(context, static_cast<ParamID>(ParameterID::kVQNumNeighbors), 0,
              1.0f, 1.0f);
+  MakeCombobox(context, static_cast<ParamID>(ParameterID::kMorphingQuality),
+               kTransparentCColor, kDarkColorScheme.on_surface);
+  MakeSlider(context, static_cast<ParamID>(ParameterID::kVoiceCacheSize), 0,
+             1.0f, 1.0f);
+  MakeCombobox(context,
+               static_cast<ParamID>(ParameterID::kParallelPitchEstimation),
+               kTransparentCColor, kDarkColorScheme.on_surface);
+  MakeCombobox(context, static_cast<ParamID>(ParameterID::kPipelinedProcessing),
+               kTransparentCColor, kDarkColorScheme.on_surface);
+  MakeSlider(context, static_cast<ParamID>(ParameterID::kSilenceThreshold), 1,
+             1.0f, 0.1f);
+  MakeSlider(context, static_cast<ParamID>(ParameterID::kWarmUpHops), 0, 1.0f,
+             1.0f);
+  MakeSlider(context, static_cast<ParamID>(ParameterID::kRandomSeed), 0, 1.0f,
+             1.0f);
+  MakeCombobox(context, static_cast<ParamID>(ParameterID::kLockModelMemory),
+               kTransparentCColor, kDarkColorScheme.on_surface);
+  MakeCombobox(context,
+               static_cast<ParamID>(ParameterID::kHalfPrecisionEmbeddings),
+               kTransparentCColor, kDarkColorScheme.on_surface);
   MakeModelVoiceDescription(context);
   EndGroup(context);
   EndColumn(context);
@@ -341,8 +375,19 @@ void Editor::SyncModelDescription() {
         u8"issue. Please reload a valid model.");
     return;
   }
+  // 重みは使わないので、モデルバンドルは展開せずに TOML と画像だけ読む
+  auto reader = common::ModelFileReader();
+  auto toml_text = std::string();
+  if (reader.Open(file) != common::ErrorCode::kSuccess ||
+      reader.ReadConfig(toml_text) != common::ErrorCode::kSuccess) {
+    model_selector->setText("<failed to load>");
+    model_voice_description_->SetModelDescription(
+        u8"Error: The model bundle is corrupted. Please reload a valid model.");
+    return;
+  }
   try {
-    const auto toml_data = toml::parse(file);
+    auto iss = std::istringstream(toml_text);
+    const auto toml_data = toml::parse(iss);
     model_config_ = toml::get<common::ModelConfig>(toml_data);
     if (model_config_->model.VersionInt() == -1) {
       model_voice_description_->SetModelDescription(
@@ -368,13 +413,16 @@ void Editor::SyncModelDescription() {
         if (portraits_.contains(voice.portrait.path)) {
           goto load_portrait_succeeded;
         }
-        const auto portrait_file = file.parent_path() / voice.portrait.path;
-        if (!std::filesystem::exists(portrait_file) ||
-            !std::filesystem::is_regular_file(portrait_file)) {
+        auto portrait_data = std::string();
+        if (voice.portrait.path.empty() ||
+            reader.ReadFile(voice.portrait.path, portrait_data) !=
+                common::ErrorCode::kSuccess) {
           goto load_portrait_failed;
         }
-        const auto platform_bitmap = getPlatformFactory().createBitmapFromPath(
-            reinterpret_cast<const char*>(portrait_file.u8string().c_str()));
+        const auto platform_bitmap =
+            getPlatformFactory().createBitmapFromMemory(
+                portrait_data.data(),
+                static_cast<uint32_t>(portrait_data.size()));
         if (!platform_bitmap) {
           goto load_portrait_failed;
         }
@@ -542,6 +590,9 @@ void Editor::valueChanged(CControl* const pControl) {
     const auto file = control->GetPath().u8string();
     auto error_code = str_param->ControllerSetValue(core, file);
     if (error_code == common::ErrorCode::kFileOpenError ||
+        error_code == common::ErrorCode::kFileTooSmall ||
+        error_code == common::ErrorCode::kInvalidModelBundle ||
+        error_code == common::ErrorCode::kChecksumMismatch ||
         error_code == common::ErrorCode::kTOMLSyntaxError) {
       // Controller とは別に Editor::SyncModelDescription でも改めて
       // ファイルを読み込もうとして失敗するので、ここではエラー処理しない
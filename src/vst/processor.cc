@@ -2,10 +2,13 @@
 
 #include "vst/processor.h"
 
+#include <algorithm>
+#include <array>
 #include <cstring>
 #include <memory>
 #include <mutex>  // NOLINT(build/c++11)
 #include <string>
+#include <utility>
 
 #include "vst3sdk/pluginterfaces/vst/ivstparameterchanges.h"
 #include "vst3sdk/pluginterfaces/vst/vstspeaker.h"
@@ -46,6 +49,12 @@ auto PLUGIN_API Processor::initialize(FUnknown* const context) -> tresult {
   // In/Out バスの生成
   addAudioInput(STR16("AudioInput"), SpeakerArr::kMono);
   addAudioOutput(STR16("AudioOutput"), SpeakerArr::kMono);
+  // 追加の目標話者用の出力バス
+  for (auto i = 0; i < common::kMaxNExtraTargets; ++i) {
+    const auto name = u"ExtraOutput" + std::u16string(1, u'1' + i);
+    addAudioOutput(reinterpret_cast<const Steinberg::char16*>(name.c_str()),
+                   SpeakerArr::kMono, Steinberg::Vst::kAux, 0);
+  }
 
   return kResultTrue;
 }
@@ -58,14 +67,18 @@ auto PLUGIN_API Processor::setBusArrangements(SpeakerArrangement* const inputs,
                                               const int32 numIns,
                                               SpeakerArrangement* const outputs,
                                               const int32 numOuts) -> tresult {
-  // 入力バス・出力バスの数はいずれも 1
-  if (numIns == 1 && numOuts == 1 &&
-      (inputs[0] == SpeakerArr::kMono || inputs[0] == SpeakerArr::kStereo) &&
-      (outputs[0] == SpeakerArr::kMono || outputs[0] == SpeakerArr::kStereo)) {
-    return AudioEffect::setBusArrangements(inputs, numIns, outputs, numOuts);
+  // 入力バスの数は 1、出力バスの数は 1 に追加の出力バスを加えたもの以下
+  if (numIns != 1 || numOuts < 1 || numOuts > 1 + common::kMaxNExtraTargets ||
+      (inputs[0] != SpeakerArr::kMono && inputs[0] != SpeakerArr::kStereo)) {
+    return kResultFalse;
   }
-
-  return kResultFalse;
+  for (auto bus = 0; bus < numOuts; ++bus) {
+    if (outputs[bus] != SpeakerArr::kMono &&
+        outputs[bus] != SpeakerArr::kStereo) {
+      return kResultFalse;
+    }
+  }
+  return AudioEffect::setBusArrangements(inputs, numIns, outputs, numOuts);
 }
 
 // "Setup Done" の状態に遷移する
@@ -79,17 +92,31 @@ auto PLUGIN_API Processor::setupProcessing(ProcessSetup& setup) -> tresult {
   if (setup.symbolicSampleSize == Steinberg::Vst::kSample64) {
     return kResultFalse;
   }
+  // オフライン処理ではモデルの読み込みを待つ
+  vc_core_.SetOfflineProcessing(setup.processMode == Steinberg::Vst::kOffline);
   const auto error_code = vc_core_.SetSampleRate(setup.sampleRate);
   assert(error_code == common::ErrorCode::kSuccess);
+  const auto error_code_block_size =
+      vc_core_.SetMaxBlockSize(setup.maxSamplesPerBlock);
+  assert(error_code_block_size == common::ErrorCode::kSuccess);
   return AudioEffect::setupProcessing(setup);
 }
 
+// 遅延が変わると ReportStatus() で kLatencySamples を通知し、
+// それを受けた Controller が kLatencyChanged を通知してホストから再度呼ばれる
+auto PLUGIN_API Processor::getLatencySamples() -> uint32 {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return static_cast<uint32>(vc_core_.GetCore()->GetLatencySamples());
+}
+
 auto PLUGIN_API Processor::setActive(const TBool state) -> tresult {
+  std::lock_guard<std::mutex> lock(mtx_);
+  // 処理が始まるまでは、モデルをその場で読み込む
+  vc_core_.SetActive(state != 0);
   if (state) {
     // メモリの確保など
   } else {
     // メモリの解放など
-    std::lock_guard<std::mutex> lock(mtx_);
     const auto error_code = vc_core_.GetCore()->ResetContext();
     assert(error_code == common::ErrorCode::kSuccess);
   }
@@ -123,8 +150,8 @@ auto PLUGIN_API Processor::process(ProcessData& data) -> tresult {
   }
 
   std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
-  // ファイルの読み込み中はパラメータ変更の処理を先送りにし、
-  // 無音を出力する
+  // 状態の読み書き中はパラメータ変更の処理を先送りにし、
+  // 無音を出力する。モデルの読み込みはバックグラウンドで行われる
   if (!lock.owns_lock()) {
     for (auto bus = 0; bus < data.numOutputs; ++bus) {
       for (auto ch = 0; ch < data.outputs[bus].numChannels; ++ch) {
@@ -136,6 +163,11 @@ auto PLUGIN_API Processor::process(ProcessData& data) -> tresult {
     return kResultTrue;
   }
 
+  // 読み込みの終わったモデルがあれば差し替える
+  vc_core_.PublishLoadedCore();
+
+  // 同じブロック内のモーフィングの重みの変更は、まとめて 1 回で反映する
+  vc_core_.BeginParameterBatch();
   for (const auto [vst_param_id, value] : unreflected_params_) {
     const auto param_id = static_cast<common::ParameterID>(vst_param_id);
     const auto& param = common::kSchema.GetParameter(param_id);
@@ -155,7 +187,12 @@ auto PLUGIN_API Processor::process(ProcessData& data) -> tresult {
       assert(error_code == common::ErrorCode::kSuccess);
     }
   }
+  {
+    const auto error_code = vc_core_.EndParameterBatch();
+    assert(error_code == common::ErrorCode::kSuccess);
+  }
   unreflected_params_.clear();
+  ReportStatus(data);
 
   if (data.numInputs == 0 || data.numOutputs == 0 || data.numSamples == 0) {
     // 何もしない
@@ -187,42 +224,153 @@ auto PLUGIN_API Processor::process(ProcessData& data) -> tresult {
     }
   }
 
+  // 追加の出力バスのチャンネル 0。無効なバスは nullptr とする
+  auto extra_outputs = std::array<float*, common::kMaxNExtraTargets>();
+  const auto n_extra_outputs =
+      std::min(data.numOutputs - 1, common::kMaxNExtraTargets);
+  for (auto i = 0; i < n_extra_outputs; ++i) {
+    const auto& bus = data.outputs[1 + i];
+    extra_outputs[i] = bus.numChannels >= 1 ? bus.channelBuffers32[0] : nullptr;
+  }
+  // 追加の出力バスを無音にする
+  const auto silence_extra_outputs = [&] {
+    for (auto bus = 1; bus < data.numOutputs; ++bus) {
+      for (auto ch = 0; ch < data.outputs[bus].numChannels; ++ch) {
+        std::memset(data.outputs[bus].channelBuffers32[ch], 0,
+                    data.numSamples * sizeof(float));
+      }
+      data.outputs[bus].silenceFlags = 1U;
+    }
+  };
+
+  const auto is_silent = [n_samples = data.numSamples](const float* const x) {
+    return std::all_of(x, x + n_samples,
+                       [](const float v) { return v == 0.0F; });
+  };
+  // 無音区間の推論を自前で省略する ProcessorCore には、
+  // 状態が途切れないよう無音のブロックも渡す
+  const auto& core = vc_core_.GetCore();
+  const auto is_silence_gated = core->IsSilenceGated();
+
   // サイレンスフラグの確認
   if (data.inputs[0].silenceFlags) {
     data.outputs[0].silenceFlags = data.inputs[0].silenceFlags;
-    if (in0 != out0) {
+    if (in0 != out0 || is_silence_gated) {
       std::memset(out0, 0, data.numSamples * sizeof(float));
     }
-    return kResultOk;
+    if (!is_silence_gated) {
+      silence_extra_outputs();
+      return kResultOk;
+    }
   }
 
   // 無音チェック
-  auto sil = true;
-  for (auto i = 0; i < data.numSamples; ++i) {
-    if (out0[i] != 0.0F) {
-      sil = false;
-      break;
-    }
-  }
-  // TODO(bug): 遅延させる
-  if (sil) {
+  if (!is_silence_gated && is_silent(out0)) {
     data.outputs[0].silenceFlags = 1U;
+    silence_extra_outputs();
   } else {
     // VC
-    [[maybe_unused]] const auto error_code =
-        vc_core_.GetCore()->Process(out0, out0, data.numSamples);
-    // TODO(bug): error_code に基づいてサイレンスフラグを立てる
+    // 追加の出力バスがあれば、解析結果を共有して同時に処理する
+    // エラー時は ProcessorCore が出力を無音にする
+    // モデルの差し替え直後は、古いモデルの出力からクロスフェードする
+    static_cast<void>(vc_core_.ProcessMultiTarget(out0, out0,
+                                                  extra_outputs.data(),
+                                                  n_extra_outputs,
+                                                  data.numSamples));
+    // 出力が無音であればサイレンスフラグを立てる
+    for (auto bus = 0; bus < data.numOutputs; ++bus) {
+      auto& output = data.outputs[bus];
+      output.silenceFlags =
+          output.numChannels >= 1 && is_silent(output.channelBuffers32[0])
+              ? (1ULL << output.numChannels) - 1
+              : 0;
+    }
   }
 
   // 出力がステレオなら複製する
-  if (data.outputs[0].numChannels >= 2) {
-    auto* const out1 = data.outputs[0].channelBuffers32[1];
-    memcpy(out1, out0, data.numSamples * sizeof(float));
+  for (auto bus = 0; bus < data.numOutputs; ++bus) {
+    const auto& output = data.outputs[bus];
+    if (output.numChannels >= 2) {
+      memcpy(output.channelBuffers32[1], output.channelBuffers32[0],
+             data.numSamples * sizeof(float));
+    }
   }
 
   return kResultOk;
 }
 
+// 負荷に応じた品質の段階と、処理が間に合わなかった回数、遅延、
+// モデルの読み込みの結果を通知する。
+// 値は直前のブロックまでのもの
+void Processor::ReportStatus(ProcessData& data) {
+  if (data.outputParameterChanges == nullptr) {
+    return;
+  }
+  const auto add_change = [&data](const common::ParameterID param_id,
+                                  const ParamValue normalized_value) {
+    int32 queue_index;
+    auto* const queue = data.outputParameterChanges->addParameterData(
+        static_cast<ParamID>(param_id), queue_index);
+    if (queue == nullptr) {
+      return;
+    }
+    int32 point_index;
+    queue->addPoint(0, normalized_value, point_index);
+  };
+  const auto& core = vc_core_.GetCore();
+  if (const auto tier = core->GetQualityTier();
+      tier != reported_quality_tier_) {
+    add_change(common::ParameterID::kQualityTier,
+               Normalize(std::get<common::ListParameter>(
+                             common::kSchema.GetParameter(
+                                 common::ParameterID::kQualityTier)),
+                         tier));
+    reported_quality_tier_ = tier;
+  }
+  if (const auto count = core->GetDeadlineMissCount();
+      count != reported_deadline_miss_count_) {
+    add_change(common::ParameterID::kDeadlineMissCount,
+               Normalize(std::get<common::NumberParameter>(
+                             common::kSchema.GetParameter(
+                                 common::ParameterID::kDeadlineMissCount)),
+                         count));
+    reported_deadline_miss_count_ = count;
+  }
+  if (const auto latency = core->GetLatencySamples();
+      latency != reported_latency_samples_) {
+    add_change(common::ParameterID::kLatencySamples,
+               Normalize(std::get<common::NumberParameter>(
+                             common::kSchema.GetParameter(
+                                 common::ParameterID::kLatencySamples)),
+                         latency));
+    reported_latency_samples_ = latency;
+  }
+  if (const auto error = static_cast<int>(vc_core_.GetModelLoadError());
+      error != reported_model_load_error_) {
+    add_change(common::ParameterID::kModelLoadError,
+               Normalize(std::get<common::NumberParameter>(
+                             common::kSchema.GetParameter(
+                                 common::ParameterID::kModelLoadError)),
+                         error));
+    reported_model_load_error_ = error;
+  }
+  if (const auto statistics = core->GetSourcePitchStatistics();
+      statistics.n_voiced_hops != reported_n_voiced_hops_) {
+    for (const auto& [param_id, value] :
+         {std::pair(common::ParameterID::kMeasuredAverageSourcePitch,
+                    statistics.average),
+          std::pair(common::ParameterID::kMeasuredMinSourcePitch,
+                    statistics.min),
+          std::pair(common::ParameterID::kMeasuredMaxSourcePitch,
+                    statistics.max)}) {
+      const auto& param = std::get<common::NumberParameter>(
+          common::kSchema.GetParameter(param_id));
+      add_change(param_id, Normalize(param, value));
+    }
+    reported_n_voiced_hops_ = statistics.n_voiced_hops;
+  }
+}
+
 // プロジェクトやプリセットをロードした時に呼ばれる。
 // kResultFalse を返した場合、StudioRack などでは
 // Controller::setComponentState が呼ばれなくなるため注意が必要。
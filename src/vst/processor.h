@@ -40,6 +40,7 @@ class Processor : public Steinberg::Vst::AudioEffect {
 
   auto PLUGIN_API setupProcessing(ProcessSetup& setup) -> tresult SMTG_OVERRIDE;
   auto PLUGIN_API setActive(TBool state) -> tresult SMTG_OVERRIDE;
+  auto PLUGIN_API getLatencySamples() -> uint32 SMTG_OVERRIDE;
   auto PLUGIN_API process(ProcessData& data) -> tresult SMTG_OVERRIDE;
 
   auto PLUGIN_API setState(IBStream* state) -> tresult SMTG_OVERRIDE;
@@ -57,6 +58,15 @@ class Processor : public Steinberg::Vst::AudioEffect {
   common::ProcessorProxy vc_core_;
   // メモリ確保が挟まるのが望ましくないが……
   std::map<ParamID, ParamValue> unreflected_params_;
+  // ホストに最後に通知した ProcessorCore の状態
+  int reported_quality_tier_ = -1;
+  int reported_deadline_miss_count_ = -1;
+  int reported_latency_samples_ = -1;
+  int reported_model_load_error_ = -1;
+  int reported_n_voiced_hops_ = -1;
+
+  // 読み取り専用のパラメータの変更をホストに通知する
+  void ReportStatus(ProcessData& data);
 };
 
 }  // namespace beatrice::vst
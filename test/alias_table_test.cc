@@ -0,0 +1,84 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#include "common/alias_table.h"
+
+#include <array>
+#include <cmath>
+#include <random>
+
+#include "check.h"
+
+namespace {
+
+using beatrice::common::AliasTable;
+
+void TestDefault() {
+  auto table = AliasTable<4>();
+  auto engine = std::mt19937(0);
+  for (auto i = 0; i < 100; ++i) {
+    CHECK(table(engine) == 0);
+  }
+}
+
+// 正の重みに比例した頻度で選ばれ、重みが 0 以下のものは選ばれない
+void TestFrequency() {
+  constexpr auto kN = 6;
+  const auto weights = std::array<float, kN>{0.0f, 1.0f, 3.0f, -1.0f, 4.0f,
+                                             2.0f};
+  const auto indices = std::array<int, kN>{4, 2, 5, 1, 0, 3};
+  auto table = AliasTable<kN>();
+  table.Build(kN, weights.data(), indices.data());
+  auto engine = std::mt19937(1);
+  constexpr auto kNSamples = 100000;
+  auto counts = std::array<int, kN>();
+  for (auto i = 0; i < kNSamples; ++i) {
+    const auto j = table(engine);
+    CHECK(j >= 0 && j < kN);
+    if (j >= 0 && j < kN) {
+      ++counts[j];
+    }
+  }
+  CHECK(counts[0] == 0);
+  CHECK(counts[3] == 0);
+  for (const auto j : {1, 2, 4, 5}) {
+    const auto expected = kNSamples * weights[j] / 10.0;
+    CHECK(std::abs(counts[j] - expected) < 0.05 * expected);
+  }
+}
+
+// kMaxN を超える分は argsorted_indices の後ろから捨てる
+void TestTruncation() {
+  const auto weights = std::array<float, 4>{1.0f, 1.0f, 1.0f, 1.0f};
+  const auto indices = std::array<int, 4>{3, 1, 0, 2};
+  auto table = AliasTable<2>();
+  table.Build(4, weights.data(), indices.data());
+  auto engine = std::mt19937(2);
+  auto counts = std::array<int, 4>();
+  for (auto i = 0; i < 10000; ++i) {
+    ++counts[table(engine)];
+  }
+  CHECK(counts[0] == 0);
+  CHECK(counts[2] == 0);
+  CHECK(counts[1] > 4500 && counts[3] > 4500);
+}
+
+void TestNoPositiveWeight() {
+  const auto weights = std::array<float, 3>{0.0f, 0.0f, -2.0f};
+  const auto indices = std::array<int, 3>{2, 0, 1};
+  auto table = AliasTable<3>();
+  table.Build(3, weights.data(), indices.data());
+  auto engine = std::mt19937(3);
+  for (auto i = 0; i < 100; ++i) {
+    CHECK(table(engine) == 2);
+  }
+}
+
+}  // namespace
+
+auto main() -> int {
+  TestDefault();
+  TestFrequency();
+  TestTruncation();
+  TestNoPositiveWeight();
+  return beatrice::test::Result();
+}
@@ -0,0 +1,34 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#ifndef BEATRICE_TEST_CHECK_H_
+#define BEATRICE_TEST_CHECK_H_
+
+#include <cstdio>
+
+namespace beatrice::test {
+
+// 失敗した CHECK() の数
+inline int n_failures = 0;
+
+// main() の戻り値。失敗があれば 1 を返す
+inline auto Result() -> int {
+  if (n_failures > 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", n_failures);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace beatrice::test
+
+// 条件が成り立たなければ場所を表示して失敗を数える
+#define CHECK(condition)                                            \
+  do {                                                              \
+    if (!(condition)) {                                             \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,   \
+                   __LINE__, #condition);                           \
+      ++beatrice::test::n_failures;                                 \
+    }                                                               \
+  } while (false)
+
+#endif  // BEATRICE_TEST_CHECK_H_
@@ -0,0 +1,89 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#include "common/cpu_governor.h"
+
+#include <chrono>  // NOLINT(build/c++11)
+
+#include "check.h"
+
+namespace {
+
+using beatrice::common::CpuGovernor;
+using beatrice::common::QualityTier;
+
+constexpr auto kHop = std::chrono::microseconds(10000);
+
+// 負荷 load で n_hops フレームを 1 フレームずつ処理し、段階が変わった回数を返す
+auto Run(CpuGovernor& governor, const double load, const int n_hops) -> int {
+  const auto elapsed =
+      std::chrono::duration_cast<CpuGovernor::Clock::duration>(kHop * load);
+  auto n_changes = 0;
+  for (auto i = 0; i < n_hops; ++i) {
+    n_changes += governor.Update(elapsed, 1);
+  }
+  return n_changes;
+}
+
+// 既定では無効で、負荷が高くても段階を変えない
+void TestDisabledByDefault() {
+  auto governor = CpuGovernor(kHop);
+  CHECK(Run(governor, 2.0, 1000) == 0);
+  CHECK(governor.GetTier() == QualityTier::kFull);
+  CHECK(governor.GetDeadlineMissCount() == 1000);
+  CHECK(governor.GetAverageLoad() > 1.9);
+}
+
+void TestStepDownAndUp() {
+  auto governor = CpuGovernor(kHop);
+  CHECK(!governor.SetEnabled(true));
+  // 移動平均が閾値を超えるまでは下げない
+  CHECK(Run(governor, 0.9, 23) == 0);
+  CHECK(Run(governor, 0.9, 1) == 1);
+  CHECK(governor.GetTier() == QualityTier::kDeferMorphing);
+  // 下げた後は kStepDownHoldHops フレーム待つ
+  CHECK(Run(governor, 0.9, CpuGovernor::kStepDownHoldHops - 1) == 0);
+  CHECK(Run(governor, 0.9, 1) == 1);
+  CHECK(governor.GetTier() == QualityTier::kApproximateMorphing);
+  CHECK(Run(governor, 0.9, 1000) == 1);
+  CHECK(governor.GetTier() == QualityTier::kNoVQ);
+  CHECK(governor.GetDeadlineMissCount() == 0);
+
+  // 2 つの閾値の間では段階を保つ
+  CHECK(Run(governor, 0.5, 1000) == 0);
+  CHECK(governor.GetTier() == QualityTier::kNoVQ);
+
+  CHECK(Run(governor, 0.1, 10) == 0);
+  CHECK(Run(governor, 0.1, 1) == 1);
+  CHECK(governor.GetTier() == QualityTier::kApproximateMorphing);
+  // 上げた後は kStepUpHoldHops フレーム待つ
+  CHECK(Run(governor, 0.1, CpuGovernor::kStepUpHoldHops - 1) == 0);
+  CHECK(Run(governor, 0.1, 1) == 1);
+  CHECK(governor.GetTier() == QualityTier::kDeferMorphing);
+
+  // 無効にすると最高品質に戻す
+  CHECK(governor.SetEnabled(false));
+  CHECK(governor.GetTier() == QualityTier::kFull);
+  CHECK(!governor.SetEnabled(false));
+}
+
+// まとめて処理した場合はフレーム数に応じて追従し、締め切りも合計で判定する
+void TestBatch() {
+  auto governor = CpuGovernor(kHop);
+  governor.SetEnabled(true);
+  CHECK(!governor.Update(kHop * 3, 4));
+  CHECK(governor.GetDeadlineMissCount() == 0);
+  CHECK(governor.GetAverageLoad() > 0.18 && governor.GetAverageLoad() < 0.19);
+  CHECK(!governor.Update(kHop * 5, 4));
+  CHECK(governor.GetDeadlineMissCount() == 1);
+  CHECK(!governor.Update(kHop, 0));
+  CHECK(governor.GetDeadlineMissCount() == 1);
+}
+
+}  // namespace
+
+auto main() -> int {
+  TestDisabledByDefault();
+  TestStepDownAndUp();
+  TestBatch();
+  return beatrice::test::Result();
+}
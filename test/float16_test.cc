@@ -0,0 +1,96 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#include "common/float16.h"
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "check.h"
+
+namespace {
+
+using beatrice::common::ConvertToFloat;
+using beatrice::common::ConvertToFloat16;
+using beatrice::common::Float16;
+using beatrice::common::ToFloat;
+using beatrice::common::ToFloat16;
+
+auto IsNaN(const Float16 h) -> bool {
+  return (h.bits & 0x7c00u) == 0x7c00u && (h.bits & 0x03ffu) != 0;
+}
+
+// 全ての半精度の値が単精度を経由して元に戻る
+void TestRoundTrip() {
+  auto halves = std::vector<Float16>(1 << 16);
+  for (auto i = 0u; i < halves.size(); ++i) {
+    halves[i].bits = static_cast<std::uint16_t>(i);
+  }
+  auto floats = std::vector<float>(halves.size());
+  ConvertToFloat(halves.data(), floats.data(), halves.size());
+  auto back = std::vector<Float16>(halves.size());
+  ConvertToFloat16(floats.data(), back.data(), floats.size());
+  auto n_mismatches = 0;
+  for (auto i = 0u; i < halves.size(); ++i) {
+    const auto f = ToFloat(halves[i]);
+    if (IsNaN(halves[i])) {
+      n_mismatches += !std::isnan(f) || !std::isnan(floats[i]) ||
+                      !IsNaN(ToFloat16(f)) || !IsNaN(back[i]);
+      continue;
+    }
+    n_mismatches +=
+        std::bit_cast<std::uint32_t>(f) !=
+            std::bit_cast<std::uint32_t>(floats[i]) ||
+        ToFloat16(f).bits != halves[i].bits || back[i].bits != halves[i].bits;
+  }
+  CHECK(n_mismatches == 0);
+}
+
+// 丸めの境界と範囲外の値
+void TestRounding() {
+  // 1 + 2^-11 は 1 と 1 + 2^-10 のちょうど中間なので偶数側に丸める
+  CHECK(ToFloat16(1.0f + 0x1.0p-11f).bits == 0x3c00u);
+  CHECK(ToFloat16(1.0f + 0x1.8p-10f).bits == 0x3c02u);
+  CHECK(ToFloat16(1.0f + 0x1.0p-11f + 0x1.0p-20f).bits == 0x3c01u);
+  CHECK(ToFloat16(beatrice::common::kFloat16Max).bits == 0x7bffu);
+  CHECK(ToFloat16(65519.0f).bits == 0x7bffu);
+  CHECK(ToFloat16(65520.0f).bits == 0x7c00u);
+  CHECK(ToFloat16(-1.0e10f).bits == 0xfc00u);
+  // 非正規化数
+  CHECK(ToFloat16(0x1.0p-24f).bits == 0x0001u);
+  CHECK(ToFloat16(0x1.0p-25f).bits == 0x0000u);
+  CHECK(ToFloat16(0x1.8p-24f).bits == 0x0002u);
+  CHECK(ToFloat16(-0.0f).bits == 0x8000u);
+  CHECK(ToFloat(Float16{0x0001u}) == 0x1.0p-24f);
+  CHECK(ToFloat(Float16{0xc000u}) == -2.0f);
+}
+
+// まとめて変換した結果が 1 要素ずつ変換したものと一致する
+void TestBatch() {
+  constexpr auto kN = 1 << 20;
+  auto engine = std::mt19937(0);
+  auto src = std::vector<float>(kN + 5);
+  for (auto&& x : src) {
+    x = std::bit_cast<float>(static_cast<std::uint32_t>(engine()));
+  }
+  auto dst = std::vector<Float16>(src.size());
+  ConvertToFloat16(src.data(), dst.data(), src.size());
+  auto n_mismatches = 0;
+  for (auto i = 0u; i < src.size(); ++i) {
+    const auto expected = ToFloat16(src[i]);
+    n_mismatches += std::isnan(src[i]) ? !IsNaN(dst[i])
+                                       : dst[i].bits != expected.bits;
+  }
+  CHECK(n_mismatches == 0);
+}
+
+}  // namespace
+
+auto main() -> int {
+  TestRoundTrip();
+  TestRounding();
+  TestBatch();
+  return beatrice::test::Result();
+}
@@ -0,0 +1,207 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#include "common/model_bundle.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "common/error.h"
+
+namespace {
+
+using beatrice::common::Crc32c;
+using beatrice::common::ErrorCode;
+using beatrice::common::kModelBundleAlignment;
+using beatrice::common::ModelBundle;
+using beatrice::common::ModelBundleHeader;
+using beatrice::common::ModelBundleSection;
+
+auto AsBytes(const std::string_view s) -> const std::byte* {
+  return reinterpret_cast<const std::byte*>(s.data());
+}
+
+// 1 ビットずつ計算する CRC-32C
+auto ReferenceCrc32c(const std::byte* const data, const std::size_t size)
+    -> std::uint32_t {
+  auto c = ~std::uint32_t{0};
+  for (auto i = std::size_t{0}; i < size; ++i) {
+    c ^= static_cast<std::uint32_t>(data[i]);
+    for (auto k = 0; k < 8; ++k) {
+      c = (c & 1) != 0 ? 0x82f63b78u ^ (c >> 1) : c >> 1;
+    }
+  }
+  return ~c;
+}
+
+void TestCrc32c() {
+  CHECK(Crc32c(AsBytes("123456789"), 9) == 0xe3069283u);
+  CHECK(Crc32c(nullptr, 0) == 0);
+  auto engine = std::mt19937(0);
+  auto data = std::vector<std::byte>(1000);
+  for (auto&& b : data) {
+    b = static_cast<std::byte>(engine());
+  }
+  // 8 バイト単位の命令で処理する部分と端数の部分
+  for (auto size = std::size_t{0}; size <= 40; ++size) {
+    CHECK(Crc32c(data.data() + 3, size) ==
+          ReferenceCrc32c(data.data() + 3, size));
+  }
+  // 続きから計算する
+  const auto whole = Crc32c(data.data(), data.size());
+  CHECK(whole == ReferenceCrc32c(data.data(), data.size()));
+  CHECK(Crc32c(data.data() + 333, data.size() - 333,
+               Crc32c(data.data(), 333)) == whole);
+}
+
+struct Entry {
+  std::string name;
+  std::string contents;
+};
+
+// pack_model_bundle と同じ形式のバンドルを作る
+auto MakeBundle(const std::vector<Entry>& entries) -> std::string {
+  auto header = ModelBundleHeader{
+      .magic = beatrice::common::kModelBundleMagic,
+      .format_version = beatrice::common::kModelBundleFormatVersion,
+      .n_sections = static_cast<std::uint32_t>(entries.size())};
+  auto bundle = std::string(sizeof(header), '\0');
+  std::memcpy(bundle.data(), &header, sizeof(header));
+  auto offset = sizeof(header) + entries.size() * sizeof(ModelBundleSection);
+  auto body = std::string();
+  for (const auto& entry : entries) {
+    offset = (offset + kModelBundleAlignment - 1) / kModelBundleAlignment *
+             kModelBundleAlignment;
+    auto section = ModelBundleSection{
+        .offset = offset,
+        .size = entry.contents.size(),
+        .checksum = Crc32c(AsBytes(entry.contents), entry.contents.size()),
+        .name_length = static_cast<std::uint32_t>(entry.name.size()),
+        .name = {}};
+    std::memcpy(section.name.data(), entry.name.data(), entry.name.size());
+    bundle.append(reinterpret_cast<const char*>(&section), sizeof(section));
+    body.resize(offset - sizeof(header) -
+                entries.size() * sizeof(ModelBundleSection));
+    body += entry.contents;
+    offset += entry.contents.size();
+  }
+  return bundle + body;
+}
+
+class TemporaryFile {
+ public:
+  explicit TemporaryFile(const std::string& contents)
+      : path_(std::filesystem::temp_directory_path() /
+              ("beatrice_model_bundle_test_" +
+               std::to_string(std::random_device()()) + ".beatrice")) {
+    auto ofs = std::ofstream(path_, std::ios::binary);
+    ofs.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+  }
+  ~TemporaryFile() {
+    auto ec = std::error_code();
+    std::filesystem::remove(path_, ec);
+  }
+  [[nodiscard]] auto GetPath() const -> const std::filesystem::path& {
+    return path_;
+  }
+
+ private:
+  std::filesystem::path path_;
+};
+
+auto Open(const std::string& contents) -> ErrorCode {
+  const auto file = TemporaryFile(contents);
+  auto bundle = ModelBundle();
+  return bundle.Open(file.GetPath());
+}
+
+const auto kEntries = std::vector<Entry>{
+    {"model/model.toml", "[model]\nversion = \"2.0.0-rc.0\"\n"},
+    {"model/weights.bin", std::string(5000, 'w')},
+    {"model/images/a.png", "png"},
+};
+
+void TestOpen() {
+  const auto file = TemporaryFile(MakeBundle(kEntries));
+  CHECK(ModelBundle::IsBundleFile(file.GetPath()));
+  CHECK(!ModelBundle::IsBundleFile("model.toml"));
+  auto bundle = ModelBundle();
+  CHECK(bundle.Open(file.GetPath()) == ErrorCode::kSuccess);
+  CHECK(bundle.IsOpen());
+  CHECK(bundle.GetSections().size() == kEntries.size());
+  CHECK(bundle.GetConfigName() == u8"model/model.toml");
+  CHECK(bundle.Verify() == ErrorCode::kSuccess);
+  const auto* const section =
+      bundle.FindSection("model/./images/../weights.bin");
+  CHECK(section != nullptr);
+  CHECK(bundle.FindSection("model/missing.bin") == nullptr);
+  if (section != nullptr) {
+    auto contents = std::string();
+    CHECK(ModelBundle::ReadSection(*section, contents) ==
+          ErrorCode::kSuccess);
+    CHECK(contents == kEntries[1].contents);
+  }
+}
+
+void TestCorruption() {
+  auto contents = MakeBundle(kEntries);
+  contents.back() ^= 1;
+  const auto file = TemporaryFile(contents);
+  auto bundle = ModelBundle();
+  CHECK(bundle.Open(file.GetPath()) == ErrorCode::kSuccess);
+  CHECK(bundle.Verify() == ErrorCode::kChecksumMismatch);
+  auto section = std::string();
+  CHECK(ModelBundle::ReadSection(bundle.GetSections()[0], section) ==
+        ErrorCode::kSuccess);
+  CHECK(ModelBundle::ReadSection(bundle.GetSections()[2], section) ==
+        ErrorCode::kChecksumMismatch);
+}
+
+// 索引が壊れていれば Open() の時点で失敗する
+void TestInvalidIndex() {
+  const auto valid = MakeBundle(kEntries);
+  CHECK(Open(valid.substr(0, 10)) == ErrorCode::kFileTooSmall);
+  CHECK(Open(valid.substr(0, sizeof(ModelBundleHeader) + 100)) ==
+        ErrorCode::kFileTooSmall);
+
+  auto bad_magic = valid;
+  bad_magic[0] = 'X';
+  CHECK(Open(bad_magic) == ErrorCode::kInvalidModelBundle);
+
+  auto bad_version = valid;
+  bad_version[8] = 2;
+  CHECK(Open(bad_version) == ErrorCode::kInvalidModelBundle);
+
+  // 最後のセクションがファイルからはみ出す
+  CHECK(Open(valid.substr(0, valid.size() - 1)) ==
+        ErrorCode::kInvalidModelBundle);
+
+  for (const auto* const name : {"../model.toml", "/model.toml",
+                                 "model/./model.toml", "model/../x"}) {
+    auto entries = kEntries;
+    entries[1].name = name;
+    CHECK(Open(MakeBundle(entries)) == ErrorCode::kInvalidModelBundle);
+  }
+  auto entries = kEntries;
+  entries[2].name.clear();
+  CHECK(Open(MakeBundle(entries)) == ErrorCode::kInvalidModelBundle);
+}
+
+}  // namespace
+
+auto main() -> int {
+  TestCrc32c();
+  TestOpen();
+  TestCorruption();
+  TestInvalidIndex();
+  return beatrice::test::Result();
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#include "common/pitch_calibrator.h"
+
+#include <cmath>
+
+#include "check.h"
+
+namespace {
+
+using Calibrator = beatrice::common::PitchCalibrator<448>;
+
+auto IsNear(const double a, const double b) -> bool {
+  return std::abs(a - b) < 1e-4;
+}
+
+// 結果は kPublishIntervalHops フレームごとに更新する
+void TestPublishInterval() {
+  auto calibrator = Calibrator();
+  for (auto i = 0; i < Calibrator::kPublishIntervalHops - 1; ++i) {
+    calibrator.Add(200);
+  }
+  // 無声と範囲外のものは数えない
+  calibrator.Add(0);
+  calibrator.Add(-1);
+  calibrator.Add(448);
+  CHECK(calibrator.GetStatistics().n_voiced_hops == 0);
+  calibrator.Add(200);
+  const auto statistics = calibrator.GetStatistics();
+  CHECK(statistics.n_voiced_hops == Calibrator::kPublishIntervalHops);
+  CHECK(IsNear(statistics.average, Calibrator::BinToNote(200)));
+  calibrator.Reset();
+  CHECK(calibrator.GetStatistics().n_voiced_hops == 0);
+}
+
+// 範囲は両端の kRangeQuantile の外れ値を除いて求める
+void TestQuantiles() {
+  auto calibrator = Calibrator();
+  calibrator.Add(10);
+  calibrator.Add(440);
+  for (auto i = 0; i < 49; ++i) {
+    calibrator.Add(150);
+    calibrator.Add(250);
+  }
+  const auto statistics = calibrator.GetStatistics();
+  CHECK(statistics.n_voiced_hops == 100);
+  CHECK(IsNear(statistics.min,
+               Calibrator::BinToNote(150) - Calibrator::kRangeMargin));
+  CHECK(IsNear(statistics.max,
+               Calibrator::BinToNote(250) + Calibrator::kRangeMargin));
+  // 平均は外れ値も含める
+  const auto sum = Calibrator::BinToNote(10) + Calibrator::BinToNote(440) +
+                   49 * (Calibrator::BinToNote(150) +
+                         Calibrator::BinToNote(250));
+  CHECK(IsNear(statistics.average, sum / 100));
+
+  // 外れ値の割合が kRangeQuantile を超えれば範囲に含める
+  for (auto i = 0; i < 10; ++i) {
+    calibrator.Add(440);
+  }
+  CHECK(IsNear(calibrator.GetStatistics().max,
+               std::min(Calibrator::BinToNote(440) + Calibrator::kRangeMargin,
+                        128.0)));
+}
+
+}  // namespace
+
+auto main() -> int {
+  TestPublishInterval();
+  TestQuantiles();
+  return beatrice::test::Result();
+}
@@ -0,0 +1,143 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#include "common/spherical_average.h"
+
+#include <array>
+#include <cmath>
+#include <numbers>
+#include <random>
+
+#include "check.h"
+#include "common/float16.h"
+
+namespace {
+
+using beatrice::common::Float16;
+using beatrice::common::SphericalAverage;
+
+constexpr auto kM = 16;
+constexpr auto kNPoints = 8;
+using Average = SphericalAverage<float, kM>;
+using Points = std::array<float, kNPoints * kM>;
+using Vector = std::array<float, kM>;
+
+auto Solve(Average& average, const float* const weights,
+           const int* const indices = nullptr) -> Vector {
+  average.SetWeights(kNPoints, weights, indices);
+  for (auto i = 0; i < 1000 && !average.Update(); ++i) {
+  }
+  alignas(64) auto result = Vector();
+  average.GetResult(kM, result.data());
+  return result;
+}
+
+auto MaxAbsDiff(const Vector& a, const Vector& b) -> float {
+  auto d = 0.0f;
+  for (auto i = 0; i < kM; ++i) {
+    d = std::max(d, std::abs(a[i] - b[i]));
+  }
+  return d;
+}
+
+// 互いに近い、正規化していない点
+void MakePoints(Points& points) {
+  auto engine = std::mt19937(0);
+  auto dist = std::normal_distribution<float>();
+  auto base = Vector();
+  for (auto&& x : base) {
+    x = dist(engine);
+  }
+  for (auto n = 0; n < kNPoints; ++n) {
+    const auto scale = 1.0f + 0.1f * n;
+    for (auto i = 0; i < kM; ++i) {
+      points[n * kM + i] = scale * (base[i] + 0.5f * dist(engine));
+    }
+  }
+}
+
+// 直交する 2 点の球面上の重み付き平均は、角度を重みで内分した点になる
+void TestOrthogonalPoints() {
+  alignas(64) auto points = Points();
+  points[0 * kM + 0] = 1.0f;
+  points[1 * kM + 1] = 1.0f;
+  points[2 * kM + 2] = 1.0f;
+  auto average = Average(kNPoints, kM, points.data());
+
+  const auto equal = std::array<float, kNPoints>{1.0f, 1.0f};
+  auto result = Solve(average, equal.data());
+  CHECK(std::abs(result[0] - std::numbers::sqrt2_v<float> / 2) < 1e-5f);
+  CHECK(std::abs(result[1] - std::numbers::sqrt2_v<float> / 2) < 1e-5f);
+  CHECK(std::abs(average.GetApproximationAngle()) < 1e-3f);
+
+  const auto skewed = std::array<float, kNPoints>{3.0f, 1.0f};
+  result = Solve(average, skewed.data());
+  const auto theta = std::numbers::pi_v<float> / 8;
+  CHECK(std::abs(result[0] - std::cos(theta)) < 1e-5f);
+  CHECK(std::abs(result[1] - std::sin(theta)) < 1e-5f);
+  // 線形ブレンドを正規化したものは atan(1/3) の方向になる
+  CHECK(std::abs(average.GetApproximationAngle() -
+                 (theta - std::atan(1.0f / 3.0f))) < 1e-4f);
+
+  const auto three = std::array<float, kNPoints>{1.0f, 1.0f, 1.0f};
+  result = Solve(average, three.data());
+  for (auto i = 0; i < 3; ++i) {
+    CHECK(std::abs(result[i] - 1.0f / std::sqrt(3.0f)) < 1e-5f);
+  }
+}
+
+// 前回と共通する点の内積を使い回しても、作り直した場合と同じ結果になる
+void TestGramReuse() {
+  alignas(64) auto points = Points();
+  MakePoints(points);
+  const auto w1 = std::array<float, kNPoints>{0.1f, 0.4f, 0.0f, 0.2f,
+                                              0.3f, 0.0f, 0.0f, 0.0f};
+  const auto i1 = std::array<int, kNPoints>{1, 4, 3, 0, 2, 5, 6, 7};
+  // 点の並びを変え、一部を入れ替える
+  const auto w2 = std::array<float, kNPoints>{0.0f, 0.2f, 0.0f, 0.3f,
+                                              0.1f, 0.0f, 0.4f, 0.0f};
+  const auto i2 = std::array<int, kNPoints>{6, 3, 1, 4, 0, 2, 5, 7};
+
+  auto reused = Average(kNPoints, kM, points.data(), 4);
+  auto fresh = Average(kNPoints, kM, points.data(), 4);
+  Solve(reused, w1.data(), i1.data());
+  CHECK(MaxAbsDiff(Solve(reused, w2.data(), i2.data()),
+                   Solve(fresh, w2.data(), i2.data())) < 1e-6f);
+  // 重みだけを変える
+  auto w3 = w2;
+  w3[6] = 0.1f;
+  w3[1] = 0.5f;
+  auto fresh3 = Average(kNPoints, kM, points.data(), 4);
+  CHECK(MaxAbsDiff(Solve(reused, w3.data(), i2.data()),
+                   Solve(fresh3, w3.data(), i2.data())) < 1e-6f);
+  // 並べ替えずに渡す
+  auto fresh4 = Average(kNPoints, kM, points.data());
+  CHECK(MaxAbsDiff(Solve(reused, w1.data()), Solve(fresh4, w1.data())) <
+        1e-6f);
+}
+
+// 半精度で保持した点は、単精度に戻した点と同じ結果になる
+void TestHalfPrecision() {
+  alignas(64) auto points = Points();
+  MakePoints(points);
+  alignas(64) auto halves = std::array<Float16, kNPoints * kM>();
+  beatrice::common::ConvertToFloat16(points.data(), halves.data(),
+                                     points.size());
+  beatrice::common::ConvertToFloat(halves.data(), points.data(),
+                                   points.size());
+  auto average = Average(kNPoints, kM, points.data());
+  auto half_average = Average();
+  half_average.Initialize(kNPoints, kM, halves.data());
+  const auto weights = std::array<float, kNPoints>{0.3f, 0.0f, 0.1f, 0.2f,
+                                                   0.0f, 0.2f, 0.1f, 0.1f};
+  CHECK(MaxAbsDiff(Solve(average, weights.data()),
+                   Solve(half_average, weights.data())) < 1e-6f);
+}
+
+}  // namespace
+
+auto main() -> int {
+  TestOrthogonalPoints();
+  TestGramReuse();
+  TestHalfPrecision();
+  return beatrice::test::Result();
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2024-2025 Project Beatrice and Contributors
+
+#include "common/state_mailbox.h"
+
+#include <array>
+#include <cmath>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "check.h"
+
+namespace {
+
+using beatrice::common::StateMailbox;
+
+// 受け取られる前に上書きされた値は捨てられ、最新の値だけが届く
+void TestLatestValue() {
+  auto mailbox = StateMailbox<3>();
+  auto value = 0.0;
+  CHECK(!mailbox.BeginTake());
+  mailbox.Post(1, 2.0);
+  mailbox.Post(1, 3.0);
+  mailbox.Post(2, -1.0);
+  CHECK(mailbox.BeginTake());
+  CHECK(!mailbox.Take(0, value));
+  CHECK(mailbox.Take(1, value) && value == 3.0);
+  CHECK(!mailbox.Take(1, value));
+  CHECK(mailbox.Take(2, value) && value == -1.0);
+  CHECK(!mailbox.BeginTake());
+}
+
+// 別のスレッドから Post() しても、最後の値は必ず届き、順序も逆転しない
+void TestConcurrentPost() {
+  constexpr auto kNPosts = 100000;
+  auto mailbox = StateMailbox<2>();
+  auto producer = std::thread([&] {
+    for (auto i = 1; i <= kNPosts; ++i) {
+      mailbox.Post(0, i);
+      mailbox.Post(1, -i);
+    }
+  });
+  auto last = std::array<double, 2>{0.0, 0.0};
+  auto is_ordered = true;
+  while (last[0] < kNPosts || last[1] > -kNPosts) {
+    if (!mailbox.BeginTake()) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (auto slot = 0; slot < 2; ++slot) {
+      auto value = 0.0;
+      if (mailbox.Take(slot, value)) {
+        is_ordered = is_ordered && std::abs(value) > std::abs(last[slot]);
+        last[slot] = value;
+      }
+    }
+  }
+  producer.join();
+  CHECK(is_ordered);
+  CHECK(last[0] == kNPosts);
+  CHECK(last[1] == -kNPosts);
+}
+
+}  // namespace
+
+auto main() -> int {
+  TestLatestValue();
+  TestConcurrentPost();
+  return beatrice::test::Result();
+}